@@ -0,0 +1,230 @@
+﻿// AtomicFile.cpp
+#include "AtomicFile.h"
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Next to the target, so the rename stays within one file system. The extension keeps the
+// project explorer from picking it up meanwhile.
+constexpr const char* kTemporarySuffix = ".lightedit-save";
+
+#ifdef _WIN32
+constexpr size_t kBufferSize = 1u << 20;
+// Pieces this large are written directly instead of being copied into the buffer
+constexpr size_t kDirectWriteSize = 64u << 10;
+#else
+// Pieces per writev call
+constexpr size_t kMaxPieces = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#endif
+
+std::string ResolvePath(const std::string& path) {
+    std::error_code ec;
+    if (fs::is_symlink(path, ec)) {
+        const fs::path target = fs::canonical(path, ec);
+        if (!ec)
+            return target.string();
+    }
+    return path;
+}
+
+} // namespace
+
+AtomicFile::~AtomicFile() {
+    Discard();
+}
+
+#ifdef _WIN32
+
+bool AtomicFile::Open(const std::string& path) {
+    Discard();
+    mPath = ResolvePath(path);
+    mTemporaryPath = mPath + kTemporarySuffix;
+    mFailed = false;
+
+    HANDLE file = CreateFileA(mTemporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    mFile = file;
+    mBuffer.reserve(kBufferSize);
+    return true;
+}
+
+bool AtomicFile::Write(const char* data, size_t size) {
+    if (mFile == nullptr || mFailed)
+        return false;
+    if (size < kDirectWriteSize) {
+        if (mBuffer.size() + size > kBufferSize && !Flush())
+            return false;
+        mBuffer.insert(mBuffer.end(), data, data + size);
+        return true;
+    }
+
+    if (!Flush())
+        return false;
+    while (size > 0) {
+        DWORD written = 0;
+        const DWORD count = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        if (!WriteFile(mFile, data, count, &written, nullptr) || written == 0) {
+            mFailed = true;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool AtomicFile::Flush() {
+    const char* data = mBuffer.data();
+    size_t size = mBuffer.size();
+    while (size > 0) {
+        DWORD written = 0;
+        if (!WriteFile(mFile, data, static_cast<DWORD>(size), &written, nullptr) || written == 0) {
+            mFailed = true;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    mBuffer.clear();
+    return true;
+}
+
+bool AtomicFile::Commit() {
+    if (mFile == nullptr || mFailed || !Flush() || !FlushFileBuffers(mFile)) {
+        Discard();
+        return false;
+    }
+    CloseHandle(mFile);
+    mFile = nullptr;
+
+    if (!MoveFileExA(mTemporaryPath.c_str(), mPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Discard();
+        return false;
+    }
+    mTemporaryPath.clear();
+    return true;
+}
+
+void AtomicFile::Discard() {
+    if (mFile) {
+        CloseHandle(mFile);
+        mFile = nullptr;
+    }
+    if (!mTemporaryPath.empty()) {
+        DeleteFileA(mTemporaryPath.c_str());
+        mTemporaryPath.clear();
+    }
+    mBuffer.clear();
+}
+
+#else
+
+bool AtomicFile::Open(const std::string& path) {
+    Discard();
+    mPath = ResolvePath(path);
+    mTemporaryPath = mPath + kTemporarySuffix;
+    mFailed = false;
+
+    const int fd = open(mTemporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        mTemporaryPath.clear();
+        return false;
+    }
+    // The new file keeps the permissions of the one it replaces
+    struct stat info;
+    if (stat(mPath.c_str(), &info) == 0)
+        fchmod(fd, info.st_mode & 07777);
+    mFd = fd;
+    mPieces.reserve(kMaxPieces);
+    return true;
+}
+
+bool AtomicFile::Write(const char* data, size_t size) {
+    if (mFd < 0 || mFailed)
+        return false;
+    if (size == 0)
+        return true;
+    if (mPieces.size() == kMaxPieces && !Flush())
+        return false;
+    mPieces.push_back({ const_cast<char*>(data), size });
+    return true;
+}
+
+bool AtomicFile::Flush() {
+    iovec* pieces = mPieces.data();
+    int count = static_cast<int>(mPieces.size());
+    while (count > 0) {
+        ssize_t written = writev(mFd, pieces, count);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            mFailed = true;
+            return false;
+        }
+        // Skip what made it, the kernel may stop anywhere
+        while (count > 0 && static_cast<size_t>(written) >= pieces->iov_len) {
+            written -= pieces->iov_len;
+            ++pieces;
+            --count;
+        }
+        if (count > 0) {
+            pieces->iov_base = static_cast<char*>(pieces->iov_base) + written;
+            pieces->iov_len -= written;
+        }
+    }
+    mPieces.clear();
+    return true;
+}
+
+bool AtomicFile::Commit() {
+    if (mFd < 0 || mFailed || !Flush() || fsync(mFd) != 0) {
+        Discard();
+        return false;
+    }
+    const int closed = close(mFd);
+    mFd = -1;
+    if (closed != 0 || rename(mTemporaryPath.c_str(), mPath.c_str()) != 0) {
+        Discard();
+        return false;
+    }
+    mTemporaryPath.clear();
+
+    // Makes the rename itself survive a crash
+    const std::string directory = fs::path(mPath).parent_path().string();
+    const int directoryFd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (directoryFd >= 0) {
+        fsync(directoryFd);
+        close(directoryFd);
+    }
+    return true;
+}
+
+void AtomicFile::Discard() {
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+    if (!mTemporaryPath.empty()) {
+        unlink(mTemporaryPath.c_str());
+        mTemporaryPath.clear();
+    }
+    mPieces.clear();
+}
+
+#endif
@@ -0,0 +1,50 @@
+﻿// AtomicFile.h
+#pragma once
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+// Replaces a file as a whole or not at all. Everything is written to a temporary file next to
+// the target, which is flushed to disk and only then renamed over it, so a crash in between
+// leaves the old file intact.
+//
+// Write doesn't copy: the pieces are gathered and handed to the OS in a few large writes
+// (writev), so callers can write straight from their own storage.
+class AtomicFile {
+public:
+    AtomicFile() = default;
+    ~AtomicFile();
+    AtomicFile(const AtomicFile&) = delete;
+    AtomicFile& operator=(const AtomicFile&) = delete;
+
+    // Creates the temporary file for path. A symbolic link is followed, the file it points to
+    // is replaced instead of the link.
+    bool Open(const std::string& path);
+
+    // Queues size bytes at data, which have to stay valid until Commit
+    bool Write(const char* data, size_t size);
+
+    // Writes what is queued, flushes it to disk and moves the file into place
+    bool Commit();
+
+    // Deletes the temporary file, leaving the target as it was. Called by the destructor when
+    // Commit wasn't.
+    void Discard();
+
+private:
+    bool Flush();
+
+    std::string mPath;
+    std::string mTemporaryPath;
+    bool mFailed = false;
+#ifdef _WIN32
+    void* mFile = nullptr;
+    std::vector<char> mBuffer; // small pieces are collected here, Windows has no writev
+#else
+    int mFd = -1;
+    std::vector<iovec> mPieces;
+#endif
+};
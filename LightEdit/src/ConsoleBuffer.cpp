@@ -0,0 +1,118 @@
+﻿// ConsoleBuffer.cpp
+#include "ConsoleBuffer.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+ConsoleBuffer::ConsoleBuffer(size_t maxLines)
+    : mMaxLines(std::max<size_t>(1, maxLines)) {
+}
+
+// Returns room for size more bytes at the end of the last chunk, starting a new chunk when it
+// does not fit. Chunks never grow past their reserved capacity, so the text never moves.
+char* ConsoleBuffer::Reserve(size_t size) {
+    if (mChunks.empty() || mChunks.back().capacity() - mChunks.back().size() < size) {
+        mChunks.emplace_back();
+        mChunks.back().reserve(std::max(kChunkSize, size));
+    }
+    std::string& chunk = mChunks.back();
+    chunk.resize(chunk.size() + size);
+    return chunk.data() + chunk.size() - size;
+}
+
+void ConsoleBuffer::Append(std::string_view text) {
+    while (!text.empty()) {
+        const size_t eol = text.find('\n');
+        const bool terminated = eol != std::string_view::npos;
+        std::string_view part = text.substr(0, terminated ? eol : text.size());
+        text.remove_prefix(terminated ? eol + 1 : text.size());
+        if (terminated && !part.empty() && part.back() == '\r')
+            part.remove_suffix(1);
+
+        if (!mLineOpen) {
+            char* dest = Reserve(part.size());
+            memcpy(dest, part.data(), part.size());
+            const std::string& chunk = mChunks.back();
+            mLines.push_back({ mFirstChunk + mChunks.size() - 1, static_cast<uint32_t>(dest - chunk.data()), static_cast<uint32_t>(part.size()) });
+        }
+        else {
+            // The open line is always the last text of the last chunk; move it if the rest won't fit
+            LineRef& line = mLines.back();
+            const std::string& last = mChunks.back();
+            if (last.capacity() - last.size() >= part.size()) {
+                memcpy(Reserve(part.size()), part.data(), part.size());
+            }
+            else {
+                std::string_view start = GetLine(mLines.size() - 1);
+                mChunks.emplace_back();
+                mChunks.back().reserve(std::max(kChunkSize, start.size() + part.size()));
+                mChunks.back().append(start).append(part);
+                line.chunk = mFirstChunk + mChunks.size() - 1;
+                line.offset = 0;
+            }
+            line.length += static_cast<uint32_t>(part.size());
+        }
+        mLineOpen = !terminated;
+    }
+    Trim();
+}
+
+void ConsoleBuffer::AddLine(std::string_view line) {
+    Append(line);
+    Append("\n");
+}
+
+void ConsoleBuffer::Clear() {
+    mChunks.clear();
+    mLines.clear();
+    mFirstChunk = 0;
+    mFirstLineNumber = 0;
+    mLineOpen = false;
+}
+
+void ConsoleBuffer::SetMaxLines(size_t maxLines) {
+    mMaxLines = std::max<size_t>(1, maxLines);
+    Trim();
+}
+
+void ConsoleBuffer::Trim() {
+    while (mLines.size() > mMaxLines) {
+        mLines.pop_front();
+        ++mFirstLineNumber;
+    }
+
+    // Chunks in front of the first line hold nothing but dropped lines
+    const size_t firstUsed = mLines.empty() ? mFirstChunk + mChunks.size() : mLines.front().chunk;
+    while (mFirstChunk < firstUsed && mChunks.size() > 1) {
+        mChunks.pop_front();
+        ++mFirstChunk;
+    }
+}
+
+std::string_view ConsoleBuffer::GetLine(size_t index) const {
+    const LineRef& line = mLines[index];
+    return std::string_view(mChunks[line.chunk - mFirstChunk].data() + line.offset, line.length);
+}
+
+size_t ConsoleBuffer::Find(std::string_view needle, size_t index, bool forward) const {
+    const size_t count = mLines.size();
+    if (needle.empty() || count == 0)
+        return kNotFound;
+
+    if (index >= count)
+        index = forward ? count - 1 : 0;
+    for (size_t step = 1; step <= count; ++step) {
+        const size_t i = forward ? (index + step) % count : (index + count - step % count) % count;
+        if (Contains(GetLine(i), needle))
+            return i;
+    }
+    return kNotFound;
+}
+
+bool ConsoleBuffer::Contains(std::string_view text, std::string_view needle) {
+    auto equal = [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    };
+    return std::search(text.begin(), text.end(), needle.begin(), needle.end(), equal) != text.end();
+}
+
@@ -0,0 +1,59 @@
+﻿// ConsoleBuffer.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+// Append-only log text with a line index, capped at a maximum number of lines. The text lives in
+// fixed-size chunks that are never reallocated, so appending is cheap however long the log gets,
+// and the oldest chunks are released as their lines drop off the front.
+class ConsoleBuffer {
+public:
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+    explicit ConsoleBuffer(size_t maxLines = 100000);
+
+    // Appends text that may contain several lines. A last line without a line break stays open
+    // and is continued by the next call. "\r\n" line breaks are stored as plain lines.
+    void Append(std::string_view text);
+    void AddLine(std::string_view line);
+    void Clear();
+
+    void SetMaxLines(size_t maxLines);
+    size_t GetMaxLines() const { return mMaxLines; }
+
+    // Lines are addressed by index in the buffer, 0 being the oldest line still kept. The number
+    // of the first line counts every line dropped since the last Clear, so an index plus
+    // GetFirstLineNumber identifies a line even after older ones were dropped.
+    size_t GetLineCount() const { return mLines.size(); }
+    size_t GetFirstLineNumber() const { return mFirstLineNumber; }
+    std::string_view GetLine(size_t index) const;
+
+    // Index of the next line after (or before) index containing needle, ignoring case, wrapping
+    // around at the ends. index may be kNotFound to start at the first (or last) line.
+    size_t Find(std::string_view needle, size_t index, bool forward) const;
+
+    // Whether text contains needle, ignoring case
+    static bool Contains(std::string_view text, std::string_view needle);
+
+private:
+    static constexpr size_t kChunkSize = 64 * 1024;
+
+    struct LineRef {
+        size_t chunk;       // counted from the first chunk ever added, see mFirstChunk
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    char* Reserve(size_t size);
+    void Trim();
+
+    std::deque<std::string> mChunks;
+    size_t mFirstChunk = 0;
+    std::deque<LineRef> mLines;
+    size_t mFirstLineNumber = 0;
+    size_t mMaxLines;
+    bool mLineOpen = false;
+};
@@ -0,0 +1,110 @@
+﻿// Diagnostics.cpp
+#include "Diagnostics.h"
+#include <cctype>
+
+namespace {
+
+bool ParseNumber(std::string_view text, int& value) {
+    if (text.empty() || text.size() > 9)
+        return false;
+    value = 0;
+    for (char c : text) {
+        if (!isdigit(static_cast<unsigned char>(c)))
+            return false;
+        value = value * 10 + (c - '0');
+    }
+    return value > 0;
+}
+
+// Splits "file:line:col", "file:line", "file(line,col)" or "file(line)" into its parts
+bool ParseLocation(std::string_view location, Diagnostic& diagnostic) {
+    diagnostic.column = 0;
+
+    if (!location.empty() && location.back() == ')') {
+        const size_t open = location.rfind('(');
+        if (open == std::string_view::npos || open == 0)
+            return false;
+
+        std::string_view numbers = location.substr(open + 1, location.size() - open - 2);
+        const size_t comma = numbers.find(',');
+        if (comma != std::string_view::npos) {
+            if (!ParseNumber(numbers.substr(comma + 1), diagnostic.column))
+                return false;
+            numbers = numbers.substr(0, comma);
+        }
+        if (!ParseNumber(numbers, diagnostic.line))
+            return false;
+        location = location.substr(0, open);
+    }
+    else {
+        // Parsed from the right, so drive letters in Windows paths don't get in the way
+        size_t colon = location.rfind(':');
+        if (colon == std::string_view::npos || !ParseNumber(location.substr(colon + 1), diagnostic.line))
+            return false;
+        location = location.substr(0, colon);
+
+        colon = location.rfind(':');
+        int line = 0;
+        if (colon != std::string_view::npos && ParseNumber(location.substr(colon + 1), line)) {
+            diagnostic.column = diagnostic.line;
+            diagnostic.line = line;
+            location = location.substr(0, colon);
+        }
+    }
+
+    // MSBuild indents and prefixes the output of parallel project builds with "1>"
+    while (!location.empty() && isspace(static_cast<unsigned char>(location.front())))
+        location.remove_prefix(1);
+    size_t start = 0;
+
+    while (start < location.size() && isdigit(static_cast<unsigned char>(location[start])))
+        ++start;
+    if (start > 0 && start < location.size() && location[start] == '>')
+        location.remove_prefix(start + 1);
+    while (!location.empty() && isspace(static_cast<unsigned char>(location.front())))
+        location.remove_prefix(1);
+
+    if (location.empty())
+        return false;
+    diagnostic.file.assign(location);
+    return true;
+}
+
+} // namespace
+
+bool ParseDiagnostic(std::string_view line, Diagnostic& diagnostic) {
+    static const struct {
+        std::string_view text;
+        Diagnostic::Severity severity;
+    } kSeverities[] = {
+        { "fatal error", Diagnostic::Severity::Error },
+        { "error", Diagnostic::Severity::Error },
+        { "warning", Diagnostic::Severity::Warning },
+        { "note", Diagnostic::Severity::Note },
+    };
+
+    // The location is everything before the first ": <severity>" that follows a valid location
+    for (size_t pos = line.find(": "); pos != std::string_view::npos; pos = line.find(": ", pos + 1)) {
+        const std::string_view rest = line.substr(pos + 2);
+        for (const auto& kind : kSeverities) {
+            if (rest.compare(0, kind.text.size(), kind.text) != 0)
+                continue;
+
+            // "error: message" (GCC/Clang) or "error C2065: message" (MSVC)
+            std::string_view message = rest.substr(kind.text.size());
+            if (message.empty() || (message.front() != ':' && message.front() != ' '))
+                continue;
+            if (!ParseLocation(line.substr(0, pos), diagnostic))
+                return false;
+
+            if (message.front() == ':')
+                message.remove_prefix(1);
+            while (!message.empty() && message.front() == ' ')
+                message.remove_prefix(1);
+            diagnostic.severity = kind.severity;
+            diagnostic.message.assign(message);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+﻿// Diagnostics.h
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// An error, warning or note a compiler printed about a source location
+struct Diagnostic {
+    enum class Severity { Error, Warning, Note };
+
+    std::string file;   // as printed, possibly relative to the compiler's working directory
+    int line = 0;       // 1-based
+    int column = 0;     // 1-based, 0 when the compiler gave none
+    Severity severity = Severity::Error;
+    std::string message;
+};
+
+// How many diagnostics of each severity a list holds, counted as they are added so the list
+// doesn't have to be walked to show the totals
+struct DiagnosticCounts {
+    size_t errors = 0;
+    size_t warnings = 0;
+    size_t notes = 0;
+
+    void Add(Diagnostic::Severity severity) {
+        switch (severity) {
+        case Diagnostic::Severity::Error: ++errors; break;
+        case Diagnostic::Severity::Warning: ++warnings; break;
+        case Diagnostic::Severity::Note: ++notes; break;
+        }
+    }
+};
+
+// Recognizes a single line of GCC/Clang ("file:line:col: error: message", column optional) or
+// MSVC ("file(line,col): error C2065: message", column optional) output. Everything else, such as
+// source excerpts, caret lines and "In file included from" chains, returns false. Only looks at
+// the line itself, so build output can be parsed as it streams in.
+bool ParseDiagnostic(std::string_view line, Diagnostic& diagnostic);
@@ -0,0 +1,110 @@
+﻿// FileLoader.cpp
+#include "FileLoader.h"
+#include "FrameScheduler.h"
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// The preview covers the complete lines in this many bytes at the start of the file, which is
+// more than any window shows
+constexpr size_t kPreviewSize = 64u << 10;
+// Files smaller than this are split completely before anything is shown
+constexpr size_t kPreviewThreshold = 4 * kPreviewSize;
+
+} // namespace
+
+FileLoader::~FileLoader() {
+    Cancel();
+    if (mThread.joinable())
+        mThread.join();
+}
+
+void FileLoader::Start(const std::string& path) {
+    Cancel();
+    if (mThread.joinable())
+        mThread.join();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mCancelled = false;
+    mRunning = true;
+    mHasPreview = false;
+    mSucceeded = false;
+    mThread = std::thread(&FileLoader::Load, this, path);
+}
+
+void FileLoader::Cancel() {
+    mCancelled = true;
+}
+
+bool FileLoader::IsRunning() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRunning;
+}
+
+bool FileLoader::TakePreview(TextEditor::Lines& lines) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mHasPreview)
+        return false;
+    lines = std::move(mPreview);
+    mPreview.clear();
+    mHasPreview = false;
+    return true;
+}
+
+bool FileLoader::TakeResult(TextEditor::Lines& lines, TextEditor::TextFormat& format) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mRunning || !mSucceeded)
+        return false;
+    lines = std::move(mLines);
+    mLines.clear();
+    format = mFormat;
+    mSucceeded = false;
+    return true;
+}
+
+// Runs on mThread. The file is read rather than mapped: it is often loaded again right after
+// someone else wrote it, and a mapping would fault if it is cut short meanwhile.
+void FileLoader::Load(const std::string& path) {
+    TextEditor::Lines lines;
+    TextEditor::TextFormat format;
+    bool succeeded = false;
+
+    std::error_code ec;
+    const uintmax_t size = fs::file_size(path, ec);
+    std::ifstream in(path, std::ios::binary);
+    if (!ec && in) {
+        std::string text(static_cast<size_t>(size), '\0');
+        in.read(text.data(), text.size());
+        text.resize(static_cast<size_t>(in.gcount()));
+
+        const char* data = text.data();
+        if (text.size() >= kPreviewThreshold) {
+            size_t end = kPreviewSize;
+            while (end > 0 && data[end - 1] != '\n')
+                --end;
+            if (end > 0) {
+                TextEditor::Lines preview;
+                TextEditor::BuildLines(data, end - 1, preview, &mCancelled);
+
+                std::lock_guard<std::mutex> lock(mMutex);
+                mPreview = std::move(preview);
+                mHasPreview = true;
+                FrameScheduler::Wake();
+            }
+        }
+        format = TextEditor::BuildLines(data, text.size(), lines, &mCancelled);
+        succeeded = !mCancelled;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLines = std::move(lines);
+    mFormat = format;
+    mSucceeded = succeeded;
+    mHasPreview = false;
+    mPreview.clear();
+    mRunning = false;
+    FrameScheduler::Wake();
+}
@@ -0,0 +1,46 @@
+﻿// FileLoader.h
+#pragma once
+#include "ImGui/TextEditor.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Reads a file and splits it into editor lines on a worker thread, so opening a big file
+// doesn't hold up the frame. The lines of the first screenful are handed out as a preview
+// while the rest is still being split.
+class FileLoader {
+public:
+    FileLoader() = default;
+    ~FileLoader();
+    FileLoader(const FileLoader&) = delete;
+    FileLoader& operator=(const FileLoader&) = delete;
+
+    void Start(const std::string& path);
+
+    // Stops splitting as soon as possible. The loader still finishes normally, without a result.
+    void Cancel();
+
+    bool IsRunning() const;
+
+    // Moves the preview into lines once it is ready. Only files of a few hundred KB and more get
+    // one; smaller ones are done about as fast.
+    bool TakePreview(TextEditor::Lines& lines);
+
+    // Valid once IsRunning is false. Returns false if the file could not be read or the load was
+    // cancelled.
+    bool TakeResult(TextEditor::Lines& lines, TextEditor::TextFormat& format);
+
+private:
+    void Load(const std::string& path);
+
+    mutable std::mutex mMutex;
+    std::thread mThread;
+    std::atomic<bool> mCancelled = false;
+    bool mRunning = false;
+    bool mHasPreview = false;
+    bool mSucceeded = false;
+    TextEditor::Lines mPreview;
+    TextEditor::Lines mLines;
+    TextEditor::TextFormat mFormat;
+};
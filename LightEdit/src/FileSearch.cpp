@@ -0,0 +1,363 @@
+﻿// FileSearch.cpp
+#include "FileSearch.h"
+#include "FrameScheduler.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FILESEARCH_SSE2 1
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Lines longer than this are cut off in the results
+constexpr size_t kMaxLineLength = 300;
+// Files with a NUL byte this close to the start are taken for binary and skipped
+constexpr size_t kBinaryProbeLength = 8000;
+// Files smaller than this are read into a buffer; only bigger ones are mapped, see MappedFile.h
+constexpr uintmax_t kMapThreshold = 16u << 20;
+
+char ToLower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool IsLetter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// How common a byte is in source code, higher is more common; everything not listed is rare.
+// The candidate search looks for the rarest byte of the literal, so it stops as seldom as possible.
+int ByteFrequency(char c) {
+    static const char kCommonBytes[] = " etaoinsrlcdhupmf_g()=;,.b\tvy\"wx*k{}->/0#1:&[]q2j<z";
+    const char* p = strchr(kCommonBytes, ToLower(c));
+    return c != '\0' && p != nullptr ? static_cast<int>(sizeof(kCommonBytes) - (p - kCommonBytes)) : 0;
+}
+
+// memchr for either of two bytes, the two cases of a letter
+const char* FindEither(const char* p, const char* end, char a, char b) {
+#ifdef FILESEARCH_SSE2
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+        if (mask != 0) {
+            unsigned long bit = 0;
+#ifdef _MSC_VER
+            _BitScanForward(&bit, static_cast<unsigned long>(mask));
+#else
+            bit = static_cast<unsigned long>(__builtin_ctz(static_cast<unsigned>(mask)));
+#endif
+            return p + bit;
+        }
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+// Gives up on alternations, and drops characters a quantifier makes optional
+std::string FileSearch::RequiredLiteral(const std::string& pattern, bool& wholePattern) {
+    wholePattern = false;
+    if (pattern.find('|') != std::string::npos)
+        return std::string();
+
+    std::string best;
+    std::string current;
+    int depth = 0;
+    bool plain = true;
+    auto endRun = [&]() {
+        if (current.size() > best.size())
+            best = current;
+        current.clear();
+    };
+
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        const char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size()) {
+            // Escaped punctuation stands for itself; \d, \w and friends are classes
+            const char next = pattern[++i];
+            if (depth == 0 && !IsLetter(next) && !(next >= '0' && next <= '9')) {
+                current += next;
+                continue;
+            }
+            plain = false;
+            endRun();
+        }
+        else if (c == '[') {
+            plain = false;
+            endRun();
+            // Skip the class, "[]...]" and "[^]...]" start with a literal ']'
+            size_t j = i + 1;
+            if (j < pattern.size() && pattern[j] == '^') ++j;
+            if (j < pattern.size() && pattern[j] == ']') ++j;
+            while (j < pattern.size() && pattern[j] != ']') {
+                if (pattern[j] == '\\') ++j;
+                ++j;
+            }
+            i = j;
+        }
+        else if (c == '(' || c == ')') {
+            plain = false;
+            depth += c == '(' ? 1 : -1;
+            endRun();
+        }
+        else if (c == '*' || c == '?' || c == '{') {
+            plain = false;
+            if (!current.empty())
+                current.pop_back();
+            endRun();
+            if (c == '{') {
+                while (i < pattern.size() && pattern[i] != '}') ++i;
+            }
+        }
+        else if (c == '+' || c == '.' || c == '^' || c == '$') {
+            plain = false;
+            endRun();
+        }
+        else if (depth == 0) {
+            current += c;
+        }
+        else {
+            endRun();
+        }
+    }
+    endRun();
+    wholePattern = plain && depth == 0;
+    return best;
+}
+
+FileSearch::~FileSearch() {
+    Cancel();
+    Join();
+}
+
+bool FileSearch::Start(const Options& options, std::vector<Source> sources, std::string& error) {
+    Cancel();
+    Join();
+
+    if (options.pattern.empty()) {
+        error = "Nothing to search for";
+        return false;
+    }
+
+    mOptions = options;
+    if (options.regex) {
+        try {
+            auto flags = std::regex::ECMAScript | std::regex::optimize;
+            if (!options.matchCase)
+                flags |= std::regex::icase;
+            mRegex = std::regex(options.pattern, flags);
+        }
+        catch (const std::regex_error& e) {
+            error = e.what();
+            return false;
+        }
+        mLiteral = RequiredLiteral(options.pattern, mLiteralIsWhole);
+    }
+    else {
+        mLiteral = options.pattern;
+        mLiteralIsWhole = true;
+    }
+    if (!options.matchCase)
+        std::transform(mLiteral.begin(), mLiteral.end(), mLiteral.begin(), ToLower);
+
+    mRareIndex = 0;
+    for (size_t i = 1; i < mLiteral.size(); ++i) {
+        if (ByteFrequency(mLiteral[i]) < ByteFrequency(mLiteral[mRareIndex]))
+            mRareIndex = i;
+    }
+
+    mSources = std::move(sources);
+    mResults.clear();
+    mNext = 0;
+    mSearched = 0;
+    mMatchedFiles = 0;
+    mResultCount = 0;
+    mCancelled = false;
+    mTruncated = false;
+    mStartTime = std::chrono::steady_clock::now();
+
+    const unsigned workerCount = std::max(1u, std::thread::hardware_concurrency());
+    mRunningWorkers = workerCount;
+    for (unsigned i = 0; i < workerCount; ++i)
+        mWorkers.emplace_back(&FileSearch::Work, this);
+    return true;
+}
+
+void FileSearch::Cancel() {
+    mCancelled = true;
+}
+
+void FileSearch::Join() {
+    for (auto& worker : mWorkers)
+        worker.join();
+    mWorkers.clear();
+}
+
+bool FileSearch::IsRunning() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRunningWorkers > 0;
+}
+
+bool FileSearch::WasCancelled() const {
+    return mCancelled && !mTruncated;
+}
+
+bool FileSearch::WasTruncated() const {
+    return mTruncated;
+}
+
+void FileSearch::TakeResults(std::vector<Result>& results) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& result : mResults)
+        results.push_back(std::move(result));
+    mResults.clear();
+}
+
+double FileSearch::GetElapsedSeconds() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto end = mRunningWorkers > 0 ? std::chrono::steady_clock::now() : mEndTime;
+    return std::chrono::duration<double>(end - mStartTime).count();
+}
+
+void FileSearch::Work() {
+    MappedFile file;
+    std::string buffer; // reused for every file that is read
+    std::vector<Result> results;
+    for (size_t index; !mCancelled && (index = mNext++) < mSources.size();) {
+        const Source& source = mSources[index];
+        results.clear();
+        std::error_code ec;
+        if (source.text) {
+            Search(static_cast<uint32_t>(index), source.text->data(), source.text->size(), results);
+        }
+        else if (const uintmax_t size = fs::file_size(source.path, ec); !ec && size < kMapThreshold) {
+            // Sources are often rewritten while they are searched, by a build for one
+            std::ifstream in(source.path, std::ios::binary);
+            buffer.resize(static_cast<size_t>(size));
+            in.read(buffer.data(), buffer.size());
+            Search(static_cast<uint32_t>(index), buffer.data(), static_cast<size_t>(in.gcount()), results);
+        }
+        else if (!ec && file.Open(source.path)) {
+            Search(static_cast<uint32_t>(index), file.Data(), file.Size(), results);
+            file.Close();
+        }
+        ++mSearched;
+
+        if (!results.empty()) {
+            ++mMatchedFiles;
+            if ((mResultCount += results.size()) >= kMaxResults) {
+                mTruncated = true;
+                mCancelled = true;
+            }
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (auto& result : results)
+                mResults.push_back(std::move(result));
+            FrameScheduler::Wake();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (--mRunningWorkers == 0) {
+        mEndTime = std::chrono::steady_clock::now();
+        FrameScheduler::Wake();
+    }
+}
+
+// Returns the start of the next occurrence of the literal at or after p, or nullptr
+const char* FileSearch::FindLiteral(const char* p, const char* end) const {
+    const size_t length = mLiteral.size();
+    const char rare = mLiteral[mRareIndex];
+    const bool bothCases = !mOptions.matchCase && IsLetter(rare);
+    const char upper = static_cast<char>(rare - 'a' + 'A');
+
+    while (end - p >= static_cast<ptrdiff_t>(length)) {
+        // Only where the rare byte is the literal can start
+        const char* probeEnd = end - (length - mRareIndex - 1);
+        const char* probe = p + mRareIndex;
+        probe = bothCases
+            ? FindEither(probe, probeEnd, rare, upper)
+            : static_cast<const char*>(memchr(probe, rare, probeEnd - probe));
+        if (probe == nullptr)
+            return nullptr;
+
+        const char* start = probe - mRareIndex;
+        bool equal = true;
+        if (mOptions.matchCase) {
+            equal = memcmp(start, mLiteral.data(), length) == 0;
+        }
+        else {
+            for (size_t i = 0; i < length && equal; ++i)
+                equal = ToLower(start[i]) == mLiteral[i];
+        }
+        if (equal)
+            return start;
+        p = start + 1;
+    }
+    return nullptr;
+}
+
+void FileSearch::Search(uint32_t source, const char* data, size_t size, std::vector<Result>& results) const {
+    const char* const end = data + size;
+    if (memchr(data, '\0', std::min(size, kBinaryProbeLength)) != nullptr)
+        return;
+
+    // Line numbers are counted from the previous match on, never from the start again
+    uint32_t line = 1;
+    const char* counted = data;
+
+    for (const char* p = data; p < end && !mCancelled;) {
+        const char* hit = p;
+        if (!mLiteral.empty()) {
+            hit = FindLiteral(p, end);
+            if (hit == nullptr)
+                break;
+        }
+
+        // p is always at the start of a line
+        const char* lineStart = hit;
+        while (lineStart > p && lineStart[-1] != '\n')
+            --lineStart;
+        const char* lineEnd = static_cast<const char*>(memchr(hit, '\n', end - hit));
+        if (lineEnd == nullptr)
+            lineEnd = end;
+
+        // The literal only says the line may match; the regex decides
+        size_t column = hit - lineStart;
+        bool matched = mLiteralIsWhole;
+        if (!matched) {
+            std::cmatch match;
+            matched = std::regex_search(lineStart, lineEnd, match, mRegex);
+            if (matched)
+                column = match.position(0);
+        }
+
+        if (matched) {
+            line += static_cast<uint32_t>(std::count(counted, lineStart, '\n'));
+            counted = lineStart;
+
+            const char* textEnd = lineEnd > lineStart && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd;
+            Result result;
+            result.source = source;
+            result.line = line;
+            result.column = static_cast<uint32_t>(column + 1);
+            result.text.assign(lineStart, std::min<size_t>(textEnd - lineStart, kMaxLineLength));
+            results.push_back(std::move(result));
+        }
+        if (lineEnd == end)
+            break;
+        p = lineEnd + 1;
+    }
+}
@@ -0,0 +1,100 @@
+﻿// FileSearch.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Searches many files for a literal string or a regular expression on a pool of worker threads.
+// Files are read into a buffer, only very large ones are memory mapped, and candidate positions
+// are found with memchr (or SIMD) on the rarest byte of the literal before anything is compared
+// or handed to std::regex. Results are delivered per file as soon as it is done, so they can be
+// shown while the search runs.
+class FileSearch {
+public:
+    struct Options {
+        std::string pattern;
+        bool matchCase = false;
+        bool regex = false;
+    };
+
+    // A file to search. When text is set it is searched instead of the file on disk, for
+    // editors with unsaved changes.
+    struct Source {
+        std::string path;
+        std::shared_ptr<const std::string> text;
+    };
+
+    // The first match on a line. Line and column are 1-based, the column counts bytes.
+    struct Result {
+        uint32_t source;
+        uint32_t line;
+        uint32_t column;
+        std::string text; // the line, shortened if very long
+    };
+
+    // The search stops once it found this many matching lines
+    static constexpr size_t kMaxResults = 100000;
+
+    // The longest run of ordinary characters every match of a regular expression has to
+    // contain, or an empty string if there is none the parser is sure about. wholePattern tells
+    // whether the pattern is nothing but that literal.
+    static std::string RequiredLiteral(const std::string& pattern, bool& wholePattern);
+
+    FileSearch() = default;
+    ~FileSearch();
+    FileSearch(const FileSearch&) = delete;
+    FileSearch& operator=(const FileSearch&) = delete;
+
+    // Starts searching sources, cancelling a search still in progress. Fails with a message in
+    // error if the pattern is empty or not a valid regular expression.
+    bool Start(const Options& options, std::vector<Source> sources, std::string& error);
+    void Cancel();
+
+    bool IsRunning() const;
+    bool WasCancelled() const;
+    bool WasTruncated() const; // stopped at kMaxResults
+
+    // Appends the results found since the last call, grouped by file
+    void TakeResults(std::vector<Result>& results);
+
+    // The sources stay valid until the next Start
+    const Source& GetSource(uint32_t index) const { return mSources[index]; }
+    size_t GetSourceCount() const { return mSources.size(); }
+    size_t GetSearchedCount() const { return mSearched; }
+    size_t GetMatchedFileCount() const { return mMatchedFiles; }
+    size_t GetResultCount() const { return mResultCount; }
+    double GetElapsedSeconds() const;
+
+private:
+    void Work();
+    void Search(uint32_t source, const char* data, size_t size, std::vector<Result>& results) const;
+    const char* FindLiteral(const char* p, const char* end) const;
+    void Join();
+
+    Options mOptions;
+    std::vector<Source> mSources;
+    std::regex mRegex;
+    std::string mLiteral;    // must occur in every match; lower case unless matching case
+    size_t mRareIndex = 0;   // position in mLiteral of its least common byte
+    bool mLiteralIsWhole = false; // the literal is the whole pattern, nothing to verify
+
+    std::vector<std::thread> mWorkers;
+    std::atomic<size_t> mNext{ 0 };
+    std::atomic<size_t> mSearched{ 0 };
+    std::atomic<size_t> mMatchedFiles{ 0 };
+    std::atomic<size_t> mResultCount{ 0 };
+    std::atomic<bool> mCancelled{ false };
+    std::atomic<bool> mTruncated{ false };
+
+    mutable std::mutex mMutex;
+    std::vector<Result> mResults;
+    size_t mRunningWorkers = 0;
+    std::chrono::steady_clock::time_point mStartTime;
+    std::chrono::steady_clock::time_point mEndTime;
+};
@@ -0,0 +1,304 @@
+﻿// FileWatcher.cpp
+#include "FileWatcher.h"
+#include "FrameScheduler.h"
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// A burst is delivered once no event came in for kQuietPeriod, but no later than kMaxDelay after
+// its first event
+constexpr auto kQuietPeriod = std::chrono::milliseconds(200);
+constexpr auto kMaxDelay = std::chrono::seconds(2);
+constexpr auto kPollInterval = std::chrono::seconds(3);
+
+// Last write time of every file and directory below root. Linked directories are not followed,
+// the same as the project scan.
+void Snapshot(const fs::path& root, std::unordered_map<std::string, fs::file_time_type>& entries, const std::atomic<bool>& stopping) {
+    std::vector<fs::path> directories{ root };
+    while (!directories.empty() && !stopping) {
+        const fs::path directory = std::move(directories.back());
+        directories.pop_back();
+
+        std::error_code ec;
+        fs::directory_iterator it(directory, fs::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            std::error_code entryEc;
+            entries[it->path().string()] = it->last_write_time(entryEc);
+            if (it->is_directory(entryEc) && !it->is_symlink(entryEc))
+                directories.push_back(it->path());
+        }
+    }
+}
+
+} // namespace
+
+FileWatcher::~FileWatcher() {
+    Stop();
+}
+
+void FileWatcher::Start(const std::string& root) {
+    Stop();
+
+    mRoot = root;
+    mStopping = false;
+    mPending.clear();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mChanges.clear();
+        mRescan = false;
+        mPolling = false;
+    }
+#ifndef _WIN32
+    // Wakes the inotify thread out of poll() when stopping
+    if (pipe(mWakePipe) == 0) {
+        fcntl(mWakePipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(mWakePipe[1], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    mThread = std::thread(&FileWatcher::Run, this);
+}
+
+void FileWatcher::Stop() {
+    if (!mThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWake.notify_all();
+#ifndef _WIN32
+    if (mWakePipe[1] >= 0)
+        (void)!write(mWakePipe[1], "", 1);
+#endif
+    mThread.join();
+
+#ifndef _WIN32
+    for (int& fd : mWakePipe) {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+#endif
+}
+
+bool FileWatcher::IsPolling() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPolling;
+}
+
+bool FileWatcher::TakeChanges(std::vector<Change>& changes) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& change : mChanges)
+        changes.push_back(std::move(change));
+    mChanges.clear();
+
+    const bool rescan = mRescan;
+    mRescan = false;
+    return rescan;
+}
+
+void FileWatcher::Run() {
+#ifdef __linux__
+    if (RunInotify())
+        return;
+#endif
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPolling = true;
+    }
+    RunPolling();
+}
+
+void FileWatcher::AddPending(std::string path) {
+    const auto now = Clock::now();
+    if (mPending.empty())
+        mFirstPending = now;
+    mLastPending = now;
+    mPending.insert(std::move(path));
+}
+
+// Looks at what the pending paths are now, so a file created and deleted again within a burst
+// simply doesn't exist, whatever order the events came in
+void FileWatcher::Publish() {
+    std::vector<Change> changes;
+    changes.reserve(mPending.size());
+    for (const auto& path : mPending) {
+        std::error_code ec;
+        const fs::file_status status = fs::status(path, ec);
+        changes.push_back({ path, fs::exists(status), fs::is_directory(status) });
+    }
+    mPending.clear();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& change : changes)
+        mChanges.push_back(std::move(change));
+    FrameScheduler::Wake();
+}
+
+#ifdef __linux__
+// Returns false when inotify can't be used (any more), because it ran out of watches or poll()
+// failed, and the caller should poll instead
+bool FileWatcher::RunInotify() {
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    constexpr uint32_t kMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+    std::unordered_map<int, std::string> watches;
+    bool outOfWatches = false;
+    bool failed = false;
+
+    // Watches directory and every directory below it. Unless this is the initial setup, the
+    // contents are reported too, since they may have been created before the watch was in place.
+    auto watchTree = [&](const std::string& directory, bool report) {
+        std::vector<std::string> directories{ directory };
+        while (!directories.empty() && !outOfWatches) {
+            const std::string path = std::move(directories.back());
+            directories.pop_back();
+
+            const int wd = inotify_add_watch(fd, path.c_str(), kMask);
+            if (wd < 0) {
+                outOfWatches = errno == ENOSPC;
+                continue;
+            }
+            watches[wd] = path;
+
+            std::error_code ec;
+            fs::directory_iterator it(path, fs::directory_options::skip_permission_denied, ec);
+            for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+                std::error_code entryEc;
+                if (it->is_directory(entryEc) && !it->is_symlink(entryEc))
+                    directories.push_back(it->path().string());
+                if (report)
+                    AddPending(it->path().string());
+            }
+        }
+    };
+
+    watchTree(mRoot, false);
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    while (!outOfWatches && !failed && !mStopping) {
+        int timeout = -1;
+        if (!mPending.empty()) {
+            const auto now = Clock::now();
+            const auto deadline = std::min(mLastPending + kQuietPeriod, mFirstPending + kMaxDelay);
+            if (deadline <= now) {
+                Publish();
+                continue;
+            }
+            timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+        }
+
+        pollfd fds[2] = { { fd, POLLIN, 0 }, { mWakePipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            // Events may have been missed; the polling fallback takes over from a fresh scan
+            failed = true;
+            std::lock_guard<std::mutex> lock(mMutex);
+            mRescan = true;
+            FrameScheduler::Wake();
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (const char* p = buffer; p < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mRescan = true;
+                    FrameScheduler::Wake();
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    watches.erase(event->wd);
+                    continue;
+                }
+                const auto watch = watches.find(event->wd);
+                if (watch == watches.end() || event->len == 0)
+                    continue;
+
+                std::string path = watch->second + '/' + event->name;
+                if (event->mask & IN_ISDIR) {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        watchTree(path, true);
+                    }
+                    else if (event->mask & IN_MOVED_FROM) {
+                        // The watches below a directory move along with it, so their paths are
+                        // stale now; the directory is watched again wherever it shows up
+                        const std::string prefix = path + '/';
+                        for (auto it = watches.begin(); it != watches.end();) {
+                            if (it->second == path || it->second.compare(0, prefix.size(), prefix) == 0) {
+                                inotify_rm_watch(fd, it->first);
+                                it = watches.erase(it);
+                            }
+                            else {
+                                ++it;
+                            }
+                        }
+                    }
+                }
+                AddPending(std::move(path));
+            }
+        }
+    }
+
+    close(fd);
+    if (!mPending.empty())
+        Publish();
+    return !outOfWatches && !failed;
+}
+#else
+bool FileWatcher::RunInotify() {
+    return false;
+}
+#endif
+
+void FileWatcher::RunPolling() {
+    std::unordered_map<std::string, fs::file_time_type> snapshot;
+    Snapshot(mRoot, snapshot, mStopping);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mWake.wait_for(lock, kPollInterval, [this] { return mStopping.load(); })) {
+        lock.unlock();
+
+        std::unordered_map<std::string, fs::file_time_type> current;
+        Snapshot(mRoot, current, mStopping);
+        if (!mStopping) {
+            for (const auto& [path, time] : current) {
+                const auto it = snapshot.find(path);
+                if (it == snapshot.end() || it->second != time)
+                    AddPending(path);
+            }
+            for (const auto& [path, time] : snapshot) {
+                if (current.find(path) == current.end())
+                    AddPending(path);
+            }
+            snapshot = std::move(current);
+            if (!mPending.empty())
+                Publish();
+        }
+
+        lock.lock();
+    }
+}
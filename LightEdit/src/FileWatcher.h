@@ -0,0 +1,66 @@
+﻿// FileWatcher.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Watches a directory tree for files and directories being created, deleted, renamed or written
+// to. Uses inotify on Linux and falls back to comparing snapshots of the tree every few seconds
+// elsewhere, or when inotify runs out of watches or fails. Events are coalesced on a background
+// thread: a burst, such as a checkout touching thousands of files, is delivered as one batch once
+// it settles, with every path in it only once.
+class FileWatcher {
+public:
+    // The state of a path after the burst it changed in. Renames show up as a path that no
+    // longer exists and one that does.
+    struct Change {
+        std::string path;
+        bool exists = false;
+        bool isDirectory = false;
+    };
+
+    FileWatcher() = default;
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Starts watching root and everything below it, replacing the previous root
+    void Start(const std::string& root);
+    void Stop();
+
+    // True once the watcher had to fall back to polling
+    bool IsPolling() const;
+
+    // Appends the changes delivered since the last call. Returns true when the system dropped
+    // events, in which case the whole tree has to be scanned again.
+    bool TakeChanges(std::vector<Change>& changes);
+
+private:
+    void Run();
+    bool RunInotify();
+    void RunPolling();
+    void AddPending(std::string path);
+    void Publish();
+
+    std::string mRoot;
+    std::thread mThread;
+    std::atomic<bool> mStopping{ false };
+    mutable std::mutex mMutex;
+    std::condition_variable mWake;
+    std::vector<Change> mChanges;
+    bool mRescan = false;
+    bool mPolling = false;
+
+    // Only touched by the watcher thread
+    std::unordered_set<std::string> mPending;
+    std::chrono::steady_clock::time_point mFirstPending;
+    std::chrono::steady_clock::time_point mLastPending;
+#ifndef _WIN32
+    int mWakePipe[2] = { -1, -1 };
+#endif
+};
@@ -0,0 +1,60 @@
+﻿// FrameScheduler.cpp
+#include "FrameScheduler.h"
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+// ImGui needs a few frames after input to settle hover states, layouts and popups
+constexpr int kSettleFrames = 3;
+
+} // namespace
+
+std::atomic<bool> FrameScheduler::sWakePending = false;
+uint32_t FrameScheduler::sWakeEvent = 0;
+
+void FrameScheduler::Init() {
+    sWakeEvent = SDL_RegisterEvents(1);
+}
+
+void FrameScheduler::Wake() {
+    if (sWakeEvent == 0 || sWakePending.exchange(true))
+        return;
+    SDL_Event event = {};
+    event.type = sWakeEvent;
+    SDL_PushEvent(&event);
+}
+
+void FrameScheduler::RequestFrames(int count) {
+    mFramesLeft = std::max(mFramesLeft, count);
+}
+
+void FrameScheduler::RequestFrameIn(int milliseconds) {
+    mDeadline = std::min(mDeadline, SDL_GetTicks() + static_cast<uint64_t>(std::max(0, milliseconds)));
+}
+
+void FrameScheduler::WaitForFrame() {
+    // Cleared before the frame picks up any results, so a thread publishing more after that
+    // sends a new event and the wait below can't miss it
+    sWakePending = false;
+
+    if (mFramesLeft > 0) {
+        --mFramesLeft;
+        return;
+    }
+
+    const uint64_t now = SDL_GetTicks();
+    bool input = true;
+    if (mDeadline > now) {
+        const Sint32 timeout = mDeadline == UINT64_MAX ? -1 : static_cast<Sint32>(std::min<uint64_t>(mDeadline - now, INT_MAX));
+        input = SDL_WaitEventTimeout(nullptr, timeout);
+    }
+    else {
+        input = SDL_HasEvents(SDL_EVENT_FIRST, SDL_EVENT_LAST);
+    }
+
+    mDeadline = UINT64_MAX;
+    if (input)
+        mFramesLeft = kSettleFrames - 1;
+}
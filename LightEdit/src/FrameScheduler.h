@@ -0,0 +1,34 @@
+﻿// FrameScheduler.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Decides when the main loop draws. A frame is only drawn when something can have changed:
+// input arrived, a background thread called Wake, a requested deadline came up (the cursor
+// blink), or ImGui is still settling after input. In between, the loop sleeps in
+// SDL_WaitEventTimeout and uses no CPU.
+class FrameScheduler {
+public:
+    // Registers the event Wake sends. Call after SDL_Init.
+    static void Init();
+
+    // Can be called from any thread: has the main loop draw a frame soon, e.g. because results
+    // are waiting to be picked up. Sends at most one event until the loop has woken up.
+    static void Wake();
+
+    // Draws at least this many more frames without waiting
+    void RequestFrames(int count);
+
+    // Draws a frame no later than this many milliseconds from now
+    void RequestFrameIn(int milliseconds);
+
+    // Returns when the next frame is due, leaving the events that woke it in the SDL queue
+    void WaitForFrame();
+
+private:
+    static std::atomic<bool> sWakePending;
+    static uint32_t sWakeEvent;
+
+    int mFramesLeft = 1;
+    uint64_t mDeadline = UINT64_MAX; // SDL_GetTicks time of the next frame due without input
+};
@@ -0,0 +1,196 @@
+﻿// FuzzyFinder.cpp
+#include "FuzzyFinder.h"
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+// Below this many candidates starting threads costs more than it saves
+constexpr size_t kMinCandidatesPerThread = 16384;
+
+char ToLower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// One bit per letter and digit, everything else shares the remaining bits
+uint64_t CharacterBit(char c) {
+    c = ToLower(c);
+    if (c >= 'a' && c <= 'z')
+        return 1ull << (c - 'a');
+    if (c >= '0' && c <= '9')
+        return 1ull << (26 + c - '0');
+    return 1ull << (36 + static_cast<unsigned char>(c) % 28);
+}
+
+uint64_t CharacterMask(std::string_view text) {
+    uint64_t mask = 0;
+    for (char c : text)
+        mask |= CharacterBit(c);
+    return mask;
+}
+
+bool IsSeparator(char c) {
+    return c == '/' || c == '\\';
+}
+
+// Extra points for a matched character depending on what comes before it
+int BoundaryBonus(std::string_view path, size_t i) {
+    if (i == 0)
+        return 10;
+    const char previous = path[i - 1];
+    if (IsSeparator(previous))
+        return 9;
+    if (previous == '_' || previous == '-' || previous == '.' || previous == ' ')
+        return 7;
+    if (previous >= 'a' && previous <= 'z' && path[i] >= 'A' && path[i] <= 'Z')
+        return 7; // camelCase
+    return 0;
+}
+
+// Scores query (lower case) against text, or returns -1 if it doesn't match. Finds the first
+// place the match can end, then walks back from there to the latest place it can start, so the
+// matched characters are as close together as possible.
+int ScoreWindow(std::string_view query, std::string_view text) {
+    size_t end = 0;
+    size_t q = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (ToLower(text[i]) == query[q] && ++q == query.size()) {
+            end = i;
+            break;
+        }
+    }
+    if (q < query.size())
+        return -1;
+
+    size_t start = end;
+    for (size_t i = end + 1; i-- > 0;) {
+        if (ToLower(text[i]) == query[q - 1] && --q == 0) {
+            start = i;
+            break;
+        }
+    }
+
+    int score = 0;
+    int consecutive = 0;
+    q = 0;
+    for (size_t i = start; i <= end; ++i) {
+        if (q < query.size() && ToLower(text[i]) == query[q]) {
+            score += 16 + std::max(BoundaryBonus(text, i), consecutive > 0 ? 5 : 0);
+            ++consecutive;
+            ++q;
+        }
+        else {
+            score -= consecutive > 0 ? 3 : 1;
+            consecutive = 0;
+        }
+    }
+    return score;
+}
+
+int Score(std::string_view query, std::string_view path) {
+    int score = ScoreWindow(query, path);
+    if (score < 0)
+        return -1;
+
+    // What people type is mostly the file name, so a match inside it beats one across folders
+    size_t nameStart = path.size();
+    while (nameStart > 0 && !IsSeparator(path[nameStart - 1]))
+        --nameStart;
+    const int nameScore = ScoreWindow(query, path.substr(nameStart));
+    if (nameScore >= 0)
+        score = std::max(score, nameScore + 24);
+
+    // Among equal matches the shorter path wins
+    return score * 64 - static_cast<int>(std::min<size_t>(path.size(), 63));
+}
+
+bool IsBetter(const FuzzyFinder::Match& a, const FuzzyFinder::Match& b) {
+    return a.score != b.score ? a.score > b.score : a.index < b.index;
+}
+
+} // namespace
+
+void FuzzyFinder::SetPaths(std::vector<std::string> paths, size_t rootLength) {
+    mPaths = std::move(paths);
+    mRootLength = rootLength;
+    mMasks.resize(mPaths.size());
+    for (size_t i = 0; i < mPaths.size(); ++i)
+        mMasks[i] = CharacterMask(GetRelativePath(static_cast<uint32_t>(i)));
+    mLastQuery.clear();
+    mLastMatches.clear();
+}
+
+std::string_view FuzzyFinder::GetRelativePath(uint32_t index) const {
+    std::string_view path = mPaths[index];
+    path.remove_prefix(std::min(mRootLength, path.size()));
+    while (!path.empty() && IsSeparator(path.front()))
+        path.remove_prefix(1);
+    return path;
+}
+
+void FuzzyFinder::Find(std::string_view query, size_t maxResults, std::vector<Match>& results) {
+    results.clear();
+
+    std::string needle;
+    for (char c : query) {
+        if (c != ' ')
+            needle += ToLower(c);
+    }
+    if (needle.empty()) {
+        mLastQuery.clear();
+        mLastMatches.clear();
+        return;
+    }
+
+    // Whatever matches the longer query also matched the shorter one
+    const bool narrowing = !mLastQuery.empty() && needle.compare(0, mLastQuery.size(), mLastQuery) == 0;
+    const size_t candidateCount = narrowing ? mLastMatches.size() : mPaths.size();
+    const uint64_t needleMask = CharacterMask(needle);
+
+    struct Part {
+        std::vector<uint32_t> matches;
+        std::vector<Match> best;
+    };
+    const size_t threadCount = std::clamp<size_t>(candidateCount / kMinCandidatesPerThread, 1, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<Part> parts(threadCount);
+
+    auto scoreRange = [&](size_t part, size_t begin, size_t end) {
+        Part& out = parts[part];
+        for (size_t c = begin; c < end; ++c) {
+            const uint32_t index = narrowing ? mLastMatches[c] : static_cast<uint32_t>(c);
+            if ((mMasks[index] & needleMask) != needleMask)
+                continue;
+            const int score = Score(needle, GetRelativePath(index));
+            if (score < 0)
+                continue;
+            out.matches.push_back(index);
+            out.best.push_back({ index, score });
+        }
+
+        if (out.best.size() > maxResults) {
+            std::partial_sort(out.best.begin(), out.best.begin() + maxResults, out.best.end(), IsBetter);
+            out.best.resize(maxResults);
+        }
+    };
+
+    // Contiguous ranges keep the combined matches in index order
+    std::vector<std::thread> threads;
+    const size_t perThread = (candidateCount + threadCount - 1) / threadCount;
+    for (size_t part = 1; part < threadCount; ++part)
+        threads.emplace_back(scoreRange, part, part * perThread, std::min(candidateCount, (part + 1) * perThread));
+    scoreRange(0, 0, std::min(candidateCount, perThread));
+    for (auto& thread : threads)
+        thread.join();
+
+    std::vector<uint32_t> matches;
+    for (auto& part : parts) {
+        matches.insert(matches.end(), part.matches.begin(), part.matches.end());
+        results.insert(results.end(), part.best.begin(), part.best.end());
+    }
+    std::sort(results.begin(), results.end(), IsBetter);
+    if (results.size() > maxResults)
+        results.resize(maxResults);
+
+    mLastQuery = std::move(needle);
+    mLastMatches = std::move(matches);
+}
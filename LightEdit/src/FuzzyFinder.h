@@ -0,0 +1,43 @@
+﻿// FuzzyFinder.h
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fuzzy "go to file" matching over every file of a project. A path matches when the query's
+// characters appear in it in order, ignoring case; matches are ranked the way people type
+// abbreviations, preferring characters at the start of words, runs of consecutive characters
+// and matches inside the file name.
+//
+// Each path has a bitmask of the characters it contains, kept in one contiguous array, so most
+// paths are rejected with a single AND before looking at their text. The remaining ones are
+// scored on all cores. A query that extends the previous one only rescans the previous matches.
+class FuzzyFinder {
+public:
+    struct Match {
+        uint32_t index; // into the paths given to SetPaths
+        int score;
+    };
+
+    // Replaces the searchable paths. Only the part after the first rootLength characters (the
+    // project directory) is matched.
+    void SetPaths(std::vector<std::string> paths, size_t rootLength);
+
+    // Fills results with up to maxResults matches of query, best first. Spaces in the query are
+    // ignored; an empty query matches nothing.
+    void Find(std::string_view query, size_t maxResults, std::vector<Match>& results);
+
+    size_t GetPathCount() const { return mPaths.size(); }
+    const std::string& GetPath(uint32_t index) const { return mPaths[index]; }
+    std::string_view GetRelativePath(uint32_t index) const;
+
+private:
+    std::vector<std::string> mPaths;
+    std::vector<uint64_t> mMasks;
+    size_t mRootLength = 0;
+
+    // Every path matching the last query, in index order
+    std::string mLastQuery;
+    std::vector<uint32_t> mLastMatches;
+};
@@ -3,6 +3,11 @@
 #include <string>
 #include <regex>
 #include <cmath>
+#include <cstring>
+#include <bit>
+#include <bitset>
+#include <deque>
+#include <numeric>
 
 #include "TextEditor.h"
 
@@ -12,20 +17,96 @@
 // TODO
 // - multiline comments vs single-line: latter is blocking start of a ML
 
-template<class InputIt1, class InputIt2, class BinaryPredicate>
-bool equals(InputIt1 first1, InputIt1 last1,
-	InputIt2 first2, InputIt2 last2, BinaryPredicate p)
+// One thread colorizes for every editor, however many files are open. Each editor has at most
+// one job queued or running and hands the result back through its mFinishedJob.
+class TextEditor::ColorizerWorker
 {
-	for (; first1 != last1 && first2 != last2; ++first1, ++first2)
+public:
+	~ColorizerWorker()
 	{
-		if (!p(*first1, *first2))
-			return false;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+		mCondition.notify_all();
+		if (mThread.joinable())
+			mThread.join();
 	}
-	return first1 == last1 && first2 == last2;
+
+	void Post(std::unique_ptr<ColorizeJob> aJob, bool aUrgent)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (aUrgent)
+				mQueue.push_front(std::move(aJob));
+			else
+				mQueue.push_back(std::move(aJob));
+			if (!mThread.joinable())
+				mThread = std::thread(&ColorizerWorker::Run, this);
+		}
+		mCondition.notify_all();
+	}
+
+	// Drops the editor's queued job and waits for the one it may be running, so the editor
+	// can go away
+	void Cancel(TextEditor* aEditor)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		std::erase_if(mQueue, [aEditor](const std::unique_ptr<ColorizeJob>& aJob) { return aJob->mEditor == aEditor; });
+		mCondition.wait(lock, [this, aEditor] { return mRunning != aEditor; });
+	}
+
+	std::mutex mMutex;
+
+private:
+	void Run()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (;;)
+		{
+			mCondition.wait(lock, [this] { return mQuit || !mQueue.empty(); });
+			if (mQuit)
+				return;
+
+			auto job = std::move(mQueue.front());
+			mQueue.pop_front();
+			TextEditor* editor = job->mEditor;
+			mRunning = editor;
+			lock.unlock();
+
+			// Give up early once an edit has made the result useless
+			for (size_t i = 0; i + 1 < job->mLineStarts.size(); ++i)
+			{
+				if (job->mVersion != editor->mColorizeVersion.load(std::memory_order_relaxed))
+					break;
+
+				auto start = job->mLineStarts[i];
+				ColorizeLine(*job->mConfig, (const char*)job->mChars.data() + start, job->mColors.data() + start, job->mLineStarts[i + 1] - start);
+			}
+
+			lock.lock();
+			editor->mFinishedJob = std::move(job);
+			mRunning = nullptr;
+			mCondition.notify_all();
+		}
+	}
+
+	std::thread mThread;
+	std::condition_variable mCondition;
+	std::deque<std::unique_ptr<ColorizeJob>> mQueue;
+	TextEditor* mRunning = nullptr;
+	bool mQuit = false;
+};
+
+TextEditor::ColorizerWorker& TextEditor::GetColorizerWorker()
+{
+	static ColorizerWorker worker;
+	return worker;
 }
 
 TextEditor::TextEditor()
 	: mLineSpacing(1.0f)
+	, mViewLongest(0.0f)
 	, mUndoIndex(0)
 	, mTabSize(4)
 	, mOverwrite(false)
@@ -41,13 +122,36 @@ TextEditor::TextEditor()
 	, mColorRangeMin(0)
 	, mColorRangeMax(0)
 	, mSelectionMode(SelectionMode::Normal)
-	, mCheckComments(true)
+	, mCommentRangeMin(0)
+	, mCommentRangeMax(0)
+	, mColorizeVersion(0)
+	, mColorizeJobInFlight(false)
+	, mColorizeJobVisible(false)
+	, mVisibleLineMin(0)
+	, mVisibleLineMax(0)
+	, mVisibleColorizedVersion(0)
+	, mVisibleColorizedMin(0)
+	, mVisibleColorizedMax(0)
 	, mLastClick(-1.0f)
 	, mHandleKeyboardInputs(true)
 	, mHandleMouseInputs(true)
 	, mIgnoreImGuiChild(false)
 	, mShowWhitespaces(true)
+	, mMetricsFont(nullptr)
+	, mMetricsFontSize(0.0f)
+	, mGlyphScale(1.0f)
+	, mSpaceAdvance(0.0f)
+	, mMonospace(false)
+	, mMaxAdvance(0.0f)
+	, mLayoutVersion(0)
+	, mLayoutFrame(0)
+	, mLayoutTexture()
+	, mWordWrap(false)
+	, mWrapWidth(0.0f)
+	, mWrapRangeMin(0)
+	, mWrapRangeMax(0)
 	, mStartTime(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())
+	, mCursorBlinking(false)
 {
 	SetPalette(GetDarkPalette());
 	SetLanguageDefinition(LanguageDefinition::HLSL());
@@ -56,19 +160,456 @@ TextEditor::TextEditor()
 
 TextEditor::~TextEditor()
 {
+	if (mColorizeJobInFlight)
+		GetColorizerWorker().Cancel(this);
 }
 
-void TextEditor::SetLanguageDefinition(const LanguageDefinition & aLanguageDef)
+static_assert((unsigned)TextEditor::PaletteIndex::Max <= TextEditor::GlyphColorMask + 1u, "palette index must fit in the glyph color bits");
+
+void TextEditor::Line::insert(size_t aIndex, const Char* aChars, size_t aCount, uint8_t aColor)
 {
-	mLanguageDefinition = aLanguageDef;
-	mRegexList.clear();
+	assert(aIndex <= mChars.size());
+	mChars.insert(mChars.begin() + aIndex, aChars, aChars + aCount);
+	mColors.insert(mColors.begin() + aIndex, aCount, aColor);
+	mLexerState = LexerInvalid;
+	mVersion = 0;
+}
+
+void TextEditor::Line::insert(size_t aIndex, const Line& aFrom, size_t aStart, size_t aEnd)
+{
+	assert(aIndex <= mChars.size());
+	assert(aStart <= aEnd && aEnd <= aFrom.mChars.size());
+	assert(&aFrom != this);
+	mChars.insert(mChars.begin() + aIndex, aFrom.mChars.begin() + aStart, aFrom.mChars.begin() + aEnd);
+	mColors.insert(mColors.begin() + aIndex, aFrom.mColors.begin() + aStart, aFrom.mColors.begin() + aEnd);
+	mLexerState = LexerInvalid;
+	mVersion = 0;
+}
+
+void TextEditor::Line::erase(size_t aStart, size_t aEnd)
+{
+	assert(aStart <= aEnd && aEnd <= mChars.size());
+	mChars.erase(mChars.begin() + aStart, mChars.begin() + aEnd);
+	mColors.erase(mColors.begin() + aStart, mColors.begin() + aEnd);
+	mLexerState = LexerInvalid;
+	mVersion = 0;
+}
+
+void TextEditor::Lines::clear()
+{
+	mChunks.clear();
+	mChunkStart.clear();
+	mSize = 0;
+	mLastChunk = 0;
+}
+
+void TextEditor::Lines::resize(size_t aSize)
+{
+	if (aSize < mSize)
+		erase(aSize, mSize);
+	else if (aSize > mSize)
+		insert(mSize, std::vector<Line>(aSize - mSize));
+}
+
+void TextEditor::Lines::push_back(Line&& aLine)
+{
+	if (mChunks.empty() || mChunks.back().size() >= kChunkSize)
+	{
+		mChunks.emplace_back();
+		mChunks.back().reserve(kChunkSize);
+		mChunkStart.push_back(mSize);
+	}
+	mChunks.back().push_back(std::move(aLine));
+	++mSize;
+}
+
+TextEditor::Line& TextEditor::Lines::insert(size_t aIndex, Line&& aLine)
+{
+	std::vector<Line> lines;
+	lines.push_back(std::move(aLine));
+	insert(aIndex, std::move(lines));
+	return (*this)[aIndex];
+}
+
+void TextEditor::Lines::insert(size_t aIndex, std::vector<Line>&& aLines)
+{
+	assert(aIndex <= mSize);
+	if (aLines.empty())
+		return;
+
+	if (mChunks.empty())
+	{
+		mChunks.emplace_back();
+		mChunkStart.push_back(0);
+	}
+
+	size_t chunk = aIndex == mSize ? mChunks.size() - 1 : FindChunk(aIndex);
+	auto& lines = mChunks[chunk];
+	auto offset = aIndex - mChunkStart[chunk];
+	lines.insert(lines.begin() + offset, std::make_move_iterator(aLines.begin()), std::make_move_iterator(aLines.end()));
+	mSize += aLines.size();
+
+	SplitChunk(chunk);
+	UpdateChunkStarts(chunk);
+}
+
+void TextEditor::Lines::erase(size_t aStart, size_t aEnd)
+{
+	assert(aStart <= aEnd && aEnd <= mSize);
+	if (aStart == aEnd)
+		return;
+
+	auto first = FindChunk(aStart);
+	auto chunk = first;
+	auto offset = aStart - mChunkStart[chunk];
+	auto remaining = aEnd - aStart;
+	while (remaining > 0)
+	{
+		auto& lines = mChunks[chunk];
+		auto count = std::min(remaining, lines.size() - offset);
+		lines.erase(lines.begin() + offset, lines.begin() + offset + count);
+		remaining -= count;
+		offset = 0;
+		++chunk;
+	}
+	mSize -= aEnd - aStart;
+
+	// Drop the chunks that became empty and fold a small leftover into its successor
+	auto removed = std::remove_if(mChunks.begin() + first, mChunks.begin() + chunk, [](const std::vector<Line>& aLines) { return aLines.empty(); });
+	mChunks.erase(removed, mChunks.begin() + chunk);
+	if (first + 1 < mChunks.size() && mChunks[first].size() + mChunks[first + 1].size() <= kChunkSize)
+	{
+		auto& next = mChunks[first + 1];
+		mChunks[first].insert(mChunks[first].end(), std::make_move_iterator(next.begin()), std::make_move_iterator(next.end()));
+		mChunks.erase(mChunks.begin() + first + 1);
+	}
+	UpdateChunkStarts(first);
+}
+
+size_t TextEditor::Lines::FindChunk(size_t aIndex) const
+{
+	assert(aIndex < mSize);
+
+	// Most accesses walk neighbouring lines, so try the chunk of the previous lookup first
+	if (mLastChunk < mChunks.size() && aIndex >= mChunkStart[mLastChunk] && aIndex - mChunkStart[mLastChunk] < mChunks[mLastChunk].size())
+		return mLastChunk;
+
+	auto it = std::upper_bound(mChunkStart.begin(), mChunkStart.end(), aIndex);
+	mLastChunk = (size_t)(it - mChunkStart.begin()) - 1;
+	return mLastChunk;
+}
+
+void TextEditor::Lines::SplitChunk(size_t aChunk)
+{
+	auto& lines = mChunks[aChunk];
+	const auto count = lines.size();
+	if (count <= 2 * kChunkSize)
+		return;
+
+	std::vector<std::vector<Line>> pieces;
+	for (size_t from = kChunkSize; from < count; from += kChunkSize)
+	{
+		auto to = std::min(count, from + kChunkSize);
+		pieces.emplace_back(std::make_move_iterator(lines.begin() + from), std::make_move_iterator(lines.begin() + to));
+	}
+	lines.resize(kChunkSize);
+	mChunks.insert(mChunks.begin() + aChunk + 1, std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+}
+
+void TextEditor::Lines::UpdateChunkStarts(size_t aFromChunk)
+{
+	mChunkStart.resize(mChunks.size());
+	for (auto i = aFromChunk; i < mChunks.size(); ++i)
+		mChunkStart[i] = i == 0 ? 0 : mChunkStart[i - 1] + mChunks[i - 1].size();
+	mLastChunk = std::min(aFromChunk, mChunks.empty() ? 0 : mChunks.size() - 1);
+}
+
+// The lowest set bit of a Fenwick tree index, the number of lines its node sums
+static size_t LowBit(size_t aIndex)
+{
+	return aIndex & (~aIndex + 1);
+}
+
+// Adds aDelta to element aIndex of the values a Fenwick tree sums
+static void FenwickAdd(std::vector<int>& aTree, size_t aIndex, int aDelta)
+{
+	for (auto i = aIndex + 1; i < aTree.size(); i += LowBit(i))
+		aTree[i] += aDelta;
+}
+
+// The sum of the first aCount values
+static int FenwickSum(const std::vector<int>& aTree, size_t aCount)
+{
+	int sum = 0;
+	for (auto i = aCount; i > 0; i -= LowBit(i))
+		sum += aTree[i];
+	return sum;
+}
+
+// The largest count of values whose sum is at most aValue, with aValue reduced by that sum.
+// All values must be positive.
+static size_t FenwickFind(const std::vector<int>& aTree, int& aValue)
+{
+	size_t count = 0;
+	for (auto step = std::bit_floor(aTree.size()); step > 0; step >>= 1)
+	{
+		if (count + step < aTree.size() && aTree[count + step] <= aValue)
+		{
+			count += step;
+			aValue -= aTree[count];
+		}
+	}
+	return count;
+}
+
+void TextEditor::WrapRows::clear()
+{
+	mChunks.clear();
+	mChunkRows.clear();
+	mLineTree.clear();
+	mRowTree.clear();
+	mSize = 0;
+	mRowCount = 0;
+}
+
+void TextEditor::WrapRows::resize(size_t aSize)
+{
+	clear();
+	for (size_t from = 0; from < aSize; from += kChunkSize)
+	{
+		const auto count = std::min(kChunkSize, aSize - from);
+		mChunks.emplace_back(count, 1);
+		mChunkRows.push_back((int)count);
+	}
+	mSize = aSize;
+	mRowCount = (int)aSize;
+	BuildTrees();
+}
+
+void TextEditor::WrapRows::set(size_t aLine, int aRows)
+{
+	const auto chunk = FindChunk(aLine);
+	const int delta = aRows - mChunks[chunk][aLine];
+	if (delta == 0)
+		return;
+	mChunks[chunk][aLine] = aRows;
+	AddToChunk(chunk, 0, delta);
+}
 
-	for (auto& r : mLanguageDefinition.mTokenRegexStrings)
-		mRegexList.push_back(std::make_pair(std::regex(r.first, std::regex_constants::optimize), r.second));
+void TextEditor::WrapRows::assign(size_t aStart, const std::vector<int>& aRows)
+{
+	// The changed counts are consecutive, so each chunk is looked up and updated once
+	for (size_t i = 0; i < aRows.size();)
+	{
+		size_t offset = aStart + i;
+		const auto chunk = FindChunk(offset);
+		auto& rows = mChunks[chunk];
+		int delta = 0;
+		for (; offset < rows.size() && i < aRows.size(); ++offset, ++i)
+		{
+			delta += aRows[i] - rows[offset];
+			rows[offset] = aRows[i];
+		}
+		if (delta != 0)
+			AddToChunk(chunk, 0, delta);
+	}
+}
+
+void TextEditor::WrapRows::insert(size_t aIndex, size_t aCount)
+{
+	if (aCount == 0)
+		return;
+	if (mChunks.empty())
+	{
+		resize(aCount);
+		return;
+	}
+
+	// Lines appended at the end go into the last chunk
+	size_t chunk, offset = aIndex;
+	if (aIndex == mSize)
+	{
+		chunk = mChunks.size() - 1;
+		offset = mChunks[chunk].size();
+	}
+	else
+	{
+		chunk = FindChunk(offset);
+	}
+
+	auto& rows = mChunks[chunk];
+	rows.insert(rows.begin() + offset, aCount, 1);
+	mSize += aCount;
+	if (rows.size() <= 2 * kChunkSize)
+	{
+		AddToChunk(chunk, (int)aCount, (int)aCount);
+		return;
+	}
+
+	// Split the chunk up, the same as Lines does
+	mRowCount += (int)aCount;
+	std::vector<std::vector<int>> pieces;
+	for (size_t from = kChunkSize; from < rows.size(); from += kChunkSize)
+		pieces.emplace_back(rows.begin() + from, rows.begin() + std::min(rows.size(), from + kChunkSize));
+	rows.resize(kChunkSize);
+
+	std::vector<int> pieceRows;
+	for (const auto& piece : pieces)
+		pieceRows.push_back(std::accumulate(piece.begin(), piece.end(), 0));
+	mChunkRows[chunk] = std::accumulate(rows.begin(), rows.end(), 0);
+	mChunks.insert(mChunks.begin() + chunk + 1, std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+	mChunkRows.insert(mChunkRows.begin() + chunk + 1, pieceRows.begin(), pieceRows.end());
+	BuildTrees();
+}
+
+void TextEditor::WrapRows::erase(size_t aStart, size_t aEnd)
+{
+	if (aStart >= aEnd)
+		return;
+
+	size_t offset = aStart;
+	auto chunk = FindChunk(offset);
+	auto count = aEnd - aStart;
+	mSize -= count;
+
+	// Within one chunk that keeps some lines, only its totals change
+	auto& first = mChunks[chunk];
+	if (offset + count < first.size() || (offset > 0 && offset + count == first.size()))
+	{
+		const int rows = std::accumulate(first.begin() + offset, first.begin() + offset + count, 0);
+		first.erase(first.begin() + offset, first.begin() + offset + count);
+		AddToChunk(chunk, -(int)count, -rows);
+		return;
+	}
+
+	// Otherwise walk the chunks the range covers and drop the ones that end up empty
+	auto last = chunk;
+	while (count > 0)
+	{
+		auto& rows = mChunks[last];
+		const auto n = std::min(count, rows.size() - offset);
+		const int removed = std::accumulate(rows.begin() + offset, rows.begin() + offset + n, 0);
+		rows.erase(rows.begin() + offset, rows.begin() + offset + n);
+		mChunkRows[last] -= removed;
+		mRowCount -= removed;
+		count -= n;
+		offset = 0;
+		++last;
+	}
+	for (auto i = last; i-- > chunk;)
+	{
+		if (mChunks[i].empty())
+		{
+			mChunks.erase(mChunks.begin() + i);
+			mChunkRows.erase(mChunkRows.begin() + i);
+		}
+	}
+	BuildTrees();
+}
+
+int TextEditor::WrapRows::GetFirstRow(size_t aLine) const
+{
+	if (aLine >= mSize)
+		return mRowCount;
+
+	const auto chunk = FindChunk(aLine);
+	const auto& rows = mChunks[chunk];
+	return FenwickSum(mRowTree, chunk) + std::accumulate(rows.begin(), rows.begin() + aLine, 0);
+}
+
+size_t TextEditor::WrapRows::FindLine(int aRow) const
+{
+	assert(mSize > 0);
+
+	// The chunk holding the row, then the line in it whose rows cover it
+	const auto chunk = FenwickFind(mRowTree, aRow);
+	if (chunk >= mChunks.size())
+		return mSize - 1;
+
+	const auto& rows = mChunks[chunk];
+	size_t line = 0;
+	while (line + 1 < rows.size() && aRow >= rows[line])
+		aRow -= rows[line++];
+	return FenwickSum(mLineTree, chunk) + line;
+}
+
+size_t TextEditor::WrapRows::FindChunk(size_t& aLine) const
+{
+	assert(aLine < mSize);
+
+	int line = (int)aLine;
+	const auto chunk = FenwickFind(mLineTree, line);
+	aLine = (size_t)line;
+	return chunk;
+}
+
+void TextEditor::WrapRows::AddToChunk(size_t aChunk, int aLines, int aRows)
+{
+	mChunkRows[aChunk] += aRows;
+	mRowCount += aRows;
+	if (aLines != 0)
+		FenwickAdd(mLineTree, aChunk, aLines);
+	FenwickAdd(mRowTree, aChunk, aRows);
+}
+
+// Rebuilds both trees from the chunk totals in one pass over the chunks
+void TextEditor::WrapRows::BuildTrees()
+{
+	mLineTree.assign(mChunks.size() + 1, 0);
+	mRowTree.assign(mChunks.size() + 1, 0);
+	for (size_t i = 1; i < mLineTree.size(); ++i)
+	{
+		mLineTree[i] += (int)mChunks[i - 1].size();
+		mRowTree[i] += mChunkRows[i - 1];
+		auto parent = i + LowBit(i);
+		if (parent < mLineTree.size())
+		{
+			mLineTree[parent] += mLineTree[i];
+			mRowTree[parent] += mRowTree[i];
+		}
+	}
+}
+
+void TextEditor::SetLanguageDefinition(const LanguageDefinitionPtr & aLanguageDef)
+{
+	mLanguageDefinition = aLanguageDef;
+	mColorizerConfig = GetColorizerConfig(aLanguageDef);
 
 	Colorize();
 }
 
+void TextEditor::SetLanguageDefinition(const LanguageDefinition & aLanguageDef)
+{
+	SetLanguageDefinition(std::make_shared<const LanguageDefinition>(aLanguageDef));
+}
+
+std::shared_ptr<const TextEditor::ColorizerConfig> TextEditor::GetColorizerConfig(const LanguageDefinitionPtr& aLanguageDef)
+{
+	// Each entry lives as long as some editor or job holds it. A live entry keeps its definition
+	// alive too, so its key cannot be reused by another definition.
+	static std::mutex mutex;
+	static std::unordered_map<const LanguageDefinition*, std::weak_ptr<const ColorizerConfig>> configs;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& entry = configs[aLanguageDef.get()];
+	if (auto config = entry.lock())
+		return config;
+
+	auto config = std::make_shared<ColorizerConfig>();
+	config->mLanguage = aLanguageDef;
+	if (!config->mTokenDfa.Compile(aLanguageDef->mTokenRegexStrings))
+	{
+		for (auto& r : aLanguageDef->mTokenRegexStrings)
+			config->mRegexList.push_back(std::make_pair(std::regex(r.first, std::regex_constants::optimize), r.second));
+	}
+	entry = config;
+
+	for (auto it = configs.begin(); it != configs.end(); )
+		it = it->second.expired() ? configs.erase(it) : std::next(it);
+
+	return config;
+}
+
 void TextEditor::SetPalette(const Palette & aValue)
 {
 	mPaletteBase = aValue;
@@ -84,27 +625,26 @@ std::string TextEditor::GetText(const Coordinates & aStart, const Coordinates &
 	auto iend = GetCharacterIndex(aEnd);
 	size_t s = 0;
 
-	for (size_t i = lstart; i < lend; i++)
-		s += mLines[i].size();
+	for (int i = lstart; i < lend && i < (int)mLines.size(); i++)
+		s += mLines[i].size() + 1;
 
-	result.reserve(s + s / 8);
+	result.reserve(s);
 
-	while (istart < iend || lstart < lend)
+	for (; lstart < (int)mLines.size(); ++lstart)
 	{
-		if (lstart >= (int)mLines.size())
-			break;
-
 		auto& line = mLines[lstart];
-		if (istart < (int)line.size())
+		if (lstart < lend)
 		{
-			result += line[istart].mChar;
-			istart++;
+			if (istart < (int)line.size())
+				result.append(line.data() + istart, line.size() - istart);
+			result += '\n';
+			istart = 0;
 		}
 		else
 		{
-			istart = 0;
-			++lstart;
-			result += '\n';
+			if (istart < iend)
+				result.append(line.data() + istart, std::min(iend, (int)line.size()) - istart);
+			break;
 		}
 	}
 
@@ -158,6 +698,24 @@ static int UTF8CharLength(TextEditor::Char c)
 	return 1;
 }
 
+// Decodes the character at aText into the codepoint ImGui looks glyphs up by, returning its length
+static int UTF8Decode(const char* aText, const char* aEnd, ImWchar& aChar)
+{
+	auto c = (unsigned char)*aText;
+	auto length = UTF8CharLength(c);
+	if (length > 4 || length > aEnd - aText)
+	{
+		aChar = IM_UNICODE_CODEPOINT_INVALID;
+		return 1;
+	}
+
+	unsigned int codepoint = length == 1 ? c : c & (0x7F >> length);
+	for (int i = 1; i < length; ++i)
+		codepoint = (codepoint << 6) | ((unsigned char)aText[i] & 0x3F);
+	aChar = codepoint <= IM_UNICODE_CODEPOINT_MAX ? (ImWchar)codepoint : IM_UNICODE_CODEPOINT_INVALID;
+	return length;
+}
+
 // "Borrowed" from ImGui source
 static inline int ImTextCharToUtf8(char* buf, int buf_size, unsigned int c)
 {
@@ -205,7 +763,7 @@ void TextEditor::Advance(Coordinates & aCoordinates) const
 
 		if (cindex + 1 < (int)line.size())
 		{
-			auto delta = UTF8CharLength(line[cindex].mChar);
+			auto delta = UTF8CharLength(line.mChars[cindex]);
 			cindex = std::min(cindex + delta, (int)line.size() - 1);
 		}
 		else
@@ -235,20 +793,20 @@ void TextEditor::DeleteRange(const Coordinates & aStart, const Coordinates & aEn
 		auto& line = mLines[aStart.mLine];
 		auto n = GetLineMaxColumn(aStart.mLine);
 		if (aEnd.mColumn >= n)
-			line.erase(line.begin() + start, line.end());
+			line.erase(start, line.size());
 		else
-			line.erase(line.begin() + start, line.begin() + end);
+			line.erase(start, end);
 	}
 	else
 	{
 		auto& firstLine = mLines[aStart.mLine];
 		auto& lastLine = mLines[aEnd.mLine];
 
-		firstLine.erase(firstLine.begin() + start, firstLine.end());
-		lastLine.erase(lastLine.begin(), lastLine.begin() + end);
+		firstLine.erase(start, firstLine.size());
+		lastLine.erase(0, end);
 
 		if (aStart.mLine < aEnd.mLine)
-			firstLine.insert(firstLine.end(), lastLine.begin(), lastLine.end());
+			firstLine.append(lastLine, 0, lastLine.size());
 
 		if (aStart.mLine < aEnd.mLine)
 			RemoveLine(aStart.mLine + 1, aEnd.mLine + 1);
@@ -260,13 +818,15 @@ void TextEditor::DeleteRange(const Coordinates & aStart, const Coordinates & aEn
 int TextEditor::InsertTextAt(Coordinates& /* inout */ aWhere, const char * aValue)
 {
 	assert(!mReadOnly);
+	assert(!mLines.empty());
 
-	int cindex = GetCharacterIndex(aWhere);
-	int totalLines = 0;
+	// Collect the text up to the first newline (it goes into the current line) and every
+	// following line first, then splice them in with one insert each.
+	Line head;
+	std::vector<Line> newLines;
+	int column = aWhere.mColumn;
 	while (*aValue != '\0')
 	{
-		assert(!mLines.empty());
-
 		if (*aValue == '\r')
 		{
 			// skip
@@ -274,35 +834,43 @@ int TextEditor::InsertTextAt(Coordinates& /* inout */ aWhere, const char * aValu
 		}
 		else if (*aValue == '\n')
 		{
-			if (cindex < (int)mLines[aWhere.mLine].size())
-			{
-				auto& newLine = InsertLine(aWhere.mLine + 1);
-				auto& line = mLines[aWhere.mLine];
-				newLine.insert(newLine.begin(), line.begin() + cindex, line.end());
-				line.erase(line.begin() + cindex, line.end());
-			}
-			else
-			{
-				InsertLine(aWhere.mLine + 1);
-			}
-			++aWhere.mLine;
-			aWhere.mColumn = 0;
-			cindex = 0;
-			++totalLines;
+			newLines.emplace_back();
+			column = 0;
 			++aValue;
 		}
 		else
 		{
-			auto& line = mLines[aWhere.mLine];
+			auto& run = newLines.empty() ? head : newLines.back();
 			auto d = UTF8CharLength(*aValue);
+			auto from = aValue;
 			while (d-- > 0 && *aValue != '\0')
-				line.insert(line.begin() + cindex++, Glyph(*aValue++, PaletteIndex::Default));
-			++aWhere.mColumn;
+				++aValue;
+			run.insert(run.size(), (const Char*)from, aValue - from);
+			++column;
 		}
 
 		mTextChanged = true;
 	}
 
+	int cindex = GetCharacterIndex(aWhere);
+	auto& line = mLines[aWhere.mLine];
+	int totalLines = (int)newLines.size();
+	if (newLines.empty())
+	{
+		line.insert(cindex, head, 0, head.size());
+	}
+	else
+	{
+		auto& tail = newLines.back();
+		tail.append(line, cindex, line.size());
+		line.erase(cindex, line.size());
+		line.append(head, 0, head.size());
+
+		InsertLines(aWhere.mLine + 1, std::move(newLines));
+		aWhere.mLine += totalLines;
+	}
+	aWhere.mColumn = column;
+
 	return totalLines;
 }
 
@@ -327,50 +895,90 @@ TextEditor::Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2& aPositi
 	ImVec2 local(aPosition.x - origin.x, aPosition.y - origin.y);
 
 	int lineNo = std::max(0, (int)floor(local.y / mCharAdvance.y));
+	int row = 0;
+
+	// With word wrap lineNo is a visual row so far
+	if (IsWrapping() && mWrapRows.size() == mLines.size())
+	{
+		row = lineNo;
+		lineNo = row < mWrapRows.GetRowCount() ? (int)mWrapRows.FindLine(row) : (int)mLines.size();
+		if (lineNo < (int)mLines.size())
+			row -= mWrapRows.GetFirstRow(lineNo);
+	}
 
+	if (lineNo >= (int)mLines.size())
+		return SanitizeCoordinates(Coordinates(lineNo, 0));
+
+	return SanitizeCoordinates(TextPosToCoordinates(lineNo, row, local.x - mTextStart));
+}
+
+// The position in visual row aRow of a line (always 0 without word wrap) closest to aX pixels
+// right of the text start
+TextEditor::Coordinates TextEditor::TextPosToCoordinates(int aLineNo, int aRow, float aX) const
+{
+	auto& line = mLines.at(aLineNo);
+
+	int columnIndex = 0;
 	int columnCoord = 0;
+	float columnX = 0.0f;
+	int endIndex = (int)line.size();
+	bool rowContinues = false;
+	std::vector<RowStart> rows;
+	if (IsWrapping())
+	{
+		auto wrapped = FindWrappedLine(line);
+		if (wrapped == nullptr)
+		{
+			WrapLine(line, &rows);
+			wrapped = &rows;
+		}
+		aRow = std::min(aRow, (int)wrapped->size() - 1);
+		columnIndex = (*wrapped)[aRow].mIndex;
+		columnCoord = (*wrapped)[aRow].mColumn;
+		rowContinues = aRow + 1 < (int)wrapped->size();
+		if (rowContinues)
+			endIndex = (*wrapped)[aRow + 1].mIndex;
+	}
+	else if (auto longLine = FindLongLine(line))
+	{
+		auto& checkpoint = FindCheckpoint(*longLine, &LineCheckpoint::mX, aX);
+		columnIndex = checkpoint.mIndex;
+		columnX = checkpoint.mX;
+		columnCoord = checkpoint.mColumn;
+	}
 
-	if (lineNo >= 0 && lineNo < (int)mLines.size())
+	while (columnIndex < endIndex)
 	{
-		auto& line = mLines.at(lineNo);
+		float columnWidth = 0.0f;
+		auto d = std::min(UTF8CharLength(line.mChars[columnIndex]), (int)line.size() - columnIndex);
 
-		int columnIndex = 0;
-		float columnX = 0.0f;
+		// The end of a row that continues below is where the next row starts, so stay in front
+		// of its last character
+		if (rowContinues && columnIndex + d >= endIndex)
+			break;
 
-		while ((size_t)columnIndex < line.size())
+		if (line.mChars[columnIndex] == '\t')
 		{
-			float columnWidth = 0.0f;
-
-			if (line[columnIndex].mChar == '\t')
-			{
-				float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ").x;
-				float oldX = columnX;
-				float newColumnX = (1.0f + std::floor((1.0f + columnX) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
-				columnWidth = newColumnX - oldX;
-				if (mTextStart + columnX + columnWidth * 0.5f > local.x)
-					break;
-				columnX = newColumnX;
-				columnCoord = (columnCoord / mTabSize) * mTabSize + mTabSize;
-				columnIndex++;
-			}
-			else
-			{
-				char buf[7];
-				auto d = UTF8CharLength(line[columnIndex].mChar);
-				int i = 0;
-				while (i < 6 && d-- > 0)
-					buf[i++] = line[columnIndex++].mChar;
-				buf[i] = '\0';
-				columnWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf).x;
-				if (mTextStart + columnX + columnWidth * 0.5f > local.x)
-					break;
-				columnX += columnWidth;
-				columnCoord++;
-			}
+			float newColumnX = NextTabStop(columnX);
+			columnWidth = newColumnX - columnX;
+			if (columnX + columnWidth * 0.5f > aX)
+				break;
+			columnX = newColumnX;
+			columnCoord = (columnCoord / mTabSize) * mTabSize + mTabSize;
+			columnIndex++;
+		}
+		else
+		{
+			columnWidth = TextWidth(line.data() + columnIndex, line.data() + columnIndex + d);
+			columnIndex += d;
+			if (columnX + columnWidth * 0.5f > aX)
+				break;
+			columnX += columnWidth;
+			columnCoord++;
 		}
 	}
 
-	return SanitizeCoordinates(Coordinates(lineNo, columnCoord));
+	return Coordinates(aLineNo, columnCoord);
 }
 
 TextEditor::Coordinates TextEditor::FindWordStart(const Coordinates & aFrom) const
@@ -385,13 +993,13 @@ TextEditor::Coordinates TextEditor::FindWordStart(const Coordinates & aFrom) con
 	if (cindex >= (int)line.size())
 		return at;
 
-	while (cindex > 0 && isspace(line[cindex].mChar))
+	while (cindex > 0 && isspace(line.mChars[cindex]))
 		--cindex;
 
-	auto cstart = (PaletteIndex)line[cindex].mColorIndex;
+	auto cstart = (line.mColors[cindex] & GlyphColorMask);
 	while (cindex > 0)
 	{
-		auto c = line[cindex].mChar;
+		auto c = line.mChars[cindex];
 		if ((c & 0xC0) != 0x80)	// not UTF code sequence 10xxxxxx
 		{
 			if (c <= 32 && isspace(c))
@@ -399,7 +1007,7 @@ TextEditor::Coordinates TextEditor::FindWordStart(const Coordinates & aFrom) con
 				cindex++;
 				break;
 			}
-			if (cstart != (PaletteIndex)line[size_t(cindex - 1)].mColorIndex)
+			if (cstart != (line.mColors[size_t(cindex - 1)] & GlyphColorMask))
 				break;
 		}
 		--cindex;
@@ -419,19 +1027,19 @@ TextEditor::Coordinates TextEditor::FindWordEnd(const Coordinates & aFrom) const
 	if (cindex >= (int)line.size())
 		return at;
 
-	bool prevspace = (bool)isspace(line[cindex].mChar);
-	auto cstart = (PaletteIndex)line[cindex].mColorIndex;
+	bool prevspace = (bool)isspace(line.mChars[cindex]);
+	auto cstart = (line.mColors[cindex] & GlyphColorMask);
 	while (cindex < (int)line.size())
 	{
-		auto c = line[cindex].mChar;
+		auto c = line.mChars[cindex];
 		auto d = UTF8CharLength(c);
-		if (cstart != (PaletteIndex)line[cindex].mColorIndex)
+		if (cstart != (line.mColors[cindex] & GlyphColorMask))
 			break;
 
 		if (prevspace != !!isspace(c))
 		{
 			if (isspace(c))
-				while (cindex < (int)line.size() && isspace(line[cindex].mChar))
+				while (cindex < (int)line.size() && isspace(line.mChars[cindex]))
 					++cindex;
 			break;
 		}
@@ -453,7 +1061,7 @@ TextEditor::Coordinates TextEditor::FindNextWord(const Coordinates & aFrom) cons
 	if (cindex < (int)mLines[at.mLine].size())
 	{
 		auto& line = mLines[at.mLine];
-		isword = isalnum(line[cindex].mChar);
+		isword = isalnum(line.mChars[cindex]);
 		skip = isword;
 	}
 
@@ -468,7 +1076,7 @@ TextEditor::Coordinates TextEditor::FindNextWord(const Coordinates & aFrom) cons
 		auto& line = mLines[at.mLine];
 		if (cindex < (int)line.size())
 		{
-			isword = isalnum(line[cindex].mChar);
+			isword = isalnum(line.mChars[cindex]);
 
 			if (isword && !skip)
 				return Coordinates(at.mLine, GetCharacterColumn(at.mLine, cindex));
@@ -497,13 +1105,19 @@ int TextEditor::GetCharacterIndex(const Coordinates& aCoordinates) const
 	auto& line = mLines[aCoordinates.mLine];
 	int c = 0;
 	int i = 0;
+	if (auto longLine = FindLongLine(line))
+	{
+		auto& checkpoint = FindCheckpoint(*longLine, &LineCheckpoint::mColumn, aCoordinates.mColumn);
+		c = checkpoint.mColumn;
+		i = checkpoint.mIndex;
+	}
 	for (; i < line.size() && c < aCoordinates.mColumn;)
 	{
-		if (line[i].mChar == '\t')
+		if (line.mChars[i] == '\t')
 			c = (c / mTabSize) * mTabSize + mTabSize;
 		else
 			++c;
-		i += UTF8CharLength(line[i].mChar);
+		i += UTF8CharLength(line.mChars[i]);
 	}
 	return i;
 }
@@ -515,9 +1129,15 @@ int TextEditor::GetCharacterColumn(int aLine, int aIndex) const
 	auto& line = mLines[aLine];
 	int col = 0;
 	int i = 0;
+	if (auto longLine = FindLongLine(line))
+	{
+		auto& checkpoint = FindCheckpoint(*longLine, &LineCheckpoint::mIndex, aIndex);
+		col = checkpoint.mColumn;
+		i = checkpoint.mIndex;
+	}
 	while (i < aIndex && i < (int)line.size())
 	{
-		auto c = line[i].mChar;
+		auto c = line.mChars[i];
 		i += UTF8CharLength(c);
 		if (c == '\t')
 			col = (col / mTabSize) * mTabSize + mTabSize;
@@ -534,7 +1154,7 @@ int TextEditor::GetLineCharacterCount(int aLine) const
 	auto& line = mLines[aLine];
 	int c = 0;
 	for (unsigned i = 0; i < line.size(); c++)
-		i += UTF8CharLength(line[i].mChar);
+		i += UTF8CharLength(line.mChars[i]);
 	return c;
 }
 
@@ -543,10 +1163,12 @@ int TextEditor::GetLineMaxColumn(int aLine) const
 	if (aLine >= mLines.size())
 		return 0;
 	auto& line = mLines[aLine];
+	if (auto longLine = FindLongLine(line))
+		return longLine->mMaxColumn;
 	int col = 0;
 	for (unsigned i = 0; i < line.size(); )
 	{
-		auto c = line[i].mChar;
+		auto c = line.mChars[i];
 		if (c == '\t')
 			col = (col / mTabSize) * mTabSize + mTabSize;
 		else
@@ -567,9 +1189,9 @@ bool TextEditor::IsOnWordBoundary(const Coordinates & aAt) const
 		return true;
 
 	if (mColorizerEnabled)
-		return line[cindex].mColorIndex != line[size_t(cindex - 1)].mColorIndex;
+		return (line.mColors[cindex] & GlyphColorMask) != (line.mColors[size_t(cindex - 1)] & GlyphColorMask);
 
-	return isspace(line[cindex].mChar) != isspace(line[cindex - 1].mChar);
+	return isspace(line.mChars[cindex]) != isspace(line.mChars[cindex - 1]);
 }
 
 void TextEditor::RemoveLine(int aStart, int aEnd)
@@ -597,8 +1219,10 @@ void TextEditor::RemoveLine(int aStart, int aEnd)
 	}
 	mBreakpoints = std::move(btmp);
 
-	mLines.erase(mLines.begin() + aStart, mLines.begin() + aEnd);
+	mLines.erase(aStart, aEnd);
 	assert(!mLines.empty());
+	ShiftColorizeRanges(aStart, aStart - aEnd);
+	ShiftWrapRows(aStart, aStart - aEnd);
 
 	mTextChanged = true;
 }
@@ -627,29 +1251,57 @@ void TextEditor::RemoveLine(int aIndex)
 	}
 	mBreakpoints = std::move(btmp);
 
-	mLines.erase(mLines.begin() + aIndex);
+	mLines.erase(aIndex, aIndex + 1);
 	assert(!mLines.empty());
+	ShiftColorizeRanges(aIndex, -1);
+	ShiftWrapRows(aIndex, -1);
 
 	mTextChanged = true;
 }
 
 TextEditor::Line& TextEditor::InsertLine(int aIndex)
+{
+	std::vector<Line> lines(1);
+	InsertLines(aIndex, std::move(lines));
+	return mLines[aIndex];
+}
+
+void TextEditor::InsertLines(int aIndex, std::vector<Line>&& aLines)
 {
 	assert(!mReadOnly);
 
-	auto& result = *mLines.insert(mLines.begin() + aIndex, Line());
+	const int count = (int)aLines.size();
+	mLines.insert(aIndex, std::move(aLines));
+	ShiftColorizeRanges(aIndex, count);
+	ShiftWrapRows(aIndex, count);
 
 	ErrorMarkers etmp;
 	for (auto& i : mErrorMarkers)
-		etmp.insert(ErrorMarkers::value_type(i.first >= aIndex ? i.first + 1 : i.first, i.second));
+		etmp.insert(ErrorMarkers::value_type(i.first >= aIndex ? i.first + count : i.first, i.second));
 	mErrorMarkers = std::move(etmp);
 
 	Breakpoints btmp;
 	for (auto i : mBreakpoints)
-		btmp.insert(i >= aIndex ? i + 1 : i);
+		btmp.insert(i >= aIndex ? i + count : i);
 	mBreakpoints = std::move(btmp);
+}
 
-	return result;
+void TextEditor::ShiftColorizeRanges(int aIndex, int aCount)
+{
+	// Keep the pending ranges on the same lines when lines are inserted (aCount > 0) or removed
+	// (aCount < 0) in front of them, as the colorizer may only get to them a few frames later
+	auto shift = [aIndex, aCount](int& aLine) { if (aLine > aIndex) aLine = std::max(aIndex, aLine + aCount); };
+
+	if (mColorRangeMin < mColorRangeMax)
+	{
+		shift(mColorRangeMin);
+		shift(mColorRangeMax);
+	}
+	if (mCommentRangeMin < mCommentRangeMax)
+	{
+		shift(mCommentRangeMin);
+		shift(mCommentRangeMax);
+	}
 }
 
 std::string TextEditor::GetWordUnderCursor() const
@@ -668,22 +1320,22 @@ std::string TextEditor::GetWordAt(const Coordinates & aCoords) const
 	auto istart = GetCharacterIndex(start);
 	auto iend = GetCharacterIndex(end);
 
-	for (auto it = istart; it < iend; ++it)
-		r.push_back(mLines[aCoords.mLine][it].mChar);
+	if (istart < iend)
+		r.assign(mLines[aCoords.mLine].data() + istart, iend - istart);
 
 	return r;
 }
 
-ImU32 TextEditor::GetGlyphColor(const Glyph & aGlyph) const
+ImU32 TextEditor::GetGlyphColor(uint8_t aColor) const
 {
 	if (!mColorizerEnabled)
 		return mPalette[(int)PaletteIndex::Default];
-	if (aGlyph.mComment)
+	if (aColor & GlyphComment)
 		return mPalette[(int)PaletteIndex::Comment];
-	if (aGlyph.mMultiLineComment)
+	if (aColor & GlyphMultiLineComment)
 		return mPalette[(int)PaletteIndex::MultiLineComment];
-	auto const color = mPalette[(int)aGlyph.mColorIndex];
-	if (aGlyph.mPreprocessor)
+	auto const color = mPalette[aColor & GlyphColorMask];
+	if (aColor & GlyphPreprocessor)
 	{
 		const auto ppcolor = mPalette[(int)PaletteIndex::Preprocessor];
 		const int c0 = ((ppcolor & 0xff) + (color & 0xff)) / 2;
@@ -851,19 +1503,453 @@ void TextEditor::HandleMouseInputs()
 	}
 }
 
-void TextEditor::Render()
+// Draws the colorized text of a line starting at aPosition and returns its width. Long lines
+// start at a checkpoint, aStart bytes and aStartX pixels into the line, and stop past aEndX.
+float TextEditor::LayoutLine(const Line& aLine, ImDrawList* aDrawList, const ImVec2& aPosition, int aStart, int aEnd, float aStartX, float aEndX)
 {
-	/* Compute mCharAdvance regarding to scaled font size (Ctrl + mouse wheel)*/
-	const float fontSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, "#", nullptr, nullptr).x;
-	mCharAdvance = ImVec2(fontSize, ImGui::GetTextLineHeightWithSpacing() * mLineSpacing);
+	auto prevColor = aStart >= (int)aLine.size() ? mPalette[(int)PaletteIndex::Default] : GetGlyphColor(aLine.mColors[aStart]);
+	ImVec2 bufferOffset(aStartX, 0.0f);
+	const bool clipped = aEndX < FLT_MAX;
+	float runWidth = 0.0f;	// of mLineBuffer, only needed to know where a clipped line ends
+	const int end = std::min(aEnd, (int)aLine.size());
+
+	for (int i = aStart; i < end;)
+	{
+		if (clipped && bufferOffset.x + runWidth > aEndX)
+			break;
+
+		auto ch = aLine.mChars[i];
+		auto color = GetGlyphColor(aLine.mColors[i]);
+
+		if ((color != prevColor || ch == '\t' || ch == ' ') && !mLineBuffer.empty())
+		{
+			const ImVec2 newOffset(aPosition.x + bufferOffset.x, aPosition.y + bufferOffset.y);
+			aDrawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
+			bufferOffset.x += TextWidth(mLineBuffer.data(), mLineBuffer.data() + mLineBuffer.size());
+			mLineBuffer.clear();
+			runWidth = 0.0f;
+		}
+		prevColor = color;
+
+		if (ch == '\t')
+		{
+			auto oldX = bufferOffset.x;
+			bufferOffset.x = NextTabStop(bufferOffset.x);
+			++i;
 
+			if (mShowWhitespaces)
+			{
+				const auto s = ImGui::GetFontSize();
+				const auto x1 = aPosition.x + oldX + 1.0f;
+				const auto x2 = aPosition.x + bufferOffset.x - 1.0f;
+				const auto y = aPosition.y + bufferOffset.y + s * 0.5f;
+				const ImVec2 p1(x1, y);
+				const ImVec2 p2(x2, y);
+				const ImVec2 p3(x2 - s * 0.2f, y - s * 0.2f);
+				const ImVec2 p4(x2 - s * 0.2f, y + s * 0.2f);
+				aDrawList->AddLine(p1, p2, 0x90909090);
+				aDrawList->AddLine(p2, p3, 0x90909090);
+				aDrawList->AddLine(p2, p4, 0x90909090);
+			}
+		}
+		else if (ch == ' ')
+		{
+			if (mShowWhitespaces)
+			{
+				const auto s = ImGui::GetFontSize();
+				const auto x = aPosition.x + bufferOffset.x + mSpaceAdvance * 0.5f;
+				const auto y = aPosition.y + bufferOffset.y + s * 0.5f;
+				aDrawList->AddCircleFilled(ImVec2(x, y), 1.5f, 0x80808080, 4);
+			}
+			bufferOffset.x += mSpaceAdvance;
+			i++;
+		}
+		else
+		{
+			auto l = UTF8CharLength(ch);
+			if (clipped)
+				runWidth += TextWidth(aLine.data() + i, aLine.data() + std::min(i + l, (int)aLine.size()));
+			while (l-- > 0 && i < (int)aLine.size())
+				mLineBuffer.push_back(aLine.mChars[i++]);
+		}
+	}
+
+	if (!mLineBuffer.empty())
+	{
+		const ImVec2 newOffset(aPosition.x + bufferOffset.x, aPosition.y + bufferOffset.y);
+		aDrawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
+		bufferOffset.x += TextWidth(mLineBuffer.data(), mLineBuffer.data() + mLineBuffer.size());
+		mLineBuffer.clear();
+	}
+
+	return bufferOffset.x;
+}
+
+// Returns the layout of a line, laid out again if the line changed since it was last drawn, or
+// nullptr for lines too long to cache
+const TextEditor::LineLayout* TextEditor::GetLineLayout(int aLineNo, const ImVec2& aPosition, const ImDrawList* aDrawList)
+{
+	auto& line = mLines[aLineNo];
+	AssignLineVersion(line);
+	if (line.size() > kMaxLayoutLength)
+		return nullptr;
+
+	// Glyphs snap to whole pixels, so the line is laid out at the fraction of its position and
+	// moved by whole pixels when it is drawn
+	const ImVec2 origin(aPosition.x - std::floor(aPosition.x), aPosition.y - std::floor(aPosition.y));
+
+	auto& layout = mLineLayouts[line.mVersion];
+	const bool current = layout.mFrame != 0 && layout.mOrigin.x == origin.x && layout.mOrigin.y == origin.y;
+	layout.mFrame = mLayoutFrame;
+	if (current)
+		return &layout;
+
+	if (!mLayoutDrawList)
+		mLayoutDrawList = std::make_unique<ImDrawList>(ImGui::GetDrawListSharedData());
+	auto& drawList = *mLayoutDrawList;
+	drawList._ResetForNewFrame();
+	drawList.Flags = aDrawList->Flags;
+	drawList.PushTextureID(mLayoutTexture);
+	drawList.PushClipRect(ImVec2(-FLT_MAX, -FLT_MAX), ImVec2(FLT_MAX, FLT_MAX));
+
+	layout.mWidth = LayoutLine(line, &drawList, origin);
+	layout.mMaxColumn = GetLineMaxColumn(aLineNo);
+	layout.mOrigin = origin;
+	layout.mVertices.assign(drawList.VtxBuffer.begin(), drawList.VtxBuffer.end());
+	layout.mIndices.assign(drawList.IdxBuffer.begin(), drawList.IdxBuffer.end());
+	assert(drawList.CmdBuffer.Size == 1 && drawList.VtxBuffer.Size <= 0xffff);
+	return &layout;
+}
+
+// Returns the checkpoints of a line too long to cache its layout, walking the line once after
+// it changed. GetLineLayout or GetWrappedLine has given it a version.
+const TextEditor::LongLine* TextEditor::GetLongLine(int aLineNo)
+{
+	auto& line = mLines[aLineNo];
+	auto& longLine = mLongLines[line.mVersion];
+	const bool current = longLine.mFrame != 0;
+	longLine.mFrame = mLayoutFrame;
+	if (current)
+		return &longLine;
+
+	longLine.mCheckpoints.clear();
+	int column = 0;
+	float x = 0.0f;
+	int next = 0;
+	for (int i = 0; i < (int)line.size();)
+	{
+		if (i >= next)
+		{
+			longLine.mCheckpoints.push_back({ i, column, x });
+			next = i + kCheckpointInterval;
+		}
+
+		auto c = line.mChars[i];
+		auto d = UTF8CharLength(c);
+		if (c == '\t')
+		{
+			x = NextTabStop(x);
+			column = (column / mTabSize) * mTabSize + mTabSize;
+		}
+		else
+		{
+			x += TextWidth(line.data() + i, line.data() + std::min(i + d, (int)line.size()));
+			++column;
+		}
+		i += d;
+	}
+	longLine.mWidth = x;
+	longLine.mMaxColumn = column;
+	return &longLine;
+}
+
+// The checkpoints of a long line Render has drawn since it last changed, or nullptr
+const TextEditor::LongLine* TextEditor::FindLongLine(const Line& aLine) const
+{
+	if (aLine.mVersion == 0 || aLine.size() <= kMaxLayoutLength)
+		return nullptr;
+	auto it = mLongLines.find(aLine.mVersion);
+	return it != mLongLines.end() ? &it->second : nullptr;
+}
+
+// The last checkpoint whose aMember is at most aValue
+template <typename T>
+const TextEditor::LineCheckpoint& TextEditor::FindCheckpoint(const LongLine& aLongLine, T LineCheckpoint::* aMember, T aValue)
+{
+	auto& checkpoints = aLongLine.mCheckpoints;
+	auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), aValue,
+		[aMember](T aValue, const LineCheckpoint& aCheckpoint) { return aValue < aCheckpoint.*aMember; });
+	return it == checkpoints.begin() ? *it : *(it - 1);
+}
+
+// Appends the geometry of a layout to the current draw command, the way AddText would
+void TextEditor::DrawLineLayout(const LineLayout& aLayout, ImDrawList* aDrawList, const ImVec2& aPosition) const
+{
+	if (aLayout.mIndices.empty())
+		return;
+
+	const ImVec2 offset(std::floor(aPosition.x), std::floor(aPosition.y));
+	const auto vertexCount = (int)aLayout.mVertices.size();
+	const auto indexCount = (int)aLayout.mIndices.size();
+	aDrawList->PrimReserve(indexCount, vertexCount);
+
+	const auto base = aDrawList->_VtxCurrentIdx;
+	auto vertex = aDrawList->_VtxWritePtr;
+	for (const auto& v : aLayout.mVertices)
+	{
+		*vertex = v;
+		vertex->pos.x += offset.x;
+		vertex->pos.y += offset.y;
+		++vertex;
+	}
+	auto index = aDrawList->_IdxWritePtr;
+	for (auto i : aLayout.mIndices)
+		*index++ = (ImDrawIdx)(base + i);
+
+	aDrawList->_VtxWritePtr = vertex;
+	aDrawList->_IdxWritePtr = index;
+	aDrawList->_VtxCurrentIdx += vertexCount;
+}
+
+// Gives a line that changed since it was last drawn a new key into the layout caches
+void TextEditor::AssignLineVersion(Line& aLine)
+{
+	if (aLine.mVersion != 0)
+		return;
+	if (++mLayoutVersion == 0)
+		++mLayoutVersion;
+	aLine.mVersion = mLayoutVersion;
+}
+
+// More changed lines than this are wrapped on all cores
+static const size_t kParallelWrapLines = 16384;
+
+// Counts the rows aLine takes at mWrapWidth and fills aRows with where they start. A row ends
+// behind the last whitespace that fits, and whitespace may hang over the edge, so a row never
+// starts with the spaces that ended the row above. Tab stops count from the start of the row.
+int TextEditor::WrapLine(const Line& aLine, std::vector<RowStart>* aRows) const
+{
+	if (aRows != nullptr)
+	{
+		aRows->clear();
+		aRows->push_back({ 0, 0 });
+	}
+
+	// No glyph is wider than mMaxAdvance and no tab wider than a tab stop plus a pixel, so most
+	// lines are known to fit without measuring them
+	const auto size = (int)aLine.size();
+	const auto tabs = (int)std::count(aLine.mChars.begin(), aLine.mChars.end(), (Char)'\t');
+	if ((size - tabs) * mMaxAdvance + tabs * (mTabSize * mSpaceAdvance + 1.0f) <= mWrapWidth)
+		return 1;
+
+	int rows = 1;
+	int rowStart = 0;
+	int column = 0;
+	float x = 0.0f;
+	int breakIndex = 0;		// behind the last whitespace of the row
+	int breakColumn = 0;
+	for (int i = 0; i < size;)
+	{
+		auto c = aLine.mChars[i];
+		auto d = std::min(UTF8CharLength(c), size - i);
+		const bool space = c == ' ' || c == '\t';
+		const float advance = c == '\t' ? NextTabStop(x) - x : c == ' ' ? mSpaceAdvance : TextWidth(aLine.data() + i, aLine.data() + i + d);
+		if (!space && i > rowStart && x + advance > mWrapWidth)
+		{
+			// Words too long for a row are broken wherever the row is full
+			if (breakIndex > rowStart)
+			{
+				i = breakIndex;
+				column = breakColumn;
+			}
+			rowStart = i;
+			x = 0.0f;
+			++rows;
+			if (aRows != nullptr)
+				aRows->push_back({ i, column });
+			continue;
+		}
+
+		x += advance;
+		column = c == '\t' ? (column / mTabSize) * mTabSize + mTabSize : column + 1;
+		i += d;
+		if (space)
+		{
+			breakIndex = i;
+			breakColumn = column;
+		}
+	}
+	return rows;
+}
+
+// Counts the rows of the lines that changed since the last call, or of all lines after the
+// width changed. Many lines at once are spread over all cores.
+void TextEditor::UpdateWrap()
+{
+	if (!IsWrapping())
+		return;
+	if (mWrapRows.size() != mLines.size())
+	{
+		mWrapRows.resize(mLines.size());
+		mWrapRangeMin = 0;
+		mWrapRangeMax = (int)mLines.size();
+	}
+	mWrapRangeMax = std::min(mWrapRangeMax, (int)mLines.size());
+	if (mWrapRangeMin >= mWrapRangeMax)
+		return;
+
+	// The worker threads must not look lines up themselves, Lines caches the last chunk it found
+	std::vector<const Line*> lines(mWrapRangeMax - mWrapRangeMin);
+	for (size_t i = 0; i < lines.size(); ++i)
+		lines[i] = &mLines[mWrapRangeMin + i];
+
+	std::vector<int> rows(lines.size());
+	auto wrap = [&](size_t aFrom, size_t aTo) {
+		for (auto i = aFrom; i < aTo; ++i)
+			rows[i] = WrapLine(*lines[i], nullptr);
+	};
+	const size_t rangeCount = std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned)(lines.size() / kParallelWrapLines)));
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < rangeCount; ++i)
+		threads.emplace_back(wrap, lines.size() * i / rangeCount, lines.size() * (i + 1) / rangeCount);
+	wrap(0, lines.size() / rangeCount);
+	for (auto& thread : threads)
+		thread.join();
+
+	mWrapRows.assign(mWrapRangeMin, rows);
+	mWrapRangeMin = mWrapRangeMax = 0;
+}
+
+// Marks lines whose rows have to be counted again, all of them by default
+void TextEditor::InvalidateWrap(int aFromLine, int aToLine)
+{
+	if (!IsWrapping())
+		return;
+
+	aFromLine = std::max(0, aFromLine);
+	aToLine = std::min(aToLine, (int)mLines.size());
+	if (aFromLine >= aToLine)
+		return;
+
+	if (mWrapRangeMin < mWrapRangeMax)
+	{
+		mWrapRangeMin = std::min(mWrapRangeMin, aFromLine);
+		mWrapRangeMax = std::max(mWrapRangeMax, aToLine);
+	}
+	else
+	{
+		mWrapRangeMin = aFromLine;
+		mWrapRangeMax = aToLine;
+	}
+}
+
+// Keeps the row counts on their lines when lines are inserted (aCount > 0) or removed
+// (aCount < 0). Inserted lines are counted with the next UpdateWrap.
+void TextEditor::ShiftWrapRows(int aIndex, int aCount)
+{
+	if (!IsWrapping() || (int)mWrapRows.size() + aCount != (int)mLines.size())
+		return;
+
+	if (aCount > 0)
+		mWrapRows.insert(aIndex, aCount);
+	else
+		mWrapRows.erase(aIndex, aIndex - aCount);
+
+	if (mWrapRangeMin < mWrapRangeMax)
+	{
+		auto shift = [aIndex, aCount](int& aLine) { if (aLine > aIndex) aLine = std::max(aIndex, aLine + aCount); };
+		shift(mWrapRangeMin);
+		shift(mWrapRangeMax);
+	}
+	if (aCount > 0)
+		InvalidateWrap(aIndex, aIndex + aCount);
+}
+
+// Returns where the rows of a line start, wrapping it again if it changed since it was last used
+const std::vector<TextEditor::RowStart>& TextEditor::GetWrappedLine(int aLineNo)
+{
+	auto& line = mLines[aLineNo];
+	AssignLineVersion(line);
+	auto& wrapped = mWrappedLines[line.mVersion];
+	if (wrapped.mRows.empty())
+		WrapLine(line, &wrapped.mRows);
+	wrapped.mFrame = mLayoutFrame;
+	return wrapped.mRows;
+}
+
+// The row starts of a line used since it last changed, or nullptr
+const std::vector<TextEditor::RowStart>* TextEditor::FindWrappedLine(const Line& aLine) const
+{
+	if (aLine.mVersion == 0)
+		return nullptr;
+	auto it = mWrappedLines.find(aLine.mVersion);
+	return it != mWrappedLines.end() ? &it->second.mRows : nullptr;
+}
+
+// The row of a wrapped line aColumn is shown in; a column where a row breaks is at the start of
+// the next row
+int TextEditor::FindRow(const std::vector<RowStart>& aRows, int aColumn)
+{
+	auto it = std::upper_bound(aRows.begin(), aRows.end(), aColumn,
+		[](int aValue, const RowStart& aRow) { return aValue < aRow.mColumn; });
+	return std::max(0, (int)(it - aRows.begin()) - 1);
+}
+
+float TextEditor::TextDistanceToRowStart(const Line& aLine, const RowStart& aRow, int aIndex) const
+{
+	float distance = 0.0f;
+	const int end = std::min(aIndex, (int)aLine.size());
+	for (int it = aRow.mIndex; it < end; )
+	{
+		if (aLine.mChars[it] == '\t')
+		{
+			distance = NextTabStop(distance);
+			++it;
+		}
+		else
+		{
+			auto d = std::min(UTF8CharLength(aLine.mChars[it]), (int)aLine.size() - it);
+			distance += TextWidth(aLine.data() + it, aLine.data() + it + d);
+			it += d;
+		}
+	}
+	return distance;
+}
+
+// The position aRows visual rows below aFrom (above for negative aRows), as close as possible
+// to the same distance from the row start
+TextEditor::Coordinates TextEditor::MoveByRows(const Coordinates& aFrom, int aRows)
+{
+	UpdateWrap();
+
+	auto& rows = GetWrappedLine(aFrom.mLine);
+	auto row = FindRow(rows, aFrom.mColumn);
+	auto x = TextDistanceToRowStart(mLines[aFrom.mLine], rows[row], GetCharacterIndex(aFrom));
+
+	auto target = std::max(0, std::min(mWrapRows.GetRowCount() - 1, mWrapRows.GetFirstRow(aFrom.mLine) + row + aRows));
+	auto lineNo = (int)mWrapRows.FindLine(target);
+	GetWrappedLine(lineNo);
+	return TextPosToCoordinates(lineNo, target - mWrapRows.GetFirstRow(lineNo), x);
+}
+
+void TextEditor::Render()
+{
 	/* Update palette with the current alpha from style */
+	auto palette = mPalette;
 	for (int i = 0; i < (int)PaletteIndex::Max; ++i)
 	{
 		auto color = ImGui::ColorConvertU32ToFloat4(mPaletteBase[i]);
 		color.w *= ImGui::GetStyle().Alpha;
 		mPalette[i] = ImGui::ColorConvertFloat4ToU32(color);
 	}
+	if (mPalette != palette)
+		mLineLayouts.clear();
+
+	if (HasTextView())
+	{
+		RenderTextView();
+		return;
+	}
 
 	assert(mLineBuffer.empty());
 
@@ -887,42 +1973,102 @@ void TextEditor::Render()
 
 	// Deduce mTextStart by evaluating mLines size (global lineMax) plus two spaces as text width
 	char buf[16];
-	snprintf(buf, 16, " %d ", globalLineMax);
-	mTextStart = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf, nullptr, nullptr).x + mLeftMargin;
+	int bufLength = snprintf(buf, 16, " %d ", globalLineMax);
+	mTextStart = TextWidth(buf, buf + bufLength) + mLeftMargin;
+
+	// With word wrap the rows fill the width of the window, leaving room for the cursor behind
+	// the last character, and lineNo and lineMax are found from the visual rows in view
+	int rowNo = 0;
+	if (mWordWrap)
+	{
+		const float wrapWidth = std::max(mCharAdvance.x, contentSize.x - ImGui::GetWindowContentRegionMin().x - mTextStart - mCharAdvance.x);
+		if (wrapWidth != mWrapWidth)
+		{
+			mWrapWidth = wrapWidth;
+			mWrappedLines.clear();
+			InvalidateWrap();
+		}
+		UpdateWrap();
+		if (scrollX != 0.0f)
+			ImGui::SetScrollX(0.0f);
+
+		auto rowMin = (int)floor(scrollY / mCharAdvance.y);
+		auto rowMax = rowMin + (int)floor((scrollY + contentSize.y) / mCharAdvance.y);
+		lineNo = (int)mWrapRows.FindLine(rowMin);
+		lineMax = (int)mWrapRows.FindLine(rowMax);
+		rowNo = mWrapRows.GetFirstRow(lineNo);
+	}
+	mVisibleLineMin = lineNo;
+	mVisibleLineMax = lineMax + 1;
 
 	if (!mLines.empty())
 	{
-		float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
+		// The cached layouts hold texture coordinates of the font atlas
+		if (drawList->_CmdHeader.TextureId != mLayoutTexture)
+		{
+			mLayoutTexture = drawList->_CmdHeader.TextureId;
+			mLineLayouts.clear();
+		}
+		++mLayoutFrame;
+
+		static const std::vector<RowStart> kSingleRow(1, RowStart{ 0, 0 });
+		const bool wrapping = IsWrapping();
+		const float clipTop = drawList->GetClipRectMin().y;
+		const float clipBottom = drawList->GetClipRectMax().y;
 
 		while (lineNo <= lineMax)
 		{
-			ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, cursorScreenPos.y + lineNo * mCharAdvance.y);
+			ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, cursorScreenPos.y + (wrapping ? rowNo : lineNo) * mCharAdvance.y);
 			ImVec2 textScreenPos = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
 
+			// Lines wrapped into several rows are drawn row by row without the layout cache
 			auto& line = mLines[lineNo];
-			longest = std::max(mTextStart + TextDistanceToLineStart(Coordinates(lineNo, GetLineMaxColumn(lineNo))), longest);
-			auto columnNo = 0;
+			auto& rows = wrapping ? GetWrappedLine(lineNo) : kSingleRow;
+			const int rowCount = (int)rows.size();
+			const float lineHeight = rowCount * mCharAdvance.y;
+			auto layout = rowCount == 1 ? GetLineLayout(lineNo, textScreenPos, drawList) : nullptr;
+			auto longLine = layout == nullptr && line.size() > kMaxLayoutLength ? GetLongLine(lineNo) : nullptr;
+			auto lineMaxColumn = layout != nullptr ? layout->mMaxColumn : longLine != nullptr ? longLine->mMaxColumn : GetLineMaxColumn(lineNo);
 			Coordinates lineStartCoord(lineNo, 0);
-			Coordinates lineEndCoord(lineNo, GetLineMaxColumn(lineNo));
-
-			// Draw selection for the current line
-			float sstart = -1.0f;
-			float ssend = -1.0f;
-
+			Coordinates lineEndCoord(lineNo, lineMaxColumn);
+
+			// Only the rows of a long wrapped line between the edges of the window are drawn
+			const int rowFirst = std::max(0, (int)floor((clipTop - lineStartScreenPos.y) / mCharAdvance.y));
+			const int rowLast = std::min(rowCount - 1, (int)floor((clipBottom - lineStartScreenPos.y) / mCharAdvance.y));
+
+			// With a monospace font the selection and line ends of an unwrapped line are plain column math
+			auto distanceToRowStart = [&](int aRow, const Coordinates& aAt) {
+				if (rowCount > 1)
+					return TextDistanceToRowStart(line, rows[aRow], GetCharacterIndex(aAt));
+				return mMonospace ? std::min(aAt.mColumn, lineMaxColumn) * mCharAdvance.x : TextDistanceToLineStart(aAt);
+			};
+			if (!wrapping)
+				longest = std::max(mTextStart + (layout != nullptr ? layout->mWidth : longLine->mWidth), longest);
+
+			// Draw selection for every row of the current line
 			assert(mState.mSelectionStart <= mState.mSelectionEnd);
-			if (mState.mSelectionStart <= lineEndCoord)
-				sstart = mState.mSelectionStart > lineStartCoord ? TextDistanceToLineStart(mState.mSelectionStart) : 0.0f;
-			if (mState.mSelectionEnd > lineStartCoord)
-				ssend = TextDistanceToLineStart(mState.mSelectionEnd < lineEndCoord ? mState.mSelectionEnd : lineEndCoord);
+			for (int row = rowFirst; row <= rowLast; ++row)
+			{
+				Coordinates rowStartCoord(lineNo, rows[row].mColumn);
+				Coordinates rowEndCoord = row + 1 < rowCount ? Coordinates(lineNo, rows[row + 1].mColumn) : lineEndCoord;
+				float sstart = -1.0f;
+				float ssend = -1.0f;
 
-			if (mState.mSelectionEnd.mLine > lineNo)
-				ssend += mCharAdvance.x;
+				if (mState.mSelectionStart <= rowEndCoord)
+					sstart = mState.mSelectionStart > rowStartCoord ? distanceToRowStart(row, mState.mSelectionStart) : 0.0f;
+				if (mState.mSelectionEnd > rowStartCoord)
+					ssend = distanceToRowStart(row, mState.mSelectionEnd < rowEndCoord ? mState.mSelectionEnd : rowEndCoord);
 
-			if (sstart != -1 && ssend != -1 && sstart < ssend)
-			{
-				ImVec2 vstart(lineStartScreenPos.x + mTextStart + sstart, lineStartScreenPos.y);
-				ImVec2 vend(lineStartScreenPos.x + mTextStart + ssend, lineStartScreenPos.y + mCharAdvance.y);
-				drawList->AddRectFilled(vstart, vend, mPalette[(int)PaletteIndex::Selection]);
+				if (row + 1 == rowCount && mState.mSelectionEnd.mLine > lineNo)
+					ssend += mCharAdvance.x;
+
+				if (sstart != -1 && ssend != -1 && sstart < ssend)
+				{
+					const float y = lineStartScreenPos.y + row * mCharAdvance.y;
+					ImVec2 vstart(lineStartScreenPos.x + mTextStart + sstart, y);
+					ImVec2 vend(lineStartScreenPos.x + mTextStart + ssend, y + mCharAdvance.y);
+					drawList->AddRectFilled(vstart, vend, mPalette[(int)PaletteIndex::Selection]);
+				}
 			}
 
 			// Draw breakpoints
@@ -930,7 +2076,7 @@ void TextEditor::Render()
 
 			if (mBreakpoints.count(lineNo + 1) != 0)
 			{
-				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + mCharAdvance.y);
+				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + lineHeight);
 				drawList->AddRectFilled(start, end, mPalette[(int)PaletteIndex::Breakpoint]);
 			}
 
@@ -938,7 +2084,7 @@ void TextEditor::Render()
 			auto errorIt = mErrorMarkers.find(lineNo + 1);
 			if (errorIt != mErrorMarkers.end())
 			{
-				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + mCharAdvance.y);
+				auto end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX, lineStartScreenPos.y + lineHeight);
 				drawList->AddRectFilled(start, end, mPalette[(int)PaletteIndex::ErrorMarker]);
 
 				if (ImGui::IsMouseHoveringRect(lineStartScreenPos, end))
@@ -956,9 +2102,9 @@ void TextEditor::Render()
 			}
 
 			// Draw line number (right aligned)
-			snprintf(buf, 16, "%d  ", lineNo + 1);
+			bufLength = snprintf(buf, 16, "%d  ", lineNo + 1);
 
-			auto lineNoWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf, nullptr, nullptr).x;
+			auto lineNoWidth = TextWidth(buf, buf + bufLength);
 			drawList->AddText(ImVec2(lineStartScreenPos.x + mTextStart - lineNoWidth, lineStartScreenPos.y), mPalette[(int)PaletteIndex::LineNumber], buf);
 
 			if (mState.mCursorPosition.mLine == lineNo)
@@ -968,7 +2114,7 @@ void TextEditor::Render()
 				// Highlight the current line (where the cursor is)
 				if (!HasSelection())
 				{
-					auto end = ImVec2(start.x + contentSize.x + scrollX, start.y + mCharAdvance.y);
+					auto end = ImVec2(start.x + contentSize.x + scrollX, start.y + lineHeight);
 					drawList->AddRectFilled(start, end, mPalette[(int)(focused ? PaletteIndex::CurrentLineFill : PaletteIndex::CurrentLineFillInactive)]);
 					drawList->AddRect(start, end, mPalette[(int)PaletteIndex::CurrentLineEdge], 1.0f);
 				}
@@ -976,32 +2122,32 @@ void TextEditor::Render()
 				// Render the cursor
 				if (focused)
 				{
+					mCursorBlinking = true;
 					auto timeEnd = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 					auto elapsed = timeEnd - mStartTime;
 					if (elapsed > 400)
 					{
 						float width = 1.0f;
 						auto cindex = GetCharacterIndex(mState.mCursorPosition);
-						float cx = TextDistanceToLineStart(mState.mCursorPosition);
+						auto crow = rowCount > 1 ? FindRow(rows, mState.mCursorPosition.mColumn) : 0;
+						float cx = rowCount > 1 ? TextDistanceToRowStart(line, rows[crow], cindex) : TextDistanceToLineStart(mState.mCursorPosition);
+						float cy = lineStartScreenPos.y + crow * mCharAdvance.y;
 
 						if (mOverwrite && cindex < (int)line.size())
 						{
-							auto c = line[cindex].mChar;
+							auto c = line.mChars[cindex];
 							if (c == '\t')
 							{
-								auto x = (1.0f + std::floor((1.0f + cx) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
-								width = x - cx;
+								width = NextTabStop(cx) - cx;
 							}
 							else
 							{
-								char buf2[2];
-								buf2[0] = line[cindex].mChar;
-								buf2[1] = '\0';
-								width = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf2).x;
+								auto d = std::min(UTF8CharLength(c), (int)line.size() - cindex);
+								width = TextWidth(line.data() + cindex, line.data() + cindex + d);
 							}
 						}
-						ImVec2 cstart(textScreenPos.x + cx, lineStartScreenPos.y);
-						ImVec2 cend(textScreenPos.x + cx + width, lineStartScreenPos.y + mCharAdvance.y);
+						ImVec2 cstart(textScreenPos.x + cx, cy);
+						ImVec2 cend(textScreenPos.x + cx + width, cy + mCharAdvance.y);
 						drawList->AddRectFilled(cstart, cend, mPalette[(int)PaletteIndex::Cursor]);
 						if (elapsed > 800)
 							mStartTime = timeEnd;
@@ -1010,84 +2156,44 @@ void TextEditor::Render()
 			}
 
 			// Render colorized text
-			auto prevColor = line.empty() ? mPalette[(int)PaletteIndex::Default] : GetGlyphColor(line[0]);
-			ImVec2 bufferOffset;
-
-			for (int i = 0; i < line.size();)
+			if (layout != nullptr)
 			{
-				auto& glyph = line[i];
-				auto color = GetGlyphColor(glyph);
-
-				if ((color != prevColor || glyph.mChar == '\t' || glyph.mChar == ' ') && !mLineBuffer.empty())
-				{
-					const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-					drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-					auto textSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, mLineBuffer.c_str(), nullptr, nullptr);
-					bufferOffset.x += textSize.x;
-					mLineBuffer.clear();
-				}
-				prevColor = color;
-
-				if (glyph.mChar == '\t')
-				{
-					auto oldX = bufferOffset.x;
-					bufferOffset.x = (1.0f + std::floor((1.0f + bufferOffset.x) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
-					++i;
-
-					if (mShowWhitespaces)
-					{
-						const auto s = ImGui::GetFontSize();
-						const auto x1 = textScreenPos.x + oldX + 1.0f;
-						const auto x2 = textScreenPos.x + bufferOffset.x - 1.0f;
-						const auto y = textScreenPos.y + bufferOffset.y + s * 0.5f;
-						const ImVec2 p1(x1, y);
-						const ImVec2 p2(x2, y);
-						const ImVec2 p3(x2 - s * 0.2f, y - s * 0.2f);
-						const ImVec2 p4(x2 - s * 0.2f, y + s * 0.2f);
-						drawList->AddLine(p1, p2, 0x90909090);
-						drawList->AddLine(p2, p3, 0x90909090);
-						drawList->AddLine(p2, p4, 0x90909090);
-					}
-				}
-				else if (glyph.mChar == ' ')
-				{
-					if (mShowWhitespaces)
-					{
-						const auto s = ImGui::GetFontSize();
-						const auto x = textScreenPos.x + bufferOffset.x + spaceSize * 0.5f;
-						const auto y = textScreenPos.y + bufferOffset.y + s * 0.5f;
-						drawList->AddCircleFilled(ImVec2(x, y), 1.5f, 0x80808080, 4);
-					}
-					bufferOffset.x += spaceSize;
-					i++;
-				}
-				else
+				DrawLineLayout(*layout, drawList, textScreenPos);
+			}
+			else if (rowCount > 1)
+			{
+				for (int row = rowFirst; row <= rowLast; ++row)
 				{
-					auto l = UTF8CharLength(glyph.mChar);
-					while (l-- > 0)
-						mLineBuffer.push_back(line[i++].mChar);
+					const ImVec2 rowScreenPos(textScreenPos.x, textScreenPos.y + row * mCharAdvance.y);
+					LayoutLine(line, drawList, rowScreenPos, rows[row].mIndex, row + 1 < rowCount ? rows[row + 1].mIndex : INT_MAX);
 				}
-				++columnNo;
 			}
-
-			if (!mLineBuffer.empty())
+			else
 			{
-				const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-				drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-				mLineBuffer.clear();
+				// Only the part of a long line between the edges of the window is drawn
+				const float left = drawList->GetClipRectMin().x - textScreenPos.x;
+				const float right = drawList->GetClipRectMax().x - textScreenPos.x;
+				auto& checkpoint = FindCheckpoint(*longLine, &LineCheckpoint::mX, left);
+				LayoutLine(line, drawList, textScreenPos, checkpoint.mIndex, INT_MAX, checkpoint.mX, right);
 			}
 
+			rowNo += rowCount;
 			++lineNo;
 		}
 
+		// Drop the layouts of lines that changed or scrolled out of view
+		std::erase_if(mLineLayouts, [this](const auto& aEntry) { return aEntry.second.mFrame != mLayoutFrame; });
+		std::erase_if(mLongLines, [this](const auto& aEntry) { return aEntry.second.mFrame != mLayoutFrame; });
+		std::erase_if(mWrappedLines, [this](const auto& aEntry) { return aEntry.second.mFrame != mLayoutFrame; });
+
 		// Draw a tooltip on known identifiers/preprocessor symbols
 		if (ImGui::IsMousePosValid())
 		{
 			auto id = GetWordAt(ScreenPosToCoordinates(ImGui::GetMousePos()));
 			if (!id.empty())
 			{
-				auto it = mLanguageDefinition.mIdentifiers.find(id);
-				if (it != mLanguageDefinition.mIdentifiers.end())
+				auto it = mLanguageDefinition->mIdentifiers.find(id);
+				if (it != mLanguageDefinition->mIdentifiers.end())
 				{
 					ImGui::BeginTooltip();
 					ImGui::TextUnformatted(it->second.mDeclaration.c_str());
@@ -1095,8 +2201,8 @@ void TextEditor::Render()
 				}
 				else
 				{
-					auto pi = mLanguageDefinition.mPreprocIdentifiers.find(id);
-					if (pi != mLanguageDefinition.mPreprocIdentifiers.end())
+					auto pi = mLanguageDefinition->mPreprocIdentifiers.find(id);
+					if (pi != mLanguageDefinition->mPreprocIdentifiers.end())
 					{
 						ImGui::BeginTooltip();
 						ImGui::TextUnformatted(pi->second.mDeclaration.c_str());
@@ -1108,7 +2214,10 @@ void TextEditor::Render()
 	}
 
 
-	ImGui::Dummy(ImVec2((longest + 2), mLines.size() * mCharAdvance.y));
+	if (IsWrapping())
+		ImGui::Dummy(ImVec2(mTextStart + mWrapWidth, mWrapRows.GetRowCount() * mCharAdvance.y));
+	else
+		ImGui::Dummy(ImVec2((longest + 2), mLines.size() * mCharAdvance.y));
 
 	if (mScrollToCursor)
 	{
@@ -1123,22 +2232,36 @@ void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 	mWithinRender = true;
 	mTextChanged = false;
 	mCursorPositionChanged = false;
+	mCursorBlinking = false;
 
 	ImGui::PushStyleColor(ImGuiCol_ChildBg, ImGui::ColorConvertU32ToFloat4(mPalette[(int)PaletteIndex::Background]));
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0.0f, 0.0f));
 	if (!mIgnoreImGuiChild)
-		ImGui::BeginChild(aTitle, aSize, aBorder, ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_AlwaysHorizontalScrollbar | ImGuiWindowFlags_NoMove);
+	{
+		// Wrapped text never needs to scroll horizontally
+		ImGuiWindowFlags flags = ImGuiWindowFlags_NoMove;
+		if (!mWordWrap || HasTextView())
+			flags |= ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_AlwaysHorizontalScrollbar;
+		ImGui::BeginChild(aTitle, aSize, aBorder, flags);
+	}
+
+	// Mouse input maps positions to text, so measure before handling it
+	UpdateFontMetrics();
 
-	if (mHandleKeyboardInputs)
+	// A text view has no cursor and no colors, only scrolling
+	if (mHandleKeyboardInputs && !HasTextView())
 	{
 		HandleKeyboardInputs();
 		// ImGui::PushAllowKeyboardFocus(true);
 	}
 
-	if (mHandleMouseInputs)
+	// Rows of the lines edited by keyboard input are counted before the mouse is mapped to them
+	UpdateWrap();
+	if (mHandleMouseInputs && !HasTextView())
 		HandleMouseInputs();
 
-	ColorizeInternal();
+	if (!HasTextView())
+		ColorizeInternal();
 	Render();
 
 	if (mHandleKeyboardInputs)
@@ -1153,26 +2276,124 @@ void TextEditor::Render(const char* aTitle, const ImVec2& aSize, bool aBorder)
 	mWithinRender = false;
 }
 
+// Texts smaller than this are split into lines on the calling thread only
+static const size_t kParallelLoadSize = 4u << 20;
+
+// Appends the lines in [aBegin, aEnd). Unless aLast, the range ends right behind a line break
+// and the next range continues with the following line.
+static void SplitLines(const char* aBegin, const char* aEnd, bool aLast, std::vector<TextEditor::Line>& aLines, const std::atomic<bool>* aCancel)
+{
+	aLines.reserve(std::count(aBegin, aEnd, '\n') + (aLast ? 1 : 0));
+
+	const char* p = aBegin;
+	for (;;)
+	{
+		if (aCancel != nullptr && aLines.size() % 4096 == 0 && aCancel->load(std::memory_order_relaxed))
+			return;
+
+		auto eol = (const char*)memchr(p, '\n', aEnd - p);
+		if (eol == nullptr && !aLast)
+			break;
+		if (eol == nullptr)
+			eol = aEnd;
+
+		auto lineEnd = eol;
+		if (lineEnd > p && lineEnd[-1] == '\r')
+			--lineEnd;
+
+		TextEditor::Line line;
+		line.mChars.assign((const TextEditor::Char*)p, (const TextEditor::Char*)lineEnd);
+		// ignore stray carriage return characters as well
+		if (memchr(p, '\r', lineEnd - p) != nullptr)
+			line.mChars.erase(std::remove(line.mChars.begin(), line.mChars.end(), (TextEditor::Char)'\r'), line.mChars.end());
+		line.mColors.assign(line.mChars.size(), (uint8_t)TextEditor::PaletteIndex::Default);
+		aLines.push_back(std::move(line));
+
+		if (eol == aEnd)
+			break;
+		p = eol + 1;
+	}
+}
+
 void TextEditor::SetText(const std::string & aText)
 {
-	mLines.clear();
-	mLines.emplace_back(Line());
-	for (auto chr : aText)
+	SetText(aText.data(), aText.size());
+}
+
+TextEditor::TextFormat TextEditor::SetText(const char* aText, size_t aSize)
+{
+	mView = TextView();
+	const auto format = BuildLines(aText, aSize, mLines);
+
+	mTextChanged = true;
+	mScrollToTop = true;
+
+	mUndoBuffer.clear();
+	mUndoIndex = 0;
+
+	Colorize();
+	return format;
+}
+
+TextEditor::TextFormat TextEditor::BuildLines(const char* aText, size_t aSize, Lines& aLines, const std::atomic<bool>* aCancel)
+{
+	aLines.clear();
+
+	static const char kBom[] = "\xEF\xBB\xBF";
+	TextFormat format;
+	if (aSize >= 3 && memcmp(aText, kBom, 3) == 0)
 	{
-		if (chr == '\r')
-		{
-			// ignore the carriage return character
-		}
-		else if (chr == '\n')
-			mLines.emplace_back(Line());
-		else
+		format.mBom = true;
+		aText += 3;
+		aSize -= 3;
+	}
+	if (aSize == 0)
+	{
+		aLines.push_back(Line());
+	}
+	else
+	{
+		const char* end = aText + aSize;
+		if (auto eol = (const char*)memchr(aText, '\n', aSize))
+			format.mLineBreak = eol > aText && eol[-1] == '\r' ? LineBreak::CrLf : LineBreak::Lf;
+
+		// Every range but the first starts behind a line break, so no line is cut in two
+		size_t rangeCount = std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned)(aSize / kParallelLoadSize)));
+		std::vector<const char*> starts(1, aText);
+		for (size_t i = 1; i < rangeCount; ++i)
 		{
-			mLines.back().emplace_back(Glyph(chr, PaletteIndex::Default));
+			const char* from = std::max(starts.back(), aText + aSize / rangeCount * i);
+			auto eol = (const char*)memchr(from, '\n', end - from);
+			if (eol == nullptr)
+				break;
+			starts.push_back(eol + 1);
 		}
+		starts.push_back(end);
+		rangeCount = starts.size() - 1;
+
+		std::vector<std::vector<Line>> ranges(rangeCount);
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < rangeCount; ++i)
+			threads.emplace_back([&, i] { SplitLines(starts[i], starts[i + 1], i + 1 == rangeCount, ranges[i], aCancel); });
+		SplitLines(starts[0], starts[1], rangeCount == 1, ranges[0], aCancel);
+		for (auto& thread : threads)
+			thread.join();
+
+		for (auto& range : ranges)
+			for (auto& line : range)
+				aLines.push_back(std::move(line));
 	}
+	return format;
+}
+
+void TextEditor::SetLines(Lines&& aLines)
+{
+	mView = TextView();
+	mLines = std::move(aLines);
+	if (mLines.empty())
+		mLines.push_back(Line());
 
 	mTextChanged = true;
-	mScrollToTop = true;
 
 	mUndoBuffer.clear();
 	mUndoIndex = 0;
@@ -1182,6 +2403,7 @@ void TextEditor::SetText(const std::string & aText)
 
 void TextEditor::SetTextLines(const std::vector<std::string> & aLines)
 {
+	mView = TextView();
 	mLines.clear();
 
 	if (aLines.empty())
@@ -1196,9 +2418,9 @@ void TextEditor::SetTextLines(const std::vector<std::string> & aLines)
 		{
 			const std::string & aLine = aLines[i];
 
-			mLines[i].reserve(aLine.size());
-			for (size_t j = 0; j < aLine.size(); ++j)
-				mLines[i].emplace_back(Glyph(aLine[j], PaletteIndex::Default));
+			mLines[i].mChars.assign(aLine.begin(), aLine.end());
+			mLines[i].mColors.assign(aLine.size(), (uint8_t)PaletteIndex::Default);
+			mLines[i].mVersion = 0;
 		}
 	}
 
@@ -1211,6 +2433,112 @@ void TextEditor::SetTextLines(const std::vector<std::string> & aLines)
 	Colorize();
 }
 
+void TextEditor::SetTextView(TextView&& aView)
+{
+	assert(aView.mData != nullptr && !aView.mLineIndex.empty());
+
+	mView = std::move(aView);
+	mViewLongest = 0.0f;
+	mReadOnly = true;
+
+	mLines.clear();
+	mLines.push_back(Line());
+	mState = EditorState();
+	mErrorMarkers.clear();
+	mBreakpoints.clear();
+
+	mTextChanged = true;
+	mScrollToTop = true;
+
+	mUndoBuffer.clear();
+	mUndoIndex = 0;
+}
+
+const char* TextEditor::GetTextViewLine(size_t aLine) const
+{
+	// Start from the closest checkpoint at or before aLine; the first one is always (0, 0)
+	auto it = std::upper_bound(mView.mLineIndex.begin(), mView.mLineIndex.end(), aLine,
+		[](size_t aValue, const std::pair<size_t, size_t>& aMark) { return aValue < aMark.first; });
+	--it;
+
+	auto end = mView.mData + mView.mSize;
+	auto p = mView.mData + it->second;
+	for (auto line = it->first; line < aLine && p < end; ++line)
+	{
+		auto eol = (const char*)memchr(p, '\n', end - p);
+		p = eol != nullptr ? eol + 1 : end;
+	}
+	return p;
+}
+
+void TextEditor::RenderTextView()
+{
+	auto contentSize = ImGui::GetWindowContentRegionMax();
+	auto drawList = ImGui::GetWindowDrawList();
+
+	if (mScrollToTop)
+	{
+		mScrollToTop = false;
+		ImGui::SetScrollY(0.f);
+	}
+
+	ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
+	auto scrollY = ImGui::GetScrollY();
+
+	auto lineNo = (size_t)floor(scrollY / mCharAdvance.y);
+	auto lineMax = std::min(mView.mLineCount - 1, lineNo + (size_t)ceil(contentSize.y / mCharAdvance.y));
+
+	char buf[24];
+	int bufLength = snprintf(buf, sizeof(buf), " %zu ", mView.mLineCount);
+	mTextStart = TextWidth(buf, buf + bufLength) + mLeftMargin;
+
+	auto end = mView.mData + mView.mSize;
+	auto color = mPalette[(int)PaletteIndex::Default];
+
+	// Only the first visible line needs a lookup, the following ones start where it ends
+	auto p = lineNo < mView.mLineCount ? GetTextViewLine(lineNo) : end;
+	for (; lineNo <= lineMax; ++lineNo)
+	{
+		auto eol = (const char*)memchr(p, '\n', end - p);
+		if (eol == nullptr)
+			eol = end;
+		auto lineEnd = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+
+		ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, cursorScreenPos.y + lineNo * mCharAdvance.y);
+		ImVec2 textScreenPos = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
+
+		// Draw line number (right aligned)
+		bufLength = snprintf(buf, sizeof(buf), "%zu  ", lineNo + 1);
+		auto lineNoWidth = TextWidth(buf, buf + bufLength);
+		drawList->AddText(ImVec2(lineStartScreenPos.x + mTextStart - lineNoWidth, lineStartScreenPos.y), mPalette[(int)PaletteIndex::LineNumber], buf);
+
+		// Draw the text between tabs in one go
+		float x = 0.0f;
+		for (auto run = p; run < lineEnd;)
+		{
+			auto tab = (const char*)memchr(run, '\t', lineEnd - run);
+			auto runEnd = tab != nullptr ? tab : lineEnd;
+			if (runEnd > run)
+			{
+				drawList->AddText(ImVec2(textScreenPos.x + x, textScreenPos.y), color, run, runEnd);
+				x += TextWidth(run, runEnd);
+			}
+			if (tab == nullptr)
+				break;
+			x = NextTabStop(x);
+			run = tab + 1;
+		}
+		mViewLongest = std::max(mViewLongest, mTextStart + x);
+
+		if (eol == end)
+			break;
+		p = eol + 1;
+	}
+
+	// The width only covers the lines seen so far, it grows as the view is scrolled
+	ImGui::Dummy(ImVec2(mViewLongest + 2, mView.mLineCount * mCharAdvance.y));
+}
+
 void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 {
 	assert(!mReadOnly);
@@ -1254,16 +2582,16 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				{
 					if (!line.empty())
 					{
-						if (line.front().mChar == '\t')
+						if (line.mChars.front() == '\t')
 						{
-							line.erase(line.begin());
+							line.erase(0, 1);
 							modified = true;
 						}
 						else
 						{
-							for (int j = 0; j < mTabSize && !line.empty() && line.front().mChar == ' '; j++)
+							for (int j = 0; j < mTabSize && !line.empty() && line.mChars.front() == ' '; j++)
 							{
-								line.erase(line.begin());
+								line.erase(0, 1);
 								modified = true;
 							}
 						}
@@ -1271,7 +2599,8 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 				}
 				else
 				{
-					line.insert(line.begin(), Glyph('\t', TextEditor::PaletteIndex::Background));
+					const Char tab = '\t';
+					line.insert(0, &tab, 1, (uint8_t)PaletteIndex::Background);
 					modified = true;
 				}
 			}
@@ -1303,6 +2632,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 
 				mTextChanged = true;
 
+				Colorize(start.mLine, end.mLine - start.mLine + 1);
 				EnsureCursorVisible();
 			}
 
@@ -1328,14 +2658,18 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 		auto& line = mLines[coord.mLine];
 		auto& newLine = mLines[coord.mLine + 1];
 
-		if (mLanguageDefinition.mAutoIndentation)
-			for (size_t it = 0; it < line.size() && isascii(line[it].mChar) && isblank(line[it].mChar); ++it)
-				newLine.push_back(line[it]);
+		if (mLanguageDefinition->mAutoIndentation)
+		{
+			size_t indent = 0;
+			while (indent < line.size() && isascii(line.mChars[indent]) && isblank(line.mChars[indent]))
+				++indent;
+			newLine.append(line, 0, indent);
+		}
 
 		const size_t whitespaceSize = newLine.size();
 		auto cindex = GetCharacterIndex(coord);
-		newLine.insert(newLine.end(), line.begin() + cindex, line.end());
-		line.erase(line.begin() + cindex, line.begin() + line.size());
+		newLine.append(line, cindex, line.size());
+		line.erase(cindex, line.size());
 		SetCursorPosition(Coordinates(coord.mLine + 1, GetCharacterColumn(coord.mLine + 1, (int)whitespaceSize)));
 		u.mAdded = (char)aChar;
 	}
@@ -1351,20 +2685,21 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 
 			if (mOverwrite && cindex < (int)line.size())
 			{
-				auto d = UTF8CharLength(line[cindex].mChar);
+				auto d = UTF8CharLength(line.mChars[cindex]);
 
 				u.mRemovedStart = mState.mCursorPosition;
 				u.mRemovedEnd = Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex + d));
 
 				while (d-- > 0 && cindex < (int)line.size())
 				{
-					u.mRemoved += line[cindex].mChar;
-					line.erase(line.begin() + cindex);
+					u.mRemoved += line.mChars[cindex];
+					line.erase(cindex, cindex + 1);
 				}
 			}
 
-			for (auto p = buf; *p != '\0'; p++, ++cindex)
-				line.insert(line.begin() + cindex, Glyph(*p, PaletteIndex::Default));
+			line.insert(cindex, (const Char*)buf, e);
+			cindex += e;
+
 			u.mAdded = buf;
 
 			SetCursorPosition(Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex)));
@@ -1391,6 +2726,8 @@ void TextEditor::SetReadOnly(bool aValue)
 
 void TextEditor::SetColorizerEnable(bool aValue)
 {
+	if (mColorizerEnabled != aValue)
+		mLineLayouts.clear();
 	mColorizerEnabled = aValue;
 }
 
@@ -1459,6 +2796,24 @@ void TextEditor::SetSelection(const Coordinates & aStart, const Coordinates & aE
 void TextEditor::SetTabSize(int aValue)
 {
 	mTabSize = std::max(0, std::min(32, aValue));
+	mLineLayouts.clear();
+	mLongLines.clear();
+	mWrappedLines.clear();
+	InvalidateWrap();
+}
+
+void TextEditor::SetWordWrap(bool aValue)
+{
+	if (mWordWrap == aValue)
+		return;
+
+	// Render counts the rows once it knows the width, then scrolls the cursor back into view
+	mWordWrap = aValue;
+	mWrapWidth = 0.0f;
+	mWrapRows.clear();
+	mWrappedLines.clear();
+	mWrapRangeMin = mWrapRangeMax = 0;
+	mScrollToCursor = true;
 }
 
 void TextEditor::InsertText(const std::string & aValue)
@@ -1499,7 +2854,10 @@ void TextEditor::DeleteSelection()
 void TextEditor::MoveUp(int aAmount, bool aSelect)
 {
 	auto oldPos = mState.mCursorPosition;
-	mState.mCursorPosition.mLine = std::max(0, mState.mCursorPosition.mLine - aAmount);
+	if (IsWrapping())
+		mState.mCursorPosition = MoveByRows(GetActualCursorCoordinates(), -aAmount);
+	else
+		mState.mCursorPosition.mLine = std::max(0, mState.mCursorPosition.mLine - aAmount);
 	if (oldPos != mState.mCursorPosition)
 	{
 		if (aSelect)
@@ -1526,7 +2884,10 @@ void TextEditor::MoveDown(int aAmount, bool aSelect)
 {
 	assert(mState.mCursorPosition.mColumn >= 0);
 	auto oldPos = mState.mCursorPosition;
-	mState.mCursorPosition.mLine = std::max(0, std::min((int)mLines.size() - 1, mState.mCursorPosition.mLine + aAmount));
+	if (IsWrapping())
+		mState.mCursorPosition = MoveByRows(GetActualCursorCoordinates(), aAmount);
+	else
+		mState.mCursorPosition.mLine = std::max(0, std::min((int)mLines.size() - 1, mState.mCursorPosition.mLine + aAmount));
 
 	if (mState.mCursorPosition != oldPos)
 	{
@@ -1585,7 +2946,7 @@ void TextEditor::MoveLeft(int aAmount, bool aSelect, bool aWordMode)
 			{
 				if ((int)mLines.size() > line)
 				{
-					while (cindex > 0 && IsUTFSequence(mLines[line][cindex].mChar))
+					while (cindex > 0 && IsUTFSequence(mLines[line].mChars[cindex]))
 						--cindex;
 				}
 			}
@@ -1646,7 +3007,7 @@ void TextEditor::MoveRight(int aAmount, bool aSelect, bool aWordMode)
 		}
 		else
 		{
-			cindex += UTF8CharLength(line[cindex].mChar);
+			cindex += UTF8CharLength(line.mChars[cindex]);
 			mState.mCursorPosition = Coordinates(lindex, GetCharacterColumn(lindex, cindex));
 			if (aWordMode)
 				mState.mCursorPosition = FindNextWord(mState.mCursorPosition);
@@ -1789,7 +3150,7 @@ void TextEditor::Delete()
 			Advance(u.mRemovedEnd);
 
 			auto& nextLine = mLines[pos.mLine + 1];
-			line.insert(line.end(), nextLine.begin(), nextLine.end());
+			line.append(nextLine, 0, nextLine.size());
 			RemoveLine(pos.mLine + 1);
 		}
 		else
@@ -1799,9 +3160,11 @@ void TextEditor::Delete()
 			u.mRemovedEnd.mColumn++;
 			u.mRemoved = GetText(u.mRemovedStart, u.mRemovedEnd);
 
-			auto d = UTF8CharLength(line[cindex].mChar);
-			while (d-- > 0 && cindex < (int)line.size())
-				line.erase(line.begin() + cindex);
+			if (cindex < (int)line.size())
+			{
+				auto d = UTF8CharLength(line.mChars[cindex]);
+				line.erase(cindex, std::min(cindex + d, (int)line.size()));
+			}
 		}
 
 		mTextChanged = true;
@@ -1848,7 +3211,7 @@ void TextEditor::Backspace()
 			auto& line = mLines[mState.mCursorPosition.mLine];
 			auto& prevLine = mLines[mState.mCursorPosition.mLine - 1];
 			auto prevSize = GetLineMaxColumn(mState.mCursorPosition.mLine - 1);
-			prevLine.insert(prevLine.end(), line.begin(), line.end());
+			prevLine.append(line, 0, line.size());
 
 			ErrorMarkers etmp;
 			for (auto& i : mErrorMarkers)
@@ -1864,10 +3227,10 @@ void TextEditor::Backspace()
 			auto& line = mLines[mState.mCursorPosition.mLine];
 			auto cindex = GetCharacterIndex(pos) - 1;
 			auto cend = cindex + 1;
-			while (cindex > 0 && IsUTFSequence(line[cindex].mChar))
+			while (cindex > 0 && IsUTFSequence(line.mChars[cindex]))
 				--cindex;
 
-			//if (cindex > 0 && UTF8CharLength(line[cindex].mChar) > 1)
+			//if (cindex > 0 && UTF8CharLength(line.mChars[cindex]) > 1)
 			//	--cindex;
 
 			u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
@@ -1876,8 +3239,8 @@ void TextEditor::Backspace()
 
 			while (cindex < line.size() && cend-- > cindex)
 			{
-				u.mRemoved += line[cindex].mChar;
-				line.erase(line.begin() + cindex);
+				u.mRemoved += line.mChars[cindex];
+				line.erase(cindex, cindex + 1);
 			}
 		}
 
@@ -1919,8 +3282,7 @@ void TextEditor::Copy()
 		{
 			std::string str;
 			auto& line = mLines[GetActualCursorCoordinates().mLine];
-			for (auto& g : line)
-				str.push_back(g.mChar);
+			str.assign(line.data(), line.size());
 			ImGui::SetClipboardText(str.c_str());
 		}
 	}
@@ -2099,325 +3461,992 @@ std::vector<std::string> TextEditor::GetTextLines() const
 
 	result.reserve(mLines.size());
 
-	for (auto & line : mLines)
+	for (size_t i = 0; i < mLines.size(); ++i)
+	{
+		auto& line = mLines[i];
+		result.emplace_back(line.data(), line.size());
+
+	}
+
+	return result;
+}
+
+bool TextEditor::ForEachLine(const std::function<bool(const char* aData, size_t aSize)>& aVisit) const
+{
+	for (size_t i = 0; i < mLines.size(); ++i)
+	{
+		auto& line = mLines[i];
+		if (!aVisit(line.data(), line.size()))
+			return false;
+	}
+	return true;
+}
+
+std::string TextEditor::GetSelectedText() const
+{
+	return GetText(mState.mSelectionStart, mState.mSelectionEnd);
+}
+
+std::string TextEditor::GetCurrentLineText()const
+{
+	auto lineLength = GetLineMaxColumn(mState.mCursorPosition.mLine);
+	return GetText(
+		Coordinates(mState.mCursorPosition.mLine, 0),
+		Coordinates(mState.mCursorPosition.mLine, lineLength));
+}
+
+void TextEditor::ProcessInputs()
+{
+}
+
+void TextEditor::Colorize(int aFromLine, int aLines)
+{
+	int toLine = aLines == -1 ? (int)mLines.size() : std::min((int)mLines.size(), aFromLine + aLines);
+	mColorRangeMin = std::min(mColorRangeMin, aFromLine);
+	mColorRangeMax = std::max(mColorRangeMax, toLine);
+	mColorRangeMin = std::max(0, mColorRangeMin);
+	mColorRangeMax = std::max(mColorRangeMin, mColorRangeMax);
+	// Always rescan at least one line; edited lines further on are picked up by their reset state
+	mCommentRangeMin = std::max(0, std::min(mCommentRangeMin, aFromLine));
+	mCommentRangeMax = std::max(mCommentRangeMax, std::max(toLine, std::max(0, aFromLine) + 1));
+	++mColorizeVersion;
+	InvalidateWrap(aFromLine, toLine);
+}
+
+// Thompson construction for the regex subset the language definitions use: literals, escapes,
+// '.', bracket classes, groups, alternation and the * + ? quantifiers. Anchors, back references,
+// lookahead, counted and lazy repeats are rejected, and the language keeps using std::regex.
+struct TokenNfaState
+{
+	std::bitset<256> mChars;	// bytes leading to mNext
+	int mNext = -1;
+	std::vector<int> mEpsilon;
+	int mAccept = -1;			// index of the regex that matches on reaching this state
+};
+
+class TokenRegexParser
+{
+public:
+	TokenRegexParser(std::vector<TokenNfaState>& aStates, const std::string& aPattern)
+		: mStates(aStates), mPos(aPattern.c_str()), mEnd(aPattern.c_str() + aPattern.size())
+	{
+	}
+
+	bool Parse(int& aStart, int& aEnd)
+	{
+		return ParseAlternation(aStart, aEnd) && mPos == mEnd;
+	}
+
+private:
+	int NewState()
+	{
+		mStates.emplace_back();
+		return (int)mStates.size() - 1;
+	}
+
+	void Link(int aFrom, int aTo)
+	{
+		mStates[aFrom].mEpsilon.push_back(aTo);
+	}
+
+	bool ParseAlternation(int& aStart, int& aEnd)
+	{
+		int start, end;
+		if (!ParseSequence(start, end))
+			return false;
+
+		if (mPos == mEnd || *mPos != '|')
+		{
+			aStart = start;
+			aEnd = end;
+			return true;
+		}
+
+		aStart = NewState();
+		aEnd = NewState();
+		Link(aStart, start);
+		Link(end, aEnd);
+		while (mPos != mEnd && *mPos == '|')
+		{
+			++mPos;
+			if (!ParseSequence(start, end))
+				return false;
+			Link(aStart, start);
+			Link(end, aEnd);
+		}
+		return true;
+	}
+
+	bool ParseSequence(int& aStart, int& aEnd)
+	{
+		aStart = aEnd = NewState();
+		while (mPos != mEnd && *mPos != '|' && *mPos != ')')
+		{
+			int start, end;
+			if (!ParseRepeat(start, end))
+				return false;
+			Link(aEnd, start);
+			aEnd = end;
+		}
+		return true;
+	}
+
+	bool ParseRepeat(int& aStart, int& aEnd)
+	{
+		if (!ParseAtom(aStart, aEnd))
+			return false;
+
+		while (mPos != mEnd && (*mPos == '*' || *mPos == '+' || *mPos == '?'))
+		{
+			const char op = *mPos++;
+			if (mPos != mEnd && (*mPos == '?' || *mPos == '+'))
+				return false;
+
+			const int start = NewState();
+			const int end = NewState();
+			Link(start, aStart);
+			Link(aEnd, end);
+			if (op != '+')
+				Link(start, end);
+			if (op != '?')
+				Link(aEnd, aStart);
+			aStart = start;
+			aEnd = end;
+		}
+		return mPos == mEnd || *mPos != '{';
+	}
+
+	bool ParseAtom(int& aStart, int& aEnd)
+	{
+		const char c = *mPos++;
+		if (c == '(')
+		{
+			if (mPos != mEnd && *mPos == '?')
+			{
+				if (mEnd - mPos < 2 || mPos[1] != ':')
+					return false;
+				mPos += 2;
+			}
+			if (!ParseAlternation(aStart, aEnd) || mPos == mEnd || *mPos != ')')
+				return false;
+			++mPos;
+			return true;
+		}
+
+		std::bitset<256> chars;
+		if (c == '[')
+		{
+			if (!ParseClass(chars))
+				return false;
+		}
+		else if (c == '\\')
+		{
+			int single;
+			if (!ParseEscape(chars, single))
+				return false;
+		}
+		else if (c == '.')
+		{
+			chars.set();
+			chars.reset('\n');
+			chars.reset('\r');
+		}
+		else if (c == '^' || c == '$' || c == '*' || c == '+' || c == '?' || c == '{' || c == ')')
+			return false;
+		else
+			chars.set((uint8_t)c);
+
+		aStart = NewState();
+		aEnd = NewState();
+		mStates[aStart].mChars = chars;
+		mStates[aStart].mNext = aEnd;
+		return true;
+	}
+
+	// Adds the characters of "[...]" to aChars, the opening bracket already consumed
+	bool ParseClass(std::bitset<256>& aChars)
+	{
+		const bool negate = mPos != mEnd && *mPos == '^';
+		if (negate)
+			++mPos;
+
+		while (mPos != mEnd && *mPos != ']')
+		{
+			int first = (uint8_t)*mPos++;
+			if (first == '\\' && !ParseEscape(aChars, first))
+				return false;
+			if (first < 0)
+				continue;
+
+			int last = first;
+			if (mEnd - mPos >= 2 && mPos[0] == '-' && mPos[1] != ']')
+			{
+				++mPos;
+				last = (uint8_t)*mPos++;
+				if (last == '\\')
+				{
+					std::bitset<256> ignored;
+					if (!ParseEscape(ignored, last) || last < 0)
+						return false;
+				}
+				if (last < first)
+					return false;
+			}
+			for (int i = first; i <= last; ++i)
+				aChars.set(i);
+		}
+		if (mPos == mEnd)
+			return false;
+		++mPos;
+
+		if (negate)
+			aChars.flip();
+		return true;
+	}
+
+	// Reads the escape after a backslash. aSingle is the escaped character, or -1 for a class
+	// like \d whose characters were added to aChars.
+	bool ParseEscape(std::bitset<256>& aChars, int& aSingle)
 	{
-		std::string text;
+		if (mPos == mEnd)
+			return false;
+
+		const char c = *mPos++;
+		aSingle = -1;
+		switch (c)
+		{
+		case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+		{
+			std::bitset<256> set;
+			for (int i = 0; i < 256; ++i)
+			{
+				const bool digit = i >= '0' && i <= '9';
+				const bool word = digit || (i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || i == '_';
+				const bool space = i == ' ' || (i >= '\t' && i <= '\r');
+				const char lower = (char)tolower(c);
+				set[i] = lower == 'd' ? digit : lower == 'w' ? word : space;
+			}
+			if (isupper(c))
+				set.flip();
+			aChars |= set;
+			return true;
+		}
+		case 't': aSingle = '\t'; break;
+		case 'n': aSingle = '\n'; break;
+		case 'r': aSingle = '\r'; break;
+		case 'f': aSingle = '\f'; break;
+		case 'v': aSingle = '\v'; break;
+		case '0': aSingle = '\0'; break;
+		default:
+			// Other letters and digits are assertions, back references or unicode escapes
+			if (isalnum((uint8_t)c))
+				return false;
+			aSingle = (uint8_t)c;
+			break;
+		}
+		aChars.set(aSingle);
+		return true;
+	}
+
+	std::vector<TokenNfaState>& mStates;
+	const char* mPos;
+	const char* mEnd;
+};
+
+bool TextEditor::TokenDfa::Compile(const LanguageDefinition::TokenRegexStrings& aRegexStrings)
+{
+	// Limits the table to a few MB; a language needing more keeps using std::regex
+	const size_t maxStates = 4096;
 
-		text.resize(line.size());
+	mAccepts.clear();
+	mTransitions.clear();
+	mColors.clear();
+	if (aRegexStrings.empty() || aRegexStrings.size() > 64)
+		return false;
+
+	std::vector<TokenNfaState> nfa(1);
+	for (size_t i = 0; i < aRegexStrings.size(); ++i)
+	{
+		int start, end;
+		TokenRegexParser parser(nfa, aRegexStrings[i].first);
+		if (!parser.Parse(start, end))
+			return false;
+
+		nfa[0].mEpsilon.push_back(start);
+		nfa[end].mAccept = (int)i;
+	}
+
+	// Split the bytes into classes that every character set either fully contains or excludes
+	mByteClass.fill(0);
+	mClassCount = 1;
+	for (auto& state : nfa)
+	{
+		if (state.mNext < 0)
+			continue;
+
+		std::map<std::pair<int, bool>, int> split;
+		for (int b = 0; b < 256; ++b)
+			split.emplace(std::make_pair((int)mByteClass[b], (bool)state.mChars[b]), (int)split.size());
+		if ((int)split.size() == mClassCount)
+			continue;
+
+		for (int b = 0; b < 256; ++b)
+			mByteClass[b] = (uint8_t)split[std::make_pair((int)mByteClass[b], (bool)state.mChars[b])];
+		mClassCount = (int)split.size();
+	}
+
+	std::vector<int> classByte(mClassCount);
+	for (int b = 255; b >= 0; --b)
+		classByte[mByteClass[b]] = b;
 
-		for (size_t i = 0; i < line.size(); ++i)
-			text[i] = line[i].mChar;
+	auto closure = [&nfa](std::vector<int>& aSet)
+	{
+		for (size_t i = 0; i < aSet.size(); ++i)
+			for (int next : nfa[aSet[i]].mEpsilon)
+				if (std::find(aSet.begin(), aSet.end(), next) == aSet.end())
+					aSet.push_back(next);
+		std::sort(aSet.begin(), aSet.end());
+	};
+
+	// Subset construction; state 0 is the empty (dead) set and state 1 the start
+	std::map<std::vector<int>, int> ids;
+	std::vector<std::vector<int>> sets(2);
+	sets[1].push_back(0);
+	closure(sets[1]);
+	ids[sets[0]] = 0;
+	ids[sets[1]] = 1;
+
+	std::vector<uint16_t> transitions(2 * mClassCount, 0);
+	std::vector<uint64_t> accepts(2, 0);
+	for (size_t s = 1; s < sets.size(); ++s)
+	{
+		for (int n : sets[s])
+			if (nfa[n].mAccept >= 0)
+				accepts[s] |= 1ull << nfa[n].mAccept;
 
-		result.emplace_back(std::move(text));
+		for (int c = 0; c < mClassCount; ++c)
+		{
+			std::vector<int> next;
+			for (int n : sets[s])
+				if (nfa[n].mNext >= 0 && nfa[n].mChars[classByte[c]])
+					next.push_back(nfa[n].mNext);
+			closure(next);
+
+			auto it = ids.find(next);
+			if (it == ids.end())
+			{
+				if (sets.size() == maxStates)
+					return false;
+				it = ids.emplace(next, (int)sets.size()).first;
+				sets.push_back(std::move(next));
+				transitions.resize(sets.size() * mClassCount, 0);
+				accepts.push_back(0);
+			}
+			transitions[s * mClassCount + c] = (uint16_t)it->second;
+		}
 	}
 
-	return result;
+	mTransitions = std::move(transitions);
+	mAccepts = std::move(accepts);
+	for (auto& r : aRegexStrings)
+		mColors.push_back(r.second);
+	return true;
 }
 
-std::string TextEditor::GetSelectedText() const
+bool TextEditor::TokenDfa::Match(const char* aBegin, const char* aEnd, const char*& aTokenEnd, PaletteIndex& aColor) const
 {
-	return GetText(mState.mSelectionStart, mState.mSelectionEnd);
-}
+	int best = 64;
+	const char* bestEnd = nullptr;
 
-std::string TextEditor::GetCurrentLineText()const
-{
-	auto lineLength = GetLineMaxColumn(mState.mCursorPosition.mLine);
-	return GetText(
-		Coordinates(mState.mCursorPosition.mLine, 0),
-		Coordinates(mState.mCursorPosition.mLine, lineLength));
-}
+	uint32_t state = 1;
+	for (const char* p = aBegin; ; ++p)
+	{
+		if (const uint64_t accepts = mAccepts[state])
+		{
+			const int first = std::countr_zero(accepts);
+			if (first < best)
+			{
+				best = first;
+				bestEnd = p;
+			}
+			else if ((accepts >> best) & 1)
+				bestEnd = p;
+		}
 
-void TextEditor::ProcessInputs()
-{
-}
+		if (p == aEnd)
+			break;
+		state = mTransitions[state * mClassCount + mByteClass[(uint8_t)*p]];
+		if (state == 0)
+			break;
+	}
 
-void TextEditor::Colorize(int aFromLine, int aLines)
-{
-	int toLine = aLines == -1 ? (int)mLines.size() : std::min((int)mLines.size(), aFromLine + aLines);
-	mColorRangeMin = std::min(mColorRangeMin, aFromLine);
-	mColorRangeMax = std::max(mColorRangeMax, toLine);
-	mColorRangeMin = std::max(0, mColorRangeMin);
-	mColorRangeMax = std::max(mColorRangeMin, mColorRangeMax);
-	mCheckComments = true;
+	if (best == 64)
+		return false;
+
+	aTokenEnd = bestEnd;
+	aColor = mColors[best];
+	return true;
 }
 
-void TextEditor::ColorizeRange(int aFromLine, int aToLine)
+void TextEditor::ColorizeLine(const ColorizerConfig& aConfig, const char* aChars, uint8_t* aColors, size_t aSize)
 {
-	if (mLines.empty() || aFromLine >= aToLine)
+	if (aSize == 0)
 		return;
 
-	std::string buffer;
 	std::cmatch results;
 	std::string id;
 
-	int endLine = std::max(0, std::min((int)mLines.size(), aToLine));
-	for (int i = aFromLine; i < endLine; ++i)
-	{
-		auto& line = mLines[i];
+	auto& language = *aConfig.mLanguage;
 
-		if (line.empty())
-			continue;
+	// Tokens are matched directly on the line's characters; only the palette bits are reset
+	for (size_t j = 0; j < aSize; ++j)
+		aColors[j] = (aColors[j] & ~GlyphColorMask) | (uint8_t)PaletteIndex::Default;
 
-		buffer.resize(line.size());
-		for (size_t j = 0; j < line.size(); ++j)
-		{
-			auto& col = line[j];
-			buffer[j] = col.mChar;
-			col.mColorIndex = PaletteIndex::Default;
-		}
+	const char * bufferBegin = aChars;
+	const char * bufferEnd = bufferBegin + aSize;
 
-		const char * bufferBegin = &buffer.front();
-		const char * bufferEnd = bufferBegin + buffer.size();
+	auto last = bufferEnd;
 
-		auto last = bufferEnd;
+	for (auto first = bufferBegin; first != last; )
+	{
+		const char * token_begin = nullptr;
+		const char * token_end = nullptr;
+		PaletteIndex token_color = PaletteIndex::Default;
 
-		for (auto first = bufferBegin; first != last; )
-		{
-			const char * token_begin = nullptr;
-			const char * token_end = nullptr;
-			PaletteIndex token_color = PaletteIndex::Default;
+		bool hasTokenizeResult = false;
 
-			bool hasTokenizeResult = false;
+		if (language.mTokenize != nullptr)
+		{
+			if (language.mTokenize(first, last, token_begin, token_end, token_color))
+				hasTokenizeResult = true;
+		}
 
-			if (mLanguageDefinition.mTokenize != nullptr)
+		if (hasTokenizeResult == false && aConfig.mTokenDfa.IsValid())
+		{
+			if (aConfig.mTokenDfa.Match(first, last, token_end, token_color))
 			{
-				if (mLanguageDefinition.mTokenize(first, last, token_begin, token_end, token_color))
-					hasTokenizeResult = true;
+				hasTokenizeResult = true;
+				token_begin = first;
 			}
+		}
+		else if (hasTokenizeResult == false)
+		{
+			// todo : remove
+			//printf("using regex for %.*s\n", first + 10 < last ? 10 : int(last - first), first);
 
-			if (hasTokenizeResult == false)
+			for (auto& p : aConfig.mRegexList)
 			{
-				// todo : remove
-				//printf("using regex for %.*s\n", first + 10 < last ? 10 : int(last - first), first);
-
-				for (auto& p : mRegexList)
+				if (std::regex_search(first, last, results, p.first, std::regex_constants::match_continuous))
 				{
-					if (std::regex_search(first, last, results, p.first, std::regex_constants::match_continuous))
-					{
-						hasTokenizeResult = true;
+					hasTokenizeResult = true;
 
-						auto& v = *results.begin();
-						token_begin = v.first;
-						token_end = v.second;
-						token_color = p.second;
-						break;
-					}
+					auto& v = *results.begin();
+					token_begin = v.first;
+					token_end = v.second;
+					token_color = p.second;
+					break;
 				}
 			}
+		}
 
-			if (hasTokenizeResult == false)
-			{
-				first++;
-			}
-			else
-			{
-				const size_t token_length = token_end - token_begin;
+		if (hasTokenizeResult == false)
+		{
+			first++;
+		}
+		else
+		{
+			const size_t token_length = token_end - token_begin;
 
-				if (token_color == PaletteIndex::Identifier)
-				{
-					id.assign(token_begin, token_end);
+			if (token_color == PaletteIndex::Identifier)
+			{
+				id.assign(token_begin, token_end);
 
-					// todo : allmost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
-					if (!mLanguageDefinition.mCaseSensitive)
-						std::transform(id.begin(), id.end(), id.begin(), ::toupper);
+				// todo : allmost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
+				if (!language.mCaseSensitive)
+					std::transform(id.begin(), id.end(), id.begin(), ::toupper);
 
-					if (!line[first - bufferBegin].mPreprocessor)
-					{
-						if (mLanguageDefinition.mKeywords.count(id) != 0)
-							token_color = PaletteIndex::Keyword;
-						else if (mLanguageDefinition.mIdentifiers.count(id) != 0)
-							token_color = PaletteIndex::KnownIdentifier;
-						else if (mLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
-							token_color = PaletteIndex::PreprocIdentifier;
-					}
-					else
-					{
-						if (mLanguageDefinition.mPreprocIdentifiers.count(id) != 0)
-							token_color = PaletteIndex::PreprocIdentifier;
-					}
+				if (!(aColors[first - bufferBegin] & GlyphPreprocessor))
+				{
+					if (language.mKeywords.count(id) != 0)
+						token_color = PaletteIndex::Keyword;
+					else if (language.mIdentifiers.count(id) != 0)
+						token_color = PaletteIndex::KnownIdentifier;
+					else if (language.mPreprocIdentifiers.count(id) != 0)
+						token_color = PaletteIndex::PreprocIdentifier;
+				}
+				else
+				{
+					if (language.mPreprocIdentifiers.count(id) != 0)
+						token_color = PaletteIndex::PreprocIdentifier;
 				}
+			}
 
-				for (size_t j = 0; j < token_length; ++j)
-					line[(token_begin - bufferBegin) + j].mColorIndex = token_color;
+			auto colors = aColors + (token_begin - bufferBegin);
+			for (size_t j = 0; j < token_length; ++j)
+				colors[j] = (colors[j] & ~GlyphColorMask) | (uint8_t)token_color;
 
-				first = token_end;
-			}
+			first = token_end;
 		}
 	}
 }
 
+TextEditor::TokenizerBenchmark TextEditor::BenchmarkTokenizer(const LanguageDefinitionPtr& aLanguageDef, const std::vector<std::string>& aLines)
+{
+	TokenizerBenchmark result;
+
+	ColorizerConfig regexConfig;
+	regexConfig.mLanguage = aLanguageDef;
+	for (auto& r : aLanguageDef->mTokenRegexStrings)
+		regexConfig.mRegexList.push_back(std::make_pair(std::regex(r.first, std::regex_constants::optimize), r.second));
+
+	ColorizerConfig dfaConfig = regexConfig;
+	result.mDfaCompiled = dfaConfig.mTokenDfa.Compile(aLanguageDef->mTokenRegexStrings);
+
+	for (auto& line : aLines)
+		result.mBytes += line.size();
+
+	// Only the tokens are timed; comment and preprocessor flags stay clear in both runs
+	auto run = [&aLines, &result](const ColorizerConfig& aConfig, std::vector<uint8_t>& aColors)
+	{
+		aColors.assign(result.mBytes, 0);
+		const auto start = std::chrono::steady_clock::now();
+		size_t offset = 0;
+		for (auto& line : aLines)
+		{
+			ColorizeLine(aConfig, line.data(), aColors.data() + offset, line.size());
+			offset += line.size();
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	std::vector<uint8_t> regexColors, dfaColors;
+	result.mRegexSeconds = run(regexConfig, regexColors);
+	result.mDfaSeconds = run(dfaConfig, dfaColors);
+
+	for (size_t i = 0; i < result.mBytes; ++i)
+		if ((regexColors[i] & GlyphColorMask) != (dfaColors[i] & GlyphColorMask))
+			++result.mMismatches;
+
+	return result;
+}
+
+bool TextEditor::IsColorizing() const
+{
+	if (mLines.empty() || !mColorizerEnabled || HasTextView())
+		return false;
+	return mColorizeJobInFlight || mColorRangeMin < mColorRangeMax || mCommentRangeMin < mCommentRangeMax;
+}
+
+int TextEditor::GetCursorBlinkDelay() const
+{
+	if (!mCursorBlinking)
+		return -1;
+
+	// Render shows the cursor from 400 ms into each 800 ms period
+	auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	auto elapsed = (int64_t)(now - mStartTime);
+	if (elapsed <= 400)
+		return (int)(401 - elapsed);
+	if (elapsed <= 800)
+		return (int)(801 - elapsed);
+	return 0;
+}
+
 void TextEditor::ColorizeInternal()
 {
 	if (mLines.empty() || !mColorizerEnabled)
 		return;
 
-	if (mCheckComments)
-	{
-		auto endLine = mLines.size();
-		auto endIndex = 0;
-		auto commentStartLine = endLine;
-		auto commentStartIndex = endIndex;
-		auto withinString = false;
-		auto withinSingleLineComment = false;
-		auto withinPreproc = false;
-		auto firstChar = true;			// there is no other non-whitespace characters in the line before
-		auto concatenate = false;		// '\' on the very end of the line
-		auto currentLine = 0;
-		auto currentIndex = 0;
-		while (currentLine < endLine || currentIndex < endIndex)
+	if (mCommentRangeMin < mCommentRangeMax)
+	{
+		// Resume from the line before the edit, whose start state is still valid; lines that were
+		// never scanned send us further back.
+		auto currentLine = std::min(mCommentRangeMin, (int)mLines.size() - 1);
+		if (currentLine > 0)
+			--currentLine;
+		while (currentLine > 0 && mLines[currentLine].mLexerState == LexerInvalid)
+			--currentLine;
+
+		// A change that ripples through a huge file is spread over several frames, a couple of
+		// milliseconds each
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+		int scanned = 0;
+		bool done = true;
+
+		uint8_t state = currentLine == 0 ? (uint8_t)LexerFirstChar : mLines[currentLine].mLexerState;
+		for (; currentLine < (int)mLines.size(); ++currentLine)
 		{
 			auto& line = mLines[currentLine];
 
-			if (currentIndex == 0 && !concatenate)
+			// Past the edited lines, stop as soon as a line was already scanned with the same state
+			if (currentLine >= mCommentRangeMax && line.mLexerState == state)
+				break;
+
+			if (++scanned % 256 == 0 && std::chrono::steady_clock::now() > deadline)
 			{
-				withinSingleLineComment = false;
-				withinPreproc = false;
-				firstChar = true;
+				done = false;
+				break;
 			}
 
-			concatenate = false;
+			line.mLexerState = state;
+			state = ColorizeLineComments(line, state);
+		}
+
+		// Lines past the edit whose state changed, e.g. the continuation of a preprocessor line,
+		// can classify identifiers differently and need their tokens colorized again. That
+		// includes the last line of the range: a pass split across frames resumes there.
+		if (currentLine >= mCommentRangeMax)
+		{
+			mColorRangeMin = std::min(mColorRangeMin, mCommentRangeMax - 1);
+			mColorRangeMax = std::max(mColorRangeMax, currentLine);
+			++mColorizeVersion;
+		}
+
+		if (done)
+		{
+			mCommentRangeMin = std::numeric_limits<int>::max();
+			mCommentRangeMax = 0;
+		}
+		else
+		{
+			mCommentRangeMin = currentLine;
+			mCommentRangeMax = std::max(mCommentRangeMax, currentLine + 1);
+		}
+	}
+
+	// Take over the lines the colorizer thread has finished since the last frame
+	if (mColorizeJobInFlight)
+	{
+		std::unique_ptr<ColorizeJob> job;
+		{
+			std::lock_guard<std::mutex> lock(GetColorizerWorker().mMutex);
+			job = std::move(mFinishedJob);
+		}
+		if (job == nullptr)
+			return;
+
+		mColorizeJobInFlight = false;
+		if (job->mVersion == mColorizeVersion)
+			ApplyColorizeJob(*job);
+	}
+
+	// Lines may have been removed since the range was recorded. Lines the comment pass has not
+	// reached yet may still change their flags, so they wait for it.
+	mColorRangeMax = std::min(mColorRangeMax, (int)mLines.size());
+	const int colorEnd = mCommentRangeMin < mCommentRangeMax ? std::min(mColorRangeMax, mCommentRangeMin) : mColorRangeMax;
+	if (mColorRangeMin < colorEnd)
+	{
+		// The lines drawn by the last frame go first, then the rest of the range is swept from the top
+		const bool visibleDone = mVisibleColorizedVersion == mColorizeVersion &&
+			mVisibleColorizedMin <= mVisibleLineMin && mVisibleLineMax <= mVisibleColorizedMax;
+		const int from = std::max(mVisibleLineMin, mColorRangeMin);
+		const int to = std::min(mVisibleLineMax, colorEnd);
+
+		mColorizeJobVisible = !visibleDone && from < to;
+		if (mColorizeJobVisible)
+		{
+			mVisibleColorizedMin = mVisibleLineMin;
+			mVisibleColorizedMax = colorEnd < mColorRangeMax ? to : mVisibleLineMax;
+			PostColorizeJob(from, to);
+		}
+		else
+		{
+			const bool slowTokenizer = mLanguageDefinition->mTokenize == nullptr && !mColorizerConfig->mTokenDfa.IsValid();
+			const int increment = slowTokenizer ? 1000 : 5000;
+
+			PostColorizeJob(mColorRangeMin, std::min(mColorRangeMin + increment, colorEnd));
+		}
+	}
+}
+
+void TextEditor::PostColorizeJob(int aFromLine, int aToLine)
+{
+	auto job = std::make_unique<ColorizeJob>();
+	job->mEditor = this;
+	job->mVersion = mColorizeVersion;
+	job->mFirstLine = aFromLine;
+	job->mConfig = mColorizerConfig;
+
+	const int endLine = std::min((int)mLines.size(), aToLine);
+	job->mLineStarts.push_back(0);
+	for (int i = aFromLine; i < endLine; ++i)
+	{
+		auto& line = mLines[i];
+		job->mChars.insert(job->mChars.end(), line.mChars.begin(), line.mChars.end());
+		job->mColors.insert(job->mColors.end(), line.mColors.begin(), line.mColors.end());
+		job->mLineStarts.push_back(job->mChars.size());
+	}
+
+	// Lines on screen go ahead of the sweeps through the other open files
+	GetColorizerWorker().Post(std::move(job), mColorizeJobVisible);
+	mColorizeJobInFlight = true;
+}
+
+void TextEditor::ApplyColorizeJob(const ColorizeJob& aJob)
+{
+	// Only the palette bits come from the job, the comment flags may have been updated since
+	const int lineCount = (int)aJob.mLineStarts.size() - 1;
+	for (int i = 0; i < lineCount && aJob.mFirstLine + i < (int)mLines.size(); ++i)
+	{
+		auto& line = mLines[aJob.mFirstLine + i];
+		auto colorized = aJob.mColors.data() + aJob.mLineStarts[i];
+		if (line.size() != aJob.mLineStarts[i + 1] - aJob.mLineStarts[i])
+			continue;
 
-			if (!line.empty())
+		for (size_t j = 0; j < line.size(); ++j)
+		{
+			const uint8_t color = (line.mColors[j] & ~GlyphColorMask) | (colorized[j] & GlyphColorMask);
+			if (line.mColors[j] != color)
 			{
-				auto& g = line[currentIndex];
-				auto c = g.mChar;
+				line.mColors[j] = color;
+				line.mVersion = 0;
+			}
+		}
+	}
 
-				if (c != mLanguageDefinition.mPreprocChar && !isspace(c))
-					firstChar = false;
+	if (mColorizeJobVisible)
+		mVisibleColorizedVersion = aJob.mVersion;
 
-				if (currentIndex == (int)line.size() - 1 && line[line.size() - 1].mChar == '\\')
-					concatenate = true;
+	// Shrink the pending range if the job was at either end of it; visible lines in the
+	// middle are colorized again by the sweep, which is cheaper than tracking holes
+	const int from = aJob.mFirstLine;
+	const int to = aJob.mFirstLine + lineCount;
+	if (from <= mColorRangeMin && to > mColorRangeMin)
+		mColorRangeMin = to;
+	else if (to >= mColorRangeMax && from < mColorRangeMax)
+		mColorRangeMax = from;
 
-				bool inComment = (commentStartLine < currentLine || (commentStartLine == currentLine && commentStartIndex <= currentIndex));
+	if (mColorRangeMin >= mColorRangeMax)
+	{
+		mColorRangeMin = std::numeric_limits<int>::max();
+		mColorRangeMax = 0;
+	}
+}
 
-				if (withinString)
-				{
-					line[currentIndex].mMultiLineComment = inComment;
+uint8_t TextEditor::ColorizeLineComments(Line& aLine, uint8_t aState)
+{
+	auto withinString = (aState & LexerInString) != 0;
+	auto concatenate = (aState & LexerConcatenate) != 0;	// '\' on the very end of the line
+	auto withinSingleLineComment = concatenate && (aState & LexerInSingleLineComment) != 0;
+	auto withinPreproc = concatenate && (aState & LexerInPreproc) != 0;
+	auto firstChar = !concatenate || (aState & LexerFirstChar) != 0;	// there is no other non-whitespace characters in the line before
 
-					if (c == '\"')
-					{
-						if (currentIndex + 1 < (int)line.size() && line[currentIndex + 1].mChar == '\"')
-						{
-							currentIndex += 1;
-							if (currentIndex < (int)line.size())
-								line[currentIndex].mMultiLineComment = inComment;
-						}
-						else
-							withinString = false;
-					}
-					else if (c == '\\')
-					{
-						currentIndex += 1;
-						if (currentIndex < (int)line.size())
-							line[currentIndex].mMultiLineComment = inComment;
-					}
-				}
-				else
-				{
-					if (firstChar && c == mLanguageDefinition.mPreprocChar)
-						withinPreproc = true;
+	// Index where the open block comment starts in this line, -1 when it was opened on an earlier one
+	const int noComment = std::numeric_limits<int>::max();
+	int commentStartIndex = (aState & LexerInComment) ? -1 : noComment;
 
-					if (c == '\"')
-					{
-						withinString = true;
-						line[currentIndex].mMultiLineComment = inComment;
-					}
-					else
-					{
-						auto pred = [](const char& a, const Glyph& b) { return a == b.mChar; };
-						auto from = line.begin() + currentIndex;
-						auto& startStr = mLanguageDefinition.mCommentStart;
-						auto& singleStartStr = mLanguageDefinition.mSingleLineComment;
-
-						if (singleStartStr.size() > 0 &&
-							currentIndex + singleStartStr.size() <= line.size() &&
-							equals(singleStartStr.begin(), singleStartStr.end(), from, from + singleStartStr.size(), pred))
-						{
-							withinSingleLineComment = true;
-						}
-						else if (!withinSingleLineComment && currentIndex + startStr.size() <= line.size() &&
-							equals(startStr.begin(), startStr.end(), from, from + startStr.size(), pred))
-						{
-							commentStartLine = currentLine;
-							commentStartIndex = currentIndex;
-						}
+	auto setFlag = [&aLine](int aIndex, uint8_t aFlag, bool aValue)
+	{
+		auto& color = aLine.mColors[aIndex];
+		const uint8_t value = aValue ? (color | aFlag) : (color & ~aFlag);
+		if (color != value)
+		{
+			color = value;
+			aLine.mVersion = 0;
+		}
+	};
+	auto matches = [&aLine](int aIndex, const std::string& aStr)
+	{
+		return aIndex >= 0 && aIndex + aStr.size() <= aLine.size() &&
+			(aStr.empty() || aLine.mChars[aIndex] == (Char)aStr[0]) &&
+			memcmp(aLine.data() + aIndex, aStr.data(), aStr.size()) == 0;
+	};
 
-						inComment = inComment = (commentStartLine < currentLine || (commentStartLine == currentLine && commentStartIndex <= currentIndex));
+	concatenate = false;
+	for (int currentIndex = 0; currentIndex < (int)aLine.size();)
+	{
+		concatenate = false;
 
-						line[currentIndex].mMultiLineComment = inComment;
-						line[currentIndex].mComment = withinSingleLineComment;
+		auto c = aLine.mChars[currentIndex];
 
-						auto& endStr = mLanguageDefinition.mCommentEnd;
-						if (currentIndex + 1 >= (int)endStr.size() &&
-							equals(endStr.begin(), endStr.end(), from + 1 - endStr.size(), from + 1, pred))
-						{
-							commentStartIndex = endIndex;
-							commentStartLine = endLine;
-						}
-					}
-				}
-				line[currentIndex].mPreprocessor = withinPreproc;
-				currentIndex += UTF8CharLength(c);
-				if (currentIndex >= (int)line.size())
+		if (c != mLanguageDefinition->mPreprocChar && !isspace(c))
+			firstChar = false;
+
+		if (currentIndex == (int)aLine.size() - 1 && c == '\\')
+			concatenate = true;
+
+		bool inComment = commentStartIndex <= currentIndex;
+
+		if (withinString)
+		{
+			setFlag(currentIndex, GlyphMultiLineComment, inComment);
+
+			if (c == '\"')
+			{
+				if (currentIndex + 1 < (int)aLine.size() && aLine.mChars[currentIndex + 1] == '\"')
 				{
-					currentIndex = 0;
-					++currentLine;
+					currentIndex += 1;
+					if (currentIndex < (int)aLine.size())
+						setFlag(currentIndex, GlyphMultiLineComment, inComment);
 				}
+				else
+					withinString = false;
+			}
+			else if (c == '\\')
+			{
+				currentIndex += 1;
+				if (currentIndex < (int)aLine.size())
+					setFlag(currentIndex, GlyphMultiLineComment, inComment);
+			}
+		}
+		else
+		{
+			if (firstChar && c == mLanguageDefinition->mPreprocChar)
+				withinPreproc = true;
+
+			if (c == '\"')
+			{
+				withinString = true;
+				setFlag(currentIndex, GlyphMultiLineComment, inComment);
 			}
 			else
 			{
-				currentIndex = 0;
-				++currentLine;
+				auto& startStr = mLanguageDefinition->mCommentStart;
+				auto& singleStartStr = mLanguageDefinition->mSingleLineComment;
+
+				if (singleStartStr.size() > 0 && matches(currentIndex, singleStartStr))
+				{
+					withinSingleLineComment = true;
+				}
+				else if (!withinSingleLineComment && matches(currentIndex, startStr))
+				{
+					commentStartIndex = currentIndex;
+				}
+
+				inComment = commentStartIndex <= currentIndex;
+
+				setFlag(currentIndex, GlyphMultiLineComment, inComment);
+				setFlag(currentIndex, GlyphComment, withinSingleLineComment);
+
+				auto& endStr = mLanguageDefinition->mCommentEnd;
+				if (currentIndex + 1 >= (int)endStr.size() &&
+					matches(currentIndex + 1 - (int)endStr.size(), endStr))
+				{
+					commentStartIndex = noComment;
+				}
 			}
 		}
-		mCheckComments = false;
+		if (currentIndex < (int)aLine.size())
+			setFlag(currentIndex, GlyphPreprocessor, withinPreproc);
+
+		currentIndex += UTF8CharLength(c);
 	}
 
-	if (mColorRangeMin < mColorRangeMax)
+	// Single-line comments and preprocessor directives only carry over into a continued line
+	uint8_t state = 0;
+	if (withinString)
+		state |= LexerInString;
+	if (commentStartIndex != noComment)
+		state |= LexerInComment;
+	if (concatenate)
 	{
-		const int increment = (mLanguageDefinition.mTokenize == nullptr) ? 10 : 10000;
-		const int to = std::min(mColorRangeMin + increment, mColorRangeMax);
-		ColorizeRange(mColorRangeMin, to);
-		mColorRangeMin = to;
-
-		if (mColorRangeMax == mColorRangeMin)
-		{
-			mColorRangeMin = std::numeric_limits<int>::max();
-			mColorRangeMax = 0;
-		}
-		return;
+		state |= LexerConcatenate;
+		if (withinSingleLineComment)
+			state |= LexerInSingleLineComment;
+		if (withinPreproc)
+			state |= LexerInPreproc;
+		if (firstChar)
+			state |= LexerFirstChar;
 	}
+	return state;
 }
 
 float TextEditor::TextDistanceToLineStart(const Coordinates& aFrom) const
 {
 	auto& line = mLines[aFrom.mLine];
-	float distance = 0.0f;
-	float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
 	int colIndex = GetCharacterIndex(aFrom);
-	for (size_t it = 0u; it < line.size() && it < colIndex; )
+
+	// Tab stops fall on whole columns when every glyph is as wide as a space
+	if (mMonospace)
+		return GetCharacterColumn(aFrom.mLine, colIndex) * mCharAdvance.x;
+
+	float distance = 0.0f;
+	int it = 0;
+	if (auto longLine = FindLongLine(line))
 	{
-		if (line[it].mChar == '\t')
+		auto& checkpoint = FindCheckpoint(*longLine, &LineCheckpoint::mIndex, colIndex);
+		distance = checkpoint.mX;
+		it = checkpoint.mIndex;
+	}
+	for (; it < (int)line.size() && it < colIndex; )
+	{
+		if (line.mChars[it] == '\t')
 		{
-			distance = (1.0f + std::floor((1.0f + distance) / (float(mTabSize) * spaceSize))) * (float(mTabSize) * spaceSize);
+			distance = NextTabStop(distance);
 			++it;
 		}
 		else
 		{
-			auto d = UTF8CharLength(line[it].mChar);
-			char tempCString[7];
-			int i = 0;
-			for (; i < 6 && d-- > 0 && it < (int)line.size(); i++, it++)
-				tempCString[i] = line[it].mChar;
-
-			tempCString[i] = '\0';
-			distance += ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, tempCString, nullptr, nullptr).x;
+			auto d = std::min(UTF8CharLength(line.mChars[it]), (int)line.size() - it);
+			distance += TextWidth(line.data() + it, line.data() + it + d);
+			it += d;
 		}
 	}
 
 	return distance;
 }
 
+// Computes mCharAdvance for the current font size (Ctrl + mouse wheel). The glyph advances are
+// only measured again when the font or its size changed.
+void TextEditor::UpdateFontMetrics()
+{
+	mCharAdvance.y = ImGui::GetTextLineHeightWithSpacing() * mLineSpacing;
+
+	auto font = ImGui::GetFont();
+	auto fontSize = ImGui::GetFontSize();
+	if (font == mMetricsFont && fontSize == mMetricsFontSize)
+		return;
+
+	mMetricsFont = font;
+	mMetricsFontSize = fontSize;
+	mLineLayouts.clear();
+	mLongLines.clear();
+	mWrappedLines.clear();
+	InvalidateWrap();
+	mGlyphScale = fontSize / font->FontSize;
+	mSpaceAdvance = GlyphAdvance(' ');
+	mCharAdvance.x = GlyphAdvance('#');
+
+	// Codepoints the font lacks use the fallback advance, so checking the lookup table and the
+	// fallback covers every glyph Render can draw
+	auto advance = font->GetCharAdvance('#');
+	auto maxAdvance = font->FallbackAdvanceX;
+	mMonospace = font->FallbackAdvanceX == advance;
+	for (int c = ' '; c < font->IndexAdvanceX.Size; ++c)
+	{
+		mMonospace = mMonospace && font->IndexAdvanceX[c] == advance;
+		maxAdvance = std::max(maxAdvance, font->IndexAdvanceX[c]);
+	}
+	mMaxAdvance = maxAdvance * mGlyphScale;
+}
+
+// Same result as ImFont::CalcTextSizeA for a single line, using the advances UpdateFontMetrics cached
+float TextEditor::TextWidth(const char* aBegin, const char* aEnd) const
+{
+	if (mMonospace)
+	{
+		int count = 0;
+		for (auto p = aBegin; p < aEnd; ++p)
+			count += (*p & 0xC0) != 0x80;
+		return count * mCharAdvance.x;
+	}
+
+	float width = 0.0f;
+	for (auto p = aBegin; p < aEnd;)
+	{
+		ImWchar c;
+		p += UTF8Decode(p, aEnd, c);
+		width += GlyphAdvance(c);
+	}
+	return width;
+}
+
+float TextEditor::NextTabStop(float aX) const
+{
+	auto tabSize = float(mTabSize) * mSpaceAdvance;
+	return (1.0f + std::floor((1.0f + aX) / tabSize)) * tabSize;
+}
+
 void TextEditor::EnsureCursorVisible()
 {
 	if (!mWithinRender)
@@ -2439,6 +4468,19 @@ void TextEditor::EnsureCursorVisible()
 	auto right = (int)ceil((scrollX + width) / mCharAdvance.x);
 
 	auto pos = GetActualCursorCoordinates();
+
+	// Wrapped text only scrolls vertically, to the row the cursor is in
+	if (IsWrapping())
+	{
+		UpdateWrap();
+		auto row = mWrapRows.GetFirstRow(pos.mLine) + FindRow(GetWrappedLine(pos.mLine), pos.mColumn);
+		if (row < top)
+			ImGui::SetScrollY(std::max(0.0f, (row - 1) * mCharAdvance.y));
+		if (row > bottom - 4)
+			ImGui::SetScrollY(std::max(0.0f, (row + 4) * mCharAdvance.y - height));
+		return;
+	}
+
 	auto len = TextDistanceToLineStart(pos);
 
 	if (pos.mLine < top)
@@ -2504,14 +4546,14 @@ void TextEditor::UndoRecord::Redo(TextEditor * aEditor)
 	if (!mRemoved.empty())
 	{
 		aEditor->DeleteRange(mRemovedStart, mRemovedEnd);
-		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 1);
+		aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 2);
 	}
 
 	if (!mAdded.empty())
 	{
 		auto start = mAddedStart;
 		aEditor->InsertTextAt(start, mAdded.c_str());
-		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 1);
+		aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 2);
 	}
 
 	aEditor->mState = mAfter;
@@ -2735,12 +4777,13 @@ static bool TokenizeCStylePunctuation(const char * in_begin, const char * in_end
 	return false;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::CPlusPlus()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::CPlusPlus()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const cppKeywords[] = {
 			"alignas", "alignof", "and", "and_eq", "asm", "atomic_cancel", "atomic_commit", "atomic_noexcept", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char", "char16_t", "char32_t", "class",
 			"compl", "concept", "const", "constexpr", "const_cast", "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float",
@@ -2799,17 +4842,18 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::CPlusPlus(
 
 		langDef.mName = "C++";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::HLSL()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::HLSL()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const keywords[] = {
 			"AppendStructuredBuffer", "asm", "asm_fragment", "BlendState", "bool", "break", "Buffer", "ByteAddressBuffer", "case", "cbuffer", "centroid", "class", "column_major", "compile", "compile_fragment",
 			"CompileShader", "const", "continue", "ComputeShader", "ConsumeStructuredBuffer", "default", "DepthStencilState", "DepthStencilView", "discard", "do", "double", "DomainShader", "dword", "else",
@@ -2853,7 +4897,7 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::HLSL()
 		}
 
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[ \\t]*#[ \\t]*[a-zA-Z_]+", PaletteIndex::Preprocessor));
-		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"])*\\\"", PaletteIndex::String));
+		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"\\\\])*\\\"", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("\\'\\\\?[^\\']\\'", PaletteIndex::CharLiteral));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?([0-9]+([.][0-9]*)?|[.][0-9]+)([eE][+-]?[0-9]+)?[fF]?", PaletteIndex::Number));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?[0-9]+[Uu]?[lL]?[lL]?", PaletteIndex::Number));
@@ -2871,17 +4915,18 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::HLSL()
 
 		langDef.mName = "HLSL";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::GLSL()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::GLSL()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const keywords[] = {
 			"auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return", "short",
 			"signed", "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Bool", "_Complex", "_Generic", "_Imaginary",
@@ -2902,7 +4947,7 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::GLSL()
 		}
 
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[ \\t]*#[ \\t]*[a-zA-Z_]+", PaletteIndex::Preprocessor));
-		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"])*\\\"", PaletteIndex::String));
+		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"\\\\])*\\\"", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("\\'\\\\?[^\\']\\'", PaletteIndex::CharLiteral));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?([0-9]+([.][0-9]*)?|[.][0-9]+)([eE][+-]?[0-9]+)?[fF]?", PaletteIndex::Number));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?[0-9]+[Uu]?[lL]?[lL]?", PaletteIndex::Number));
@@ -2920,17 +4965,18 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::GLSL()
 
 		langDef.mName = "GLSL";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::C()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::C()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const keywords[] = {
 			"auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return", "short",
 			"signed", "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Bool", "_Complex", "_Generic", "_Imaginary",
@@ -2986,17 +5032,18 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::C()
 
 		langDef.mName = "C";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::SQL()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::SQL()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const keywords[] = {
 			"ADD", "EXCEPT", "PERCENT", "ALL", "EXEC", "PLAN", "ALTER", "EXECUTE", "PRECISION", "AND", "EXISTS", "PRIMARY", "ANY", "EXIT", "PRINT", "AS", "FETCH", "PROC", "ASC", "FILE", "PROCEDURE",
 			"AUTHORIZATION", "FILLFACTOR", "PUBLIC", "BACKUP", "FOR", "RAISERROR", "BEGIN", "FOREIGN", "READ", "BETWEEN", "FREETEXT", "READTEXT", "BREAK", "FREETEXTTABLE", "RECONFIGURE",
@@ -3032,7 +5079,7 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::SQL()
 			langDef.mIdentifiers.insert(std::make_pair(std::string(k), id));
 		}
 
-		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"])*\\\"", PaletteIndex::String));
+		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"\\\\])*\\\"", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("\\\'[^\\\']*\\\'", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?([0-9]+([.][0-9]*)?|[.][0-9]+)([eE][+-]?[0-9]+)?[fF]?", PaletteIndex::Number));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?[0-9]+[Uu]?[lL]?[lL]?", PaletteIndex::Number));
@@ -3050,17 +5097,18 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::SQL()
 
 		langDef.mName = "SQL";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::AngelScript()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::AngelScript()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const keywords[] = {
 			"and", "abstract", "auto", "bool", "break", "case", "cast", "class", "const", "continue", "default", "do", "double", "else", "enum", "false", "final", "float", "for",
 			"from", "funcdef", "function", "get", "if", "import", "in", "inout", "int", "interface", "int8", "int16", "int32", "int64", "is", "mixin", "namespace", "not",
@@ -3082,7 +5130,7 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::AngelScrip
 			langDef.mIdentifiers.insert(std::make_pair(std::string(k), id));
 		}
 
-		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"])*\\\"", PaletteIndex::String));
+		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"\\\\])*\\\"", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("\\'\\\\?[^\\']\\'", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?([0-9]+([.][0-9]*)?|[.][0-9]+)([eE][+-]?[0-9]+)?[fF]?", PaletteIndex::Number));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?[0-9]+[Uu]?[lL]?[lL]?", PaletteIndex::Number));
@@ -3100,17 +5148,18 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::AngelScrip
 
 		langDef.mName = "AngelScript";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
 
-const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::Lua()
+const TextEditor::LanguageDefinitionPtr& TextEditor::LanguageDefinition::Lua()
 {
-	static bool inited = false;
-	static LanguageDefinition langDef;
-	if (!inited)
+	static LanguageDefinitionPtr langDefPtr;
+	if (!langDefPtr)
 	{
+		LanguageDefinition langDef;
+
 		static const char* const keywords[] = {
 			"and", "break", "do", "", "else", "elseif", "end", "false", "for", "function", "if", "in", "", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while"
 		};
@@ -3137,7 +5186,7 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::Lua()
 			langDef.mIdentifiers.insert(std::make_pair(std::string(k), id));
 		}
 
-		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"])*\\\"", PaletteIndex::String));
+		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("L?\\\"(\\\\.|[^\\\"\\\\])*\\\"", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("\\\'[^\\\']*\\\'", PaletteIndex::String));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("0[xX][0-9a-fA-F]+[uU]?[lL]?[lL]?", PaletteIndex::Number));
 		langDef.mTokenRegexStrings.push_back(std::make_pair<std::string, PaletteIndex>("[+-]?([0-9]+([.][0-9]*)?|[.][0-9]+)([eE][+-]?[0-9]+)?[fF]?", PaletteIndex::Number));
@@ -3154,7 +5203,7 @@ const TextEditor::LanguageDefinition& TextEditor::LanguageDefinition::Lua()
 
 		langDef.mName = "Lua";
 
-		inited = true;
+		langDefPtr = std::make_shared<const LanguageDefinition>(std::move(langDef));
 	}
-	return langDef;
+	return langDefPtr;
 }
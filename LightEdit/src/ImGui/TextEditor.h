@@ -3,11 +3,17 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <climits>
 #include <memory>
 #include <unordered_set>
 #include <unordered_map>
 #include <map>
 #include <regex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 #include "imgui.h"
 
 class TextEditor
@@ -133,21 +139,93 @@ public:
 	typedef std::array<ImU32, (unsigned)PaletteIndex::Max> Palette;
 	typedef uint8_t Char;
 
-	struct Glyph
+	// Colorizer state of a single character, one byte each: the PaletteIndex in the low
+	// five bits and the flags set by the comment/preprocessor pass in the upper three.
+	enum GlyphFlags : uint8_t
 	{
-		Char mChar;
-		PaletteIndex mColorIndex = PaletteIndex::Default;
-		bool mComment : 1;
-		bool mMultiLineComment : 1;
-		bool mPreprocessor : 1;
-
-		Glyph(Char aChar, PaletteIndex aColorIndex) : mChar(aChar), mColorIndex(aColorIndex),
-			mComment(false), mMultiLineComment(false), mPreprocessor(false) {}
+		GlyphColorMask = 0x1f,
+		GlyphComment = 0x20,
+		GlyphMultiLineComment = 0x40,
+		GlyphPreprocessor = 0x80
 	};
 
-	typedef std::vector<Glyph> Line;
-	typedef std::vector<Line> Lines;
+	// Comment/string/preprocessor scanner state at the start of a line, so that a rescan can
+	// resume at any line instead of at the top of the file.
+	enum LexerState : uint8_t
+	{
+		LexerInString = 0x01,
+		LexerInComment = 0x02,				// inside a block comment
+		LexerInSingleLineComment = 0x04,
+		LexerInPreproc = 0x08,
+		LexerFirstChar = 0x10,				// only whitespace so far in the (continued) line
+		LexerConcatenate = 0x20,			// the previous line ended with '\' and continues here
+		LexerInvalid = 0xff					// never scanned
+	};
+
+	// A line keeps its characters in one contiguous array, so scans and copies work on plain
+	// bytes, and the colorizer state in a parallel array of the same length.
+	struct Line
+	{
+		std::vector<Char> mChars;
+		std::vector<uint8_t> mColors;
+		uint8_t mLexerState = LexerInvalid;	// state the line was last scanned with, reset by any edit
+		uint32_t mVersion = 0;				// names the characters and colors in the layout cache, reset by any change
+
+		size_t size() const { return mChars.size(); }
+		bool empty() const { return mChars.empty(); }
+		const char* data() const { return (const char*)mChars.data(); }
+
+		void insert(size_t aIndex, const Char* aChars, size_t aCount, uint8_t aColor = (uint8_t)PaletteIndex::Default);
+		void insert(size_t aIndex, const Line& aFrom, size_t aStart, size_t aEnd);
+		void append(const Line& aFrom, size_t aStart, size_t aEnd) { insert(size(), aFrom, aStart, aEnd); }
+		void erase(size_t aStart, size_t aEnd);
+	};
+
+	// Line storage organized as a piece tree one level deep: consecutive lines are grouped
+	// into chunks of at most a few hundred lines, and a start index records where each chunk
+	// begins. Inserting or removing lines only shifts the lines of the touched chunk and the
+	// chunk index, so the cost of an edit no longer grows with the number of lines behind it.
+	class Lines
+	{
+	public:
+		Lines() : mSize(0), mLastChunk(0) {}
+
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+
+		Line& operator[](size_t aIndex) { auto c = FindChunk(aIndex); return mChunks[c][aIndex - mChunkStart[c]]; }
+		const Line& operator[](size_t aIndex) const { auto c = FindChunk(aIndex); return mChunks[c][aIndex - mChunkStart[c]]; }
+		Line& at(size_t aIndex) { assert(aIndex < mSize); return (*this)[aIndex]; }
+		const Line& at(size_t aIndex) const { assert(aIndex < mSize); return (*this)[aIndex]; }
+		Line& back() { return (*this)[mSize - 1]; }
+		const Line& back() const { return (*this)[mSize - 1]; }
+
+		void clear();
+		void resize(size_t aSize);
+		void push_back(Line&& aLine);
+		void emplace_back(Line&& aLine) { push_back(std::move(aLine)); }
+		Line& insert(size_t aIndex, Line&& aLine);
+		void insert(size_t aIndex, std::vector<Line>&& aLines);
+		void erase(size_t aStart, size_t aEnd);
+
+	private:
+		static const size_t kChunkSize = 512;
+
+		size_t FindChunk(size_t aIndex) const;
+		void SplitChunk(size_t aChunk);
+		void UpdateChunkStarts(size_t aFromChunk);
+
+		std::vector<std::vector<Line>> mChunks;
+		std::vector<size_t> mChunkStart;
+		size_t mSize;
+		mutable size_t mLastChunk;
+	};
 
+	struct LanguageDefinition;
+	typedef std::shared_ptr<const LanguageDefinition> LanguageDefinitionPtr;
+
+	// The built-in definitions are created once and shared; a definition is never modified
+	// after it has been handed to an editor.
 	struct LanguageDefinition
 	{
 		typedef std::pair<std::string, PaletteIndex> TokenRegexString;
@@ -173,20 +251,34 @@ public:
 		{
 		}
 
-		static const LanguageDefinition& CPlusPlus();
-		static const LanguageDefinition& HLSL();
-		static const LanguageDefinition& GLSL();
-		static const LanguageDefinition& C();
-		static const LanguageDefinition& SQL();
-		static const LanguageDefinition& AngelScript();
-		static const LanguageDefinition& Lua();
+		static const LanguageDefinitionPtr& CPlusPlus();
+		static const LanguageDefinitionPtr& HLSL();
+		static const LanguageDefinitionPtr& GLSL();
+		static const LanguageDefinitionPtr& C();
+		static const LanguageDefinitionPtr& SQL();
+		static const LanguageDefinitionPtr& AngelScript();
+		static const LanguageDefinitionPtr& Lua();
+	};
+
+	// Read-only text owned by the caller, e.g. a memory-mapped file. The visible lines are
+	// drawn straight from mData. mLineIndex holds (line, byte offset) checkpoints in increasing
+	// order starting with (0, 0); the lines in between are found by scanning forward.
+	struct TextView
+	{
+		const char* mData = nullptr;
+		size_t mSize = 0;
+		size_t mLineCount = 0;
+		std::vector<std::pair<size_t, size_t>> mLineIndex;
 	};
 
 	TextEditor();
 	~TextEditor();
 
+	// Editors given the same definition share it and its compiled tokenizer. Passing a plain
+	// LanguageDefinition makes a private copy, compiled for this editor alone.
+	void SetLanguageDefinition(const LanguageDefinitionPtr& aLanguageDef);
 	void SetLanguageDefinition(const LanguageDefinition& aLanguageDef);
-	const LanguageDefinition& GetLanguageDefinition() const { return mLanguageDefinition; }
+	const LanguageDefinition& GetLanguageDefinition() const { return *mLanguageDefinition; }
 
 	const Palette& GetPalette() const { return mPaletteBase; }
 	void SetPalette(const Palette& aValue);
@@ -195,16 +287,45 @@ public:
 	void SetBreakpoints(const Breakpoints& aMarkers) { mBreakpoints = aMarkers; }
 
 	void Render(const char* aTitle, const ImVec2& aSize = ImVec2(), bool aBorder = false);
+	// How a loaded text was stored, so it can be saved the same way
+	enum class LineBreak { None, Lf, CrLf };
+	struct TextFormat
+	{
+		bool mBom = false;						// started with a UTF-8 byte order mark, which is not put into the text
+		LineBreak mLineBreak = LineBreak::None;	// the kind of the first line break
+	};
+
 	void SetText(const std::string& aText);
+	// Loads aSize bytes at aText in bulk, e.g. straight from a file mapping. Line breaks are
+	// found with memchr, every line is allocated once at its final size, and large texts are
+	// split into lines on all cores. Both LF and CR LF line breaks are accepted; CR characters
+	// never end up in the text.
+	TextFormat SetText(const char* aText, size_t aSize);
+	// The line splitting of SetText on its own, e.g. for loading a file on a worker thread and
+	// handing the result to SetLines. Gives up early once *aCancel turns true.
+	static TextFormat BuildLines(const char* aText, size_t aSize, Lines& aLines, const std::atomic<bool>* aCancel = nullptr);
+	// Replaces the text with lines built by BuildLines. The cursor and scroll position are left
+	// alone, so a text that grows from a first part to the whole doesn't jump.
+	void SetLines(Lines&& aLines);
 	std::string GetText() const;
 
 	void SetTextLines(const std::vector<std::string>& aLines);
 	std::vector<std::string> GetTextLines() const;
 
+	// Hands the characters of each line, without the line break, to aVisit straight from the
+	// line storage, e.g. for saving without building the whole text first. Stops as soon as
+	// aVisit returns false and returns false then.
+	bool ForEachLine(const std::function<bool(const char* aData, size_t aSize)>& aVisit) const;
+
+	// Shows aView instead of the editable text until the next SetText/SetTextLines. The editor
+	// becomes read-only; the caller keeps aView.mData alive for as long as it is shown.
+	void SetTextView(TextView&& aView);
+	bool HasTextView() const { return mView.mData != nullptr; }
+
 	std::string GetSelectedText() const;
 	std::string GetCurrentLineText()const;
 
-	int GetTotalLines() const { return (int)mLines.size(); }
+	int GetTotalLines() const { return HasTextView() ? (int)mView.mLineCount : (int)mLines.size(); }
 	bool IsOverwrite() const { return mOverwrite; }
 
 	void SetReadOnly(bool aValue);
@@ -214,6 +335,12 @@ public:
 
 	bool IsColorizerEnabled() const { return mColorizerEnabled; }
 	void SetColorizerEnable(bool aValue);
+	// Colorizing moves forward a bit with every Render, so the host keeps drawing frames while
+	// this is true
+	bool IsColorizing() const;
+	// Milliseconds until the blinking cursor drawn by the last Render has to turn on or off, or
+	// -1 if it drew none
+	int GetCursorBlinkDelay() const;
 
 	Coordinates GetCursorPosition() const { return GetActualCursorCoordinates(); }
 	void SetCursorPosition(const Coordinates& aPosition);
@@ -227,12 +354,17 @@ public:
 	inline void SetImGuiChildIgnored    (bool aValue){ mIgnoreImGuiChild     = aValue;}
 	inline bool IsImGuiChildIgnored() const { return mIgnoreImGuiChild; }
 
-	inline void SetShowWhitespaces(bool aValue) { mShowWhitespaces = aValue; }
+	inline void SetShowWhitespaces(bool aValue) { if (mShowWhitespaces != aValue) mLineLayouts.clear(); mShowWhitespaces = aValue; }
 	inline bool IsShowingWhitespaces() const { return mShowWhitespaces; }
 
 	void SetTabSize(int aValue);
 	inline int GetTabSize() const { return mTabSize; }
 
+	// Breaks lines wider than the window into rows at the last whitespace that fits, instead of
+	// scrolling horizontally. Not applied to a text view.
+	void SetWordWrap(bool aValue);
+	inline bool IsWordWrapEnabled() const { return mWordWrap; }
+
 	void InsertText(const std::string& aValue);
 	void InsertText(const char* aValue);
 
@@ -266,6 +398,18 @@ public:
 	static const Palette& GetLightPalette();
 	static const Palette& GetRetroBluePalette();
 
+	// Times token colorization of aLines through std::regex and through the compiled token DFA.
+	// mMismatches counts the characters the two disagree on.
+	struct TokenizerBenchmark
+	{
+		double mRegexSeconds = 0.0;
+		double mDfaSeconds = 0.0;
+		size_t mBytes = 0;
+		size_t mMismatches = 0;
+		bool mDfaCompiled = false;
+	};
+	static TokenizerBenchmark BenchmarkTokenizer(const LanguageDefinitionPtr& aLanguageDef, const std::vector<std::string>& aLines);
+
 private:
 	typedef std::vector<std::pair<std::regex, PaletteIndex>> RegexList;
 
@@ -311,11 +455,163 @@ private:
 
 	typedef std::vector<UndoRecord> UndoBuffer;
 
+	// The token regexes of a language compiled into a single DFA over bytes. Every state records
+	// which regexes accept there, so the first regex in the list that matches still wins, as it
+	// does when they are tried one after another; each regex takes its longest match.
+	class TokenDfa
+	{
+	public:
+		bool Compile(const LanguageDefinition::TokenRegexStrings& aRegexStrings);
+		bool Match(const char* aBegin, const char* aEnd, const char*& aTokenEnd, PaletteIndex& aColor) const;
+		bool IsValid() const { return !mAccepts.empty(); }
+
+	private:
+		std::array<uint8_t, 256> mByteClass = {};	// bytes no regex tells apart share a class
+		int mClassCount = 0;
+		std::vector<uint16_t> mTransitions;		// mClassCount entries per state, state 0 is dead
+		std::vector<uint64_t> mAccepts;			// bit i set: regex i matches up to here
+		std::vector<PaletteIndex> mColors;
+	};
+
+	// Everything the colorizer thread reads besides the lines themselves. There is one per
+	// language definition, shared by all editors and jobs using it and never modified.
+	// mRegexList is only compiled when the regexes could not be turned into mTokenDfa.
+	struct ColorizerConfig
+	{
+		LanguageDefinitionPtr mLanguage;
+		RegexList mRegexList;
+		TokenDfa mTokenDfa;
+	};
+
+	// A batch of lines for the colorizer thread, copied back to back when the job is posted so
+	// the thread never touches mLines. The result is only applied if mVersion is still current.
+	struct ColorizeJob
+	{
+		TextEditor* mEditor = nullptr;
+		uint64_t mVersion = 0;
+		int mFirstLine = 0;
+		std::shared_ptr<const ColorizerConfig> mConfig;
+		std::vector<Char> mChars;
+		std::vector<uint8_t> mColors;
+		std::vector<size_t> mLineStarts;	// offset of each line in mChars, followed by the end
+	};
+
 	void ProcessInputs();
 	void Colorize(int aFromLine = 0, int aCount = -1);
-	void ColorizeRange(int aFromLine = 0, int aToLine = 0);
+	static std::shared_ptr<const ColorizerConfig> GetColorizerConfig(const LanguageDefinitionPtr& aLanguageDef);
+	static void ColorizeLine(const ColorizerConfig& aConfig, const char* aChars, uint8_t* aColors, size_t aSize);
 	void ColorizeInternal();
+	void PostColorizeJob(int aFromLine, int aToLine);
+	void ApplyColorizeJob(const ColorizeJob& aJob);
+	class ColorizerWorker;
+	static ColorizerWorker& GetColorizerWorker();
+	uint8_t ColorizeLineComments(Line& aLine, uint8_t aState);
+	// Geometry of a drawn line relative to the pixel its text starts at, replayed while the line,
+	// the palette and the font stay the same
+	struct LineLayout
+	{
+		std::vector<ImDrawVert> mVertices;
+		std::vector<ImDrawIdx> mIndices;
+		ImVec2 mOrigin;			// fraction of the position the line was laid out at
+		float mWidth = 0.0f;
+		int mMaxColumn = 0;
+		uint32_t mFrame = 0;	// last frame the line was visible in
+	};
+	static constexpr size_t kMaxLayoutLength = 2048;	// longer lines are drawn without the cache
+
+	// Longer lines keep the column and distance from the line start every kCheckpointInterval
+	// bytes instead, so drawing, hit-testing and cursor moves only walk the part they need
+	struct LineCheckpoint
+	{
+		int mIndex;
+		int mColumn;
+		float mX;
+	};
+	struct LongLine
+	{
+		std::vector<LineCheckpoint> mCheckpoints;	// the first one is at the line start
+		float mWidth = 0.0f;
+		int mMaxColumn = 0;
+		uint32_t mFrame = 0;	// last frame the line was visible in
+	};
+	static constexpr int kCheckpointInterval = 1024;
+
+	// Where a visual row of a wrapped line begins; the first row is at the line start
+	struct RowStart
+	{
+		int mIndex;
+		int mColumn;
+	};
+	struct WrappedLine
+	{
+		std::vector<RowStart> mRows;
+		uint32_t mFrame = 0;	// last frame the line was used in
+	};
+
+	// Number of visual rows of every line in word wrap mode. The counts are kept in chunks of a
+	// few hundred lines, like Lines, with Fenwick trees over the line and row totals of the
+	// chunks, so the first row of a line and the line showing a row are found in O(log chunks)
+	// plus a walk through one chunk. Changing counts or splicing lines inside a chunk only
+	// updates that chunk's totals; the trees are rebuilt from the chunk totals when chunks are
+	// split or dropped.
+	class WrapRows
+	{
+	public:
+		WrapRows() : mSize(0), mRowCount(0) {}
+
+		size_t size() const { return mSize; }
+		int operator[](size_t aLine) const { auto c = FindChunk(aLine); return mChunks[c][aLine]; }
+
+		void clear();
+		void resize(size_t aSize);				// every line has one row
+		void set(size_t aLine, int aRows);
+		void assign(size_t aStart, const std::vector<int>& aRows);
+		void insert(size_t aIndex, size_t aCount);
+		void erase(size_t aStart, size_t aEnd);
+
+		int GetFirstRow(size_t aLine) const;	// rows of the lines in front of aLine
+		int GetRowCount() const { return mRowCount; }
+		size_t FindLine(int aRow) const;		// the last line for rows past the end
+
+	private:
+		static const size_t kChunkSize = 512;
+
+		size_t FindChunk(size_t& aLine) const;	// makes aLine relative to the chunk
+		void AddToChunk(size_t aChunk, int aLines, int aRows);
+		void BuildTrees();
+
+		std::vector<std::vector<int>> mChunks;
+		std::vector<int> mChunkRows;	// rows of every chunk
+		std::vector<int> mLineTree;		// mLineTree[i] sums the lines of the chunks [i - (i & -i), i)
+		std::vector<int> mRowTree;		// the same for their rows
+		size_t mSize;
+		int mRowCount;
+	};
+
+	float LayoutLine(const Line& aLine, ImDrawList* aDrawList, const ImVec2& aPosition, int aStart = 0, int aEnd = INT_MAX, float aStartX = 0.0f, float aEndX = FLT_MAX);
+	const LineLayout* GetLineLayout(int aLineNo, const ImVec2& aPosition, const ImDrawList* aDrawList);
+	const LongLine* GetLongLine(int aLineNo);
+	const LongLine* FindLongLine(const Line& aLine) const;
+	template <typename T>
+	static const LineCheckpoint& FindCheckpoint(const LongLine& aLongLine, T LineCheckpoint::* aMember, T aValue);
+	void DrawLineLayout(const LineLayout& aLayout, ImDrawList* aDrawList, const ImVec2& aPosition) const;
+	void AssignLineVersion(Line& aLine);
+	bool IsWrapping() const { return mWordWrap && mWrapWidth > 0.0f && !HasTextView(); }
+	int WrapLine(const Line& aLine, std::vector<RowStart>* aRows) const;
+	void UpdateWrap();
+	void InvalidateWrap(int aFromLine = 0, int aToLine = INT_MAX);
+	void ShiftWrapRows(int aIndex, int aCount);
+	const std::vector<RowStart>& GetWrappedLine(int aLineNo);
+	const std::vector<RowStart>* FindWrappedLine(const Line& aLine) const;
+	static int FindRow(const std::vector<RowStart>& aRows, int aColumn);
+	float TextDistanceToRowStart(const Line& aLine, const RowStart& aRow, int aIndex) const;
+	Coordinates TextPosToCoordinates(int aLineNo, int aRow, float aX) const;
+	Coordinates MoveByRows(const Coordinates& aFrom, int aRows);
 	float TextDistanceToLineStart(const Coordinates& aFrom) const;
+	void UpdateFontMetrics();
+	float GlyphAdvance(ImWchar aChar) const { return mMetricsFont->GetCharAdvance(aChar) * mGlyphScale; }
+	float TextWidth(const char* aBegin, const char* aEnd) const;
+	float NextTabStop(float aX) const;
 	void EnsureCursorVisible();
 	int GetPageSize() const;
 	std::string GetText(const Coordinates& aStart, const Coordinates& aEnd) const;
@@ -337,19 +633,26 @@ private:
 	void RemoveLine(int aStart, int aEnd);
 	void RemoveLine(int aIndex);
 	Line& InsertLine(int aIndex);
+	void InsertLines(int aIndex, std::vector<Line>&& aLines);
+	void ShiftColorizeRanges(int aIndex, int aCount);
 	void EnterCharacter(ImWchar aChar, bool aShift);
 	void Backspace();
 	void DeleteSelection();
 	std::string GetWordUnderCursor() const;
 	std::string GetWordAt(const Coordinates& aCoords) const;
-	ImU32 GetGlyphColor(const Glyph& aGlyph) const;
+	ImU32 GetGlyphColor(uint8_t aColor) const;
 
 	void HandleKeyboardInputs();
 	void HandleMouseInputs();
 	void Render();
+	void RenderTextView();
+	const char* GetTextViewLine(size_t aLine) const;
 
 	float mLineSpacing;
 	Lines mLines;
+	TextView mView;
+	float mViewLongest;
+
 	EditorState mState;
 	UndoBuffer mUndoBuffer;
 	int mUndoIndex;
@@ -374,16 +677,53 @@ private:
 
 	Palette mPaletteBase;
 	Palette mPalette;
-	LanguageDefinition mLanguageDefinition;
-	RegexList mRegexList;
+	LanguageDefinitionPtr mLanguageDefinition;
+
+	std::shared_ptr<const ColorizerConfig> mColorizerConfig;
+
+	int mCommentRangeMin, mCommentRangeMax;
+
+	// Background colorization, on a thread shared by all editors. mColorizeVersion changes with
+	// every edit and invalidates the job in flight; the visible lines that were colorized for a
+	// version are remembered so they are not posted again while the rest of the file is swept.
+	std::atomic<uint64_t> mColorizeVersion;
+	bool mColorizeJobInFlight;
+	bool mColorizeJobVisible;
+	int mVisibleLineMin, mVisibleLineMax;
+	uint64_t mVisibleColorizedVersion;
+	int mVisibleColorizedMin, mVisibleColorizedMax;
+	std::unique_ptr<ColorizeJob> mFinishedJob;	// handed back by the colorizer thread, guarded by its mutex
 
-	bool mCheckComments;
 	Breakpoints mBreakpoints;
 	ErrorMarkers mErrorMarkers;
 	ImVec2 mCharAdvance;
+	// Advances of the font Render measures with, refreshed when the font or its size changes
+	ImFont* mMetricsFont;
+	float mMetricsFontSize;
+	float mGlyphScale;
+	float mSpaceAdvance;
+	bool mMonospace;	// every glyph advances by mCharAdvance.x, so columns convert straight to pixels
+	float mMaxAdvance;	// of the widest glyph, so most lines are known to fit a row without measuring
+
+	// Layouts of the visible lines by Line::mVersion
+	std::unordered_map<uint32_t, LineLayout> mLineLayouts;
+	std::unordered_map<uint32_t, LongLine> mLongLines;
+	std::unique_ptr<ImDrawList> mLayoutDrawList;
+	uint32_t mLayoutVersion;
+	uint32_t mLayoutFrame;
+	ImTextureID mLayoutTexture;
+
+	// Word wrap. mWrapRows holds the row counts for mWrapWidth except for the lines from
+	// mWrapRangeMin to mWrapRangeMax, which changed and are counted again before the next use.
+	bool mWordWrap;
+	float mWrapWidth;	// zero until Render has measured the window
+	WrapRows mWrapRows;
+	int mWrapRangeMin, mWrapRangeMax;
+	std::unordered_map<uint32_t, WrappedLine> mWrappedLines;	// row starts by Line::mVersion
 	Coordinates mInteractiveStart, mInteractiveEnd;
 	std::string mLineBuffer;
 	uint64_t mStartTime;
+	bool mCursorBlinking;
 
 	float mLastClick;
 };
@@ -0,0 +1,195 @@
+﻿// MappedFile.cpp
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Record the offset of every kIndexStride-th line; the rest are found by scanning from there.
+constexpr size_t kIndexStride = 256;
+// Ranges smaller than this are not worth a thread of their own.
+constexpr size_t kMinRangeSize = 16u << 20;
+// Pages are evicted again after each block of this size has been scanned.
+constexpr size_t kScanBlockSize = 32u << 20;
+
+struct ScanRange {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t newlines = 0;
+    // (newlines seen in this range so far, offset of the line that follows)
+    std::vector<std::pair<size_t, size_t>> marks;
+};
+
+void Scan(const MappedFile& file, ScanRange& range) {
+    const char* data = file.Data();
+    for (size_t block = range.begin; block < range.end; block += kScanBlockSize) {
+        const char* p = data + block;
+        const char* last = data + std::min(block + kScanBlockSize, range.end);
+
+        // memchr is vectorized by every C runtime we build with, so this runs at memory speed
+        while (const char* eol = static_cast<const char*>(memchr(p, '\n', last - p))) {
+            if (++range.newlines % kIndexStride == 0)
+                range.marks.emplace_back(range.newlines, eol + 1 - data);
+            p = eol + 1;
+        }
+
+        file.Evict(block, last - (data + block));
+    }
+}
+
+} // namespace
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mFile = file;
+    mMapping = mapping;
+    mData = static_cast<const char*>(data);
+    mSize = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mData)
+        UnmapViewOfFile(mData);
+    if (mMapping)
+        CloseHandle(mMapping);
+    if (mFile)
+        CloseHandle(mFile);
+    mData = nullptr;
+    mSize = 0;
+    mMapping = nullptr;
+    mFile = nullptr;
+}
+
+void MappedFile::Evict(size_t offset, size_t length) const {
+    // Unlocking pages that were never locked removes them from the working set
+    if (mData && length > 0)
+        VirtualUnlock(const_cast<char*>(mData) + offset, length);
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    mFd = fd;
+    mData = static_cast<const char*>(data);
+    mSize = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mData)
+        munmap(const_cast<char*>(mData), mSize);
+    if (mFd >= 0)
+        close(mFd);
+    mData = nullptr;
+    mSize = 0;
+    mFd = -1;
+}
+
+void MappedFile::Evict(size_t offset, size_t length) const {
+    if (!mData || length == 0)
+        return;
+
+    // madvise wants a page aligned address; the mapping itself starts on a page boundary
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t begin = offset / page * page;
+    madvise(const_cast<char*>(mData) + begin, offset + length - begin, MADV_DONTNEED);
+}
+
+#endif
+
+TextEditor::TextView BuildTextView(const MappedFile& file) {
+    TextEditor::TextView view;
+    view.mData = file.Data();
+    view.mSize = file.Size();
+    view.mLineIndex.emplace_back(0, 0);
+
+    // Split the file into one range per core and count the line breaks of each in parallel
+    size_t rangeCount = std::max(1u, std::thread::hardware_concurrency());
+    rangeCount = std::max<size_t>(1, std::min(rangeCount, file.Size() / kMinRangeSize));
+
+    std::vector<ScanRange> ranges(rangeCount);
+    for (size_t i = 0; i < rangeCount; ++i) {
+        ranges[i].begin = file.Size() * i / rangeCount;
+        ranges[i].end = file.Size() * (i + 1) / rangeCount;
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < rangeCount; ++i)
+        workers.emplace_back(Scan, std::cref(file), std::ref(ranges[i]));
+    Scan(file, ranges[0]);
+    for (auto& worker : workers)
+        worker.join();
+
+    // Line numbers in each range are relative to its start; rebase them onto the lines before it
+    size_t lines = 0;
+    for (const auto& range : ranges) {
+        for (const auto& [line, offset] : range.marks)
+            view.mLineIndex.emplace_back(lines + line, offset);
+        lines += range.newlines;
+    }
+    view.mLineCount = lines + 1;
+
+    return view;
+}
@@ -0,0 +1,46 @@
+﻿// MappedFile.h
+#pragma once
+#include "ImGui/TextEditor.h"
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. Pages are only brought in when they are touched,
+// so even multi-gigabyte files open without copying them into the process.
+//
+// The mapping is shared with the file on disk. Windows refuses to truncate a file while it is
+// mapped, but elsewhere another process may cut it short at any time, and touching a page past
+// the new end then raises SIGBUS. Only map files that are too large to read; anything that
+// is read in full or may be rewritten while it is read goes through plain reads instead.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+
+    bool IsOpen() const { return mData != nullptr; }
+    const char* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+
+    // Drops the given range from the process working set. The pages stay in the OS file cache
+    // and are faulted back in transparently the next time they are read.
+    void Evict(size_t offset, size_t length) const;
+
+private:
+    const char* mData = nullptr;
+    size_t mSize = 0;
+#ifdef _WIN32
+    void* mFile = nullptr;
+    void* mMapping = nullptr;
+#else
+    int mFd = -1;
+#endif
+};
+
+// Scans the mapping for line breaks on all cores and returns a read-only view of it for
+// TextEditor::SetTextView. Only every few hundredth line start is recorded, and the pages are
+// evicted again as soon as they have been scanned, so the index stays small.
+TextEditor::TextView BuildTextView(const MappedFile& file);
@@ -0,0 +1,276 @@
+﻿// ProcessRunner.cpp
+#include "ProcessRunner.h"
+#include "FrameScheduler.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+ProcessRunner::~ProcessRunner() {
+    Cancel();
+    if (mThread.joinable())
+        mThread.join();
+}
+
+bool ProcessRunner::IsRunning() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRunning;
+}
+
+void ProcessRunner::TakeLines(std::vector<std::string>& lines) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& line : mLines)
+        lines.push_back(std::move(line));
+    mLines.clear();
+}
+
+int ProcessRunner::GetExitCode() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mExitCode;
+}
+
+bool ProcessRunner::WasCancelled() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCancelled;
+}
+
+double ProcessRunner::GetElapsedSeconds() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto end = mRunning ? std::chrono::steady_clock::now() : mEndTime;
+    return std::chrono::duration<double>(end - mStartTime).count();
+}
+
+void ProcessRunner::Reset() {
+    if (mThread.joinable())
+        mThread.join();
+
+    mLines.clear();
+    mPartialLine.clear();
+    mCancelled = false;
+    mExitCode = -1;
+    mStartTime = std::chrono::steady_clock::now();
+}
+
+void ProcessRunner::Finish(int exitCode) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mPartialLine.empty())
+        mLines.push_back(std::move(mPartialLine));
+    mPartialLine.clear();
+    mExitCode = exitCode;
+    mEndTime = std::chrono::steady_clock::now();
+    mRunning = false;
+    FrameScheduler::Wake();
+}
+
+// Splits what the pipe delivers into lines, dropping the '\r' of CRLF line breaks. Runs on
+// mThread until the write end of the pipe is closed by the process and all its children.
+void ProcessRunner::ReadOutput() {
+    char buffer[4096];
+    for (;;) {
+#ifdef _WIN32
+        DWORD count = 0;
+        if (!ReadFile(mReadPipe, buffer, sizeof(buffer), &count, nullptr) || count == 0)
+            break;
+#else
+        ssize_t count = read(mReadFd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+#endif
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        const char* p = buffer;
+        const char* end = buffer + count;
+        while (const char* eol = static_cast<const char*>(memchr(p, '\n', end - p))) {
+            mPartialLine.append(p, eol);
+            if (!mPartialLine.empty() && mPartialLine.back() == '\r')
+                mPartialLine.pop_back();
+            mLines.push_back(std::move(mPartialLine));
+            mPartialLine.clear();
+            p = eol + 1;
+        }
+        mPartialLine.append(p, end);
+        FrameScheduler::Wake();
+    }
+}
+
+#ifdef _WIN32
+
+bool ProcessRunner::Start(const std::string& command, const std::string& workingDir) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mRunning)
+        return false;
+    Reset();
+
+    SECURITY_ATTRIBUTES inherit = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    HANDLE readPipe = nullptr;
+    HANDLE writePipe = nullptr;
+    if (!CreatePipe(&readPipe, &writePipe, &inherit, 0))
+        return false;
+    SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+    HANDLE input = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &inherit, OPEN_EXISTING, 0, nullptr);
+
+    // Everything the build starts is put into a job object so Cancel can kill the whole tree
+    HANDLE job = CreateJobObjectA(nullptr, nullptr);
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+    limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    if (job)
+        SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = input;
+    startup.hStdOutput = writePipe;
+    startup.hStdError = writePipe;
+
+    std::string commandLine = "cmd.exe /S /C \"" + command + "\"";
+    PROCESS_INFORMATION process = {};
+    const BOOL created = CreateProcessA(nullptr, commandLine.data(), nullptr, nullptr, TRUE,
+        CREATE_NO_WINDOW | CREATE_SUSPENDED, nullptr, workingDir.empty() ? nullptr : workingDir.c_str(),
+        &startup, &process);
+
+    // The child has its own copies now; ReadFile only reports the end once all of them are closed
+    CloseHandle(writePipe);
+    if (input != INVALID_HANDLE_VALUE)
+        CloseHandle(input);
+
+    if (!created) {
+        CloseHandle(readPipe);
+        if (job)
+            CloseHandle(job);
+        return false;
+    }
+
+    if (job)
+        AssignProcessToJobObject(job, process.hProcess);
+    ResumeThread(process.hThread);
+    CloseHandle(process.hThread);
+
+    mProcess = process.hProcess;
+    mJob = job;
+    mReadPipe = readPipe;
+    mRunning = true;
+    mThread = std::thread([this]() {
+        ReadOutput();
+
+        DWORD exitCode = static_cast<DWORD>(-1);
+        WaitForSingleObject(mProcess, INFINITE);
+        GetExitCodeProcess(mProcess, &exitCode);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            CloseHandle(mProcess);
+            CloseHandle(mReadPipe);
+            if (mJob)
+                CloseHandle(mJob);
+            mProcess = nullptr;
+            mReadPipe = nullptr;
+            mJob = nullptr;
+        }
+        Finish(static_cast<int>(exitCode));
+    });
+    return true;
+}
+
+void ProcessRunner::Cancel() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mRunning || mCancelled)
+        return;
+
+    mCancelled = true;
+    if (mJob)
+        TerminateJobObject(mJob, 1);
+    else if (mProcess)
+        TerminateProcess(mProcess, 1);
+}
+
+#else
+
+bool ProcessRunner::Start(const std::string& command, const std::string& workingDir) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mRunning)
+        return false;
+    Reset();
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+    // Only async-signal-safe calls between fork and exec; other threads may hold locks
+    const char* shellCommand = command.c_str();
+    const char* dir = workingDir.empty() ? nullptr : workingDir.c_str();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Own process group, so Cancel reaches the compilers the build spawns as well
+        setpgid(0, 0);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        int null = open("/dev/null", O_RDONLY);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+        if (dir && chdir(dir) != 0)
+            _exit(127);
+        execl("/bin/sh", "sh", "-c", shellCommand, static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    setpgid(pid, pid);
+    close(fds[1]);
+
+    mPid = pid;
+    mReadFd = fds[0];
+    mRunning = true;
+    mThread = std::thread([this]() {
+        ReadOutput();
+
+        int status = 0;
+        pid_t result;
+        do {
+            result = waitpid(mPid, &status, 0);
+        } while (result < 0 && errno == EINTR);
+
+        int exitCode = -1;
+        if (result == mPid && WIFEXITED(status))
+            exitCode = WEXITSTATUS(status);
+        else if (result == mPid && WIFSIGNALED(status))
+            exitCode = 128 + WTERMSIG(status);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            close(mReadFd);
+            mReadFd = -1;
+            mPid = 0;
+        }
+        Finish(exitCode);
+    });
+    return true;
+}
+
+void ProcessRunner::Cancel() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mRunning || mCancelled || mPid <= 0)
+        return;
+
+    mCancelled = true;
+    kill(-mPid, SIGTERM);
+}
+
+#endif
@@ -0,0 +1,62 @@
+﻿// ProcessRunner.h
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs a shell command in a child process with stdout and stderr merged into one pipe. A
+// background thread reads the pipe and splits it into lines, which the UI thread picks up with
+// TakeLines whenever it likes, so a long build never blocks a frame.
+class ProcessRunner {
+public:
+    ProcessRunner() = default;
+    ~ProcessRunner();
+    ProcessRunner(const ProcessRunner&) = delete;
+    ProcessRunner& operator=(const ProcessRunner&) = delete;
+
+    // Starts command through the platform shell (sh -c / cmd /c) in workingDir. Fails if a
+    // process is still running or could not be started.
+    bool Start(const std::string& command, const std::string& workingDir);
+
+    // Kills the process and everything it started. The runner still finishes normally: the
+    // remaining output is delivered and IsRunning turns false.
+    void Cancel();
+
+    // True from Start until the output has been read to the end and the process has exited
+    bool IsRunning() const;
+
+    // Appends the complete lines received since the last call, without their line breaks. Once
+    // IsRunning has returned false this also delivers the unterminated last line.
+    void TakeLines(std::vector<std::string>& lines);
+
+    // Valid once IsRunning is false. The exit code is 128 + signal number when the process was
+    // killed by a signal, and -1 when it could not be waited for.
+    int GetExitCode() const;
+    bool WasCancelled() const;
+    double GetElapsedSeconds() const;
+
+private:
+    void ReadOutput();
+    void Finish(int exitCode);
+    void Reset();
+
+    mutable std::mutex mMutex;
+    std::thread mThread;
+    std::vector<std::string> mLines;
+    std::string mPartialLine;
+    bool mRunning = false;
+    bool mCancelled = false;
+    int mExitCode = -1;
+    std::chrono::steady_clock::time_point mStartTime;
+    std::chrono::steady_clock::time_point mEndTime;
+#ifdef _WIN32
+    void* mProcess = nullptr;
+    void* mJob = nullptr;
+    void* mReadPipe = nullptr;
+#else
+    int mPid = 0;
+    int mReadFd = -1;
+#endif
+};
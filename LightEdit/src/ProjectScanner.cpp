@@ -0,0 +1,171 @@
+﻿// ProjectScanner.cpp
+#include "ProjectScanner.h"
+#include "FrameScheduler.h"
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Lists one directory. Errors on single entries skip just that entry; an error on the directory
+// itself leaves it empty and is returned as a message.
+std::string ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& subdirectories) {
+    std::error_code ec;
+    fs::directory_iterator it(path, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        std::error_code entryEc;
+
+        // Linked directories are not followed, a link back up the tree would never end
+        if (entry.is_directory(entryEc) && !entry.is_symlink(entryEc)) {
+            subdirectories.push_back(entry.path().string());
+        }
+        else if (entry.is_regular_file(entryEc) && ProjectScanner::IsProjectFile(entry.path().string())) {
+            files.push_back(entry.path().string());
+        }
+    }
+    return ec ? "Skipped " + path + ": " + ec.message() : std::string();
+}
+
+} // namespace
+
+bool ProjectScanner::IsProjectFile(const std::string& path) {
+    const std::string ext = fs::path(path).extension().string();
+    return ext == ".cpp" || ext == ".h" || ext == ".hpp" || ext == ".c" || ext == ".txt" || ext == ".md" || ext == ".cmake";
+}
+
+ProjectScanner::~ProjectScanner() {
+    Cancel();
+    Join();
+}
+
+void ProjectScanner::Start(const std::string& root) {
+    Cancel();
+    Join();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mQueue.clear();
+    mQueue.push_back({ 0, 0, root });
+    mResults.clear();
+    mErrors.clear();
+    mNextId = 1;
+    mActiveTasks = 0;
+    mDirectoryCount = 0;
+    mFileCount = 0;
+    mCancelled = false;
+    mStartTime = std::chrono::steady_clock::now();
+
+    // Listing directories mostly waits on the file system, so this pays off even on few cores
+    const unsigned workerCount = std::clamp(std::thread::hardware_concurrency(), 2u, 8u);
+    mRunningWorkers = workerCount;
+    for (unsigned i = 0; i < workerCount; ++i)
+        mWorkers.emplace_back(&ProjectScanner::Work, this);
+}
+
+void ProjectScanner::Cancel() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mRunningWorkers == 0)
+        return;
+    mCancelled = true;
+    mQueue.clear();
+    mWake.notify_all();
+}
+
+void ProjectScanner::Join() {
+    for (auto& worker : mWorkers)
+        worker.join();
+    mWorkers.clear();
+}
+
+bool ProjectScanner::IsRunning() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRunningWorkers > 0;
+}
+
+bool ProjectScanner::WasCancelled() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCancelled;
+}
+
+void ProjectScanner::TakeResults(std::vector<Directory>& results) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& result : mResults)
+        results.push_back(std::move(result));
+    mResults.clear();
+}
+
+void ProjectScanner::TakeErrors(std::vector<std::string>& errors) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& error : mErrors)
+        errors.push_back(std::move(error));
+    mErrors.clear();
+}
+
+size_t ProjectScanner::GetDirectoryCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDirectoryCount;
+}
+
+size_t ProjectScanner::GetFileCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFileCount;
+}
+
+size_t ProjectScanner::GetPendingCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueue.size() + mActiveTasks;
+}
+
+double ProjectScanner::GetElapsedSeconds() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto end = mRunningWorkers > 0 ? std::chrono::steady_clock::now() : mEndTime;
+    return std::chrono::duration<double>(end - mStartTime).count();
+}
+
+void ProjectScanner::Work() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+        // Idle workers wait for subdirectories found by the busy ones; the scan is over once
+        // nothing is queued and nobody is listing a directory anymore
+        mWake.wait(lock, [this] { return mCancelled || !mQueue.empty() || mActiveTasks == 0; });
+        if (mCancelled || mQueue.empty())
+            break;
+
+        // Breadth first, so the top of the tree fills in before the deep parts
+        Task task = std::move(mQueue.front());
+        mQueue.pop_front();
+        ++mActiveTasks;
+        lock.unlock();
+
+        Directory directory;
+        directory.id = task.id;
+        directory.parentId = task.parentId;
+        directory.name = fs::path(task.path).filename().string();
+        directory.fullPath = std::move(task.path);
+        std::vector<std::string> subdirectories;
+        std::string error = ListDirectory(directory.fullPath, directory.files, subdirectories);
+
+        lock.lock();
+        --mActiveTasks;
+        if (!mCancelled) {
+            if (!error.empty())
+                mErrors.push_back(std::move(error));
+            ++mDirectoryCount;
+            mFileCount += directory.files.size();
+
+            // Delivered before its subdirectories are queued, so parents always come first
+            for (auto& path : subdirectories)
+                mQueue.push_back({ mNextId++, directory.id, std::move(path) });
+            mResults.push_back(std::move(directory));
+            FrameScheduler::Wake();
+        }
+        mWake.notify_all();
+    }
+
+    if (--mRunningWorkers == 0) {
+        mEndTime = std::chrono::steady_clock::now();
+        FrameScheduler::Wake();
+    }
+    mWake.notify_all();
+}
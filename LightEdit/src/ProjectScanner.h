@@ -0,0 +1,80 @@
+﻿// ProjectScanner.h
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Lists a project directory tree on a pool of worker threads, one task per directory. Each
+// directory is delivered as soon as it has been listed, so the UI thread can pick up what has
+// been found so far with TakeResults every frame and fill in its tree progressively.
+class ProjectScanner {
+public:
+    // One listed directory. Ids are assigned in the order directories are discovered; the root
+    // has id 0, and a directory is always delivered after its parent.
+    struct Directory {
+        size_t id = 0;
+        size_t parentId = 0;
+        std::string name;
+        std::string fullPath;
+        std::vector<std::string> files; // full paths of the source files directly inside it
+    };
+
+    ProjectScanner() = default;
+    ~ProjectScanner();
+    ProjectScanner(const ProjectScanner&) = delete;
+    ProjectScanner& operator=(const ProjectScanner&) = delete;
+
+    // Starts scanning root, cancelling a scan still in progress
+    void Start(const std::string& root);
+
+    // Stops handing out directories. Directories being listed are finished but not delivered.
+    void Cancel();
+
+    // True from Start until every worker has stopped
+    bool IsRunning() const;
+    bool WasCancelled() const;
+
+    // Appends the directories listed since the last call
+    void TakeResults(std::vector<Directory>& results);
+
+    // Appends a message for each directory that could not be read since the last call. Those
+    // directories are delivered without files instead of stopping the scan.
+    void TakeErrors(std::vector<std::string>& errors);
+
+    // Whether path is a file the project tree lists, by its extension
+    static bool IsProjectFile(const std::string& path);
+
+    size_t GetDirectoryCount() const; // listed so far
+    size_t GetFileCount() const;      // found so far
+    size_t GetPendingCount() const;   // discovered but not listed yet
+    double GetElapsedSeconds() const;
+
+private:
+    struct Task {
+        size_t id;
+        size_t parentId;
+        std::string path;
+    };
+
+    void Work();
+    void Join();
+
+    mutable std::mutex mMutex;
+    std::condition_variable mWake;
+    std::vector<std::thread> mWorkers;
+    std::deque<Task> mQueue;
+    std::vector<Directory> mResults;
+    std::vector<std::string> mErrors;
+    size_t mNextId = 0;
+    size_t mActiveTasks = 0;
+    size_t mRunningWorkers = 0;
+    size_t mDirectoryCount = 0;
+    size_t mFileCount = 0;
+    bool mCancelled = false;
+    std::chrono::steady_clock::time_point mStartTime;
+    std::chrono::steady_clock::time_point mEndTime;
+};
@@ -0,0 +1,704 @@
+﻿// TrigramIndex.cpp
+#include "TrigramIndex.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// The overlay is merged into a new index file once this many files changed
+constexpr size_t kMaxOverlayFiles = 1000;
+// Files with a NUL byte this close to the start are binary and get no trigrams, the same as
+// FileSearch skips them
+constexpr size_t kBinaryProbeLength = 8000;
+// Files are indexed in chunks of this many, each chunk spread over all cores
+constexpr size_t kChunkSize = 256;
+// Rebuilds scheduled in a row after the new index file couldn't be swapped in, before giving up
+constexpr int kMaxRebuilds = 3;
+
+constexpr char kMagic[8] = { 'L', 'E', 'T', 'R', 'I', 'G', '0', '1' };
+
+// File layout: Header, then the relative paths back to back, a FileRecord per file sorted by
+// path, a TrigramRecord per trigram sorted by trigram, and the posting lists. A posting list
+// holds the ids (FileRecord indices) of the files containing the trigram, ascending, each as a
+// varint of the difference to the previous one.
+struct Header {
+    char magic[8];
+    uint32_t fileCount;
+    uint32_t trigramCount;
+    uint64_t pathsOffset;
+    uint64_t pathsSize;
+    uint64_t filesOffset;
+    uint64_t trigramsOffset;
+    uint64_t postingsOffset;
+    uint64_t postingsSize;
+};
+
+struct FileRecord {
+    uint64_t pathOffset;
+    uint32_t pathLength;
+    uint32_t reserved;
+    int64_t writeTime;
+    uint64_t size;
+};
+
+struct TrigramRecord {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset; // into the postings
+};
+
+// A posting list being written
+struct PostingList {
+    std::vector<uint8_t> bytes;
+    uint32_t count = 0;
+    uint32_t last = 0;
+
+    void Add(uint32_t id) {
+        uint32_t delta = count == 0 ? id : id - last;
+        while (delta >= 0x80) {
+            bytes.push_back(static_cast<uint8_t>(delta | 0x80));
+            delta >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(delta));
+        last = id;
+        ++count;
+    }
+};
+
+// A file to be written into the index
+struct FileInfo {
+    std::string relativePath;
+    int64_t writeTime = 0;
+    uint64_t size = 0;
+};
+
+uint8_t ToLower(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<uint8_t>(c - 'A' + 'a') : c;
+}
+
+// Sorted, unique, lower-cased trigrams of text. Trigrams spanning a line break are left out,
+// searches never cross lines.
+void ExtractTrigrams(const char* data, size_t size, std::vector<uint32_t>& trigrams) {
+    trigrams.clear();
+    if (memchr(data, '\0', std::min(size, kBinaryProbeLength)) != nullptr)
+        return;
+
+    uint32_t trigram = 0;
+    int length = 0;
+    for (size_t i = 0; i < size; ++i) {
+        const uint8_t c = ToLower(static_cast<uint8_t>(data[i]));
+        if (c == '\n' || c == '\r') {
+            length = 0;
+            continue;
+        }
+        trigram = ((trigram << 8) | c) & 0xFFFFFF;
+        if (++length >= 3)
+            trigrams.push_back(trigram);
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+}
+
+bool StatFile(const std::string& path, int64_t& writeTime, uint64_t& size) {
+    std::error_code ec;
+    const auto time = fs::last_write_time(path, ec);
+    if (ec)
+        return false;
+    size = fs::file_size(path, ec);
+    if (ec)
+        return false;
+    writeTime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+// Returns false if the file is gone. The file is read rather than mapped: it is indexed right
+// after being written, and a mapping would fault if it is cut short meanwhile.
+bool IndexFile(const std::string& path, std::vector<uint32_t>& trigrams, int64_t& writeTime, uint64_t& size) {
+    trigrams.clear();
+    if (!StatFile(path, writeTime, size))
+        return false;
+    std::ifstream in(path, std::ios::binary);
+    std::string text(static_cast<size_t>(size), '\0');
+    in.read(text.data(), text.size());
+    ExtractTrigrams(text.data(), static_cast<size_t>(in.gcount()), trigrams);
+    return true;
+}
+
+// Runs index(i) for every i below count on all cores
+template <typename Function>
+void ParallelFor(size_t count, Function index) {
+    const size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            for (size_t i = t; i < count; i += threadCount)
+                index(i);
+        });
+    }
+    for (size_t i = 0; i < count; i += std::max<size_t>(1, threadCount))
+        index(i);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// Writes an index file. It is written next to the real one and swapped in by ReplaceIndex.
+bool WriteIndex(const std::string& path, const std::vector<FileInfo>& files, const std::vector<std::pair<uint32_t, PostingList>>& postings) {
+    Header header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.fileCount = static_cast<uint32_t>(files.size());
+    header.trigramCount = static_cast<uint32_t>(postings.size());
+
+    std::string paths;
+    std::vector<FileRecord> fileRecords;
+    fileRecords.reserve(files.size());
+    for (const auto& file : files) {
+        fileRecords.push_back({ paths.size(), static_cast<uint32_t>(file.relativePath.size()), 0, file.writeTime, file.size });
+        paths += file.relativePath;
+    }
+    paths.resize((paths.size() + 7) & ~size_t(7)); // keeps the records behind it aligned
+
+    std::vector<TrigramRecord> trigramRecords;
+    trigramRecords.reserve(postings.size());
+    uint64_t postingsSize = 0;
+    for (const auto& [trigram, list] : postings) {
+        trigramRecords.push_back({ trigram, list.count, postingsSize });
+        postingsSize += list.bytes.size();
+    }
+
+    header.pathsOffset = sizeof(Header);
+    header.pathsSize = paths.size();
+    header.filesOffset = header.pathsOffset + header.pathsSize;
+    header.trigramsOffset = header.filesOffset + fileRecords.size() * sizeof(FileRecord);
+    header.postingsOffset = header.trigramsOffset + trigramRecords.size() * sizeof(TrigramRecord);
+    header.postingsSize = postingsSize;
+
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(paths.data(), paths.size());
+    out.write(reinterpret_cast<const char*>(fileRecords.data()), fileRecords.size() * sizeof(FileRecord));
+    out.write(reinterpret_cast<const char*>(trigramRecords.data()), trigramRecords.size() * sizeof(TrigramRecord));
+    for (const auto& [trigram, list] : postings)
+        out.write(reinterpret_cast<const char*>(list.bytes.data()), list.bytes.size());
+    out.close();
+    return !out.fail();
+}
+
+} // namespace
+
+TrigramIndex::~TrigramIndex() {
+    Close();
+}
+
+void TrigramIndex::Open(const std::string& indexPath, const std::string& root, std::vector<std::string> files) {
+    Close();
+
+    mIndexPath = indexPath;
+    mRoot = root;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = false;
+        mOpenPending = true;
+        mBusy = true;
+        mOpenFiles = std::move(files);
+        mRebuilds = 0;
+    }
+    mThread = std::thread(&TrigramIndex::Run, this);
+}
+
+void TrigramIndex::Close() {
+    if (mThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_all();
+        mThread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mReady = false;
+    mBusy = false;
+    mOpenPending = false;
+    mOpenFiles.clear();
+    mRebuilds = 0;
+    mPendingUpdates.clear();
+    mBase.Close();
+    mBaseFileCount = 0;
+    mBaseTrigramCount = 0;
+    mStale.clear();
+    mOverlay.clear();
+}
+
+void TrigramIndex::Update(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mThread.joinable())
+            return;
+        mPendingUpdates.insert(path);
+        mBusy = true;
+    }
+    mWake.notify_all();
+}
+
+bool TrigramIndex::IsReady() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReady;
+}
+
+bool TrigramIndex::IsBusy() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBusy;
+}
+
+size_t TrigramIndex::GetFileCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBaseFileCount - std::count(mStale.begin(), mStale.end(), true) + mOverlay.size();
+}
+
+std::string TrigramIndex::RelativePath(const std::string& path) const {
+    std::string relative = fs::path(path).lexically_relative(mRoot).generic_string();
+    return relative.empty() || relative.compare(0, 2, "..") == 0 ? std::string() : relative;
+}
+
+// With native separators, the same as ProjectScanner lists the files
+std::string TrigramIndex::FullPath(std::string_view relativePath) const {
+    return (fs::path(mRoot) / fs::path(relativePath).make_preferred()).string();
+}
+
+void TrigramIndex::Run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+        mWake.wait(lock, [this] { return mStopping || mOpenPending || !mPendingUpdates.empty(); });
+        if (mStopping)
+            break;
+
+        if (mOpenPending) {
+            std::vector<std::string> files = std::move(mOpenFiles);
+            mOpenPending = false;
+            lock.unlock();
+            Load(std::move(files));
+            lock.lock();
+        }
+        else {
+            const std::set<std::string> paths = std::move(mPendingUpdates);
+            mPendingUpdates.clear();
+            lock.unlock();
+            ApplyUpdates(paths);
+            lock.lock();
+            if (mOverlay.size() >= kMaxOverlayFiles) {
+                lock.unlock();
+                Merge();
+                lock.lock();
+            }
+        }
+        mBusy = mOpenPending || !mPendingUpdates.empty();
+    }
+}
+
+// Maps the index file and checks that everything it points to lies inside it. Called with the
+// lock held.
+bool TrigramIndex::MapIndex() {
+    mBase.Close();
+    mBaseFileCount = 0;
+    mBaseTrigramCount = 0;
+    if (!mBase.Open(mIndexPath) || mBase.Size() < sizeof(Header))
+        return false;
+
+    const Header& header = *reinterpret_cast<const Header*>(mBase.Data());
+    const uint64_t size = mBase.Size();
+    const bool valid = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+        && header.pathsOffset == sizeof(Header)
+        && header.filesOffset == header.pathsOffset + header.pathsSize
+        && header.trigramsOffset == header.filesOffset + uint64_t(header.fileCount) * sizeof(FileRecord)
+        && header.postingsOffset == header.trigramsOffset + uint64_t(header.trigramCount) * sizeof(TrigramRecord)
+        && header.postingsOffset + header.postingsSize == size;
+    if (!valid) {
+        mBase.Close();
+        return false;
+    }
+
+    const FileRecord* files = reinterpret_cast<const FileRecord*>(mBase.Data() + header.filesOffset);
+    for (uint32_t i = 0; i < header.fileCount; ++i) {
+        if (files[i].pathOffset + files[i].pathLength > header.pathsSize) {
+            mBase.Close();
+            return false;
+        }
+    }
+    const TrigramRecord* trigrams = reinterpret_cast<const TrigramRecord*>(mBase.Data() + header.trigramsOffset);
+    for (uint32_t i = 0; i < header.trigramCount; ++i) {
+        if (trigrams[i].offset > header.postingsSize) {
+            mBase.Close();
+            return false;
+        }
+    }
+
+    mBaseFileCount = header.fileCount;
+    mBaseTrigramCount = header.trigramCount;
+    return true;
+}
+
+// Swaps the freshly written temporary file in for the index file. The mapping has to be closed
+// first, Windows can't replace a mapped file.
+bool TrigramIndex::ReplaceIndex() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBase.Close();
+    std::error_code ec;
+    fs::rename(mIndexPath + ".tmp", mIndexPath, ec);
+    if (ec || !MapIndex()) {
+        // Without a usable file the caller schedules a rebuild, see ScheduleRebuild
+        mBaseFileCount = 0;
+        mBaseTrigramCount = 0;
+        mStale.clear();
+        mOverlay.clear();
+        mReady = false;
+        return false;
+    }
+    mStale.assign(mBaseFileCount, false);
+    mOverlay.clear();
+    mRebuilds = 0;
+    return true;
+}
+
+// Called when ReplaceIndex failed and the index is empty: loads files again from scratch, unless
+// that already failed a few times in a row
+void TrigramIndex::ScheduleRebuild(std::vector<std::string> files) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mStopping || ++mRebuilds > kMaxRebuilds)
+        return;
+    mOpenFiles = std::move(files);
+    mOpenPending = true;
+}
+
+std::string_view TrigramIndex::GetBasePath(uint32_t id) const {
+    const Header& header = *reinterpret_cast<const Header*>(mBase.Data());
+    const FileRecord& file = reinterpret_cast<const FileRecord*>(mBase.Data() + header.filesOffset)[id];
+    return std::string_view(mBase.Data() + header.pathsOffset + file.pathOffset, file.pathLength);
+}
+
+// Returns the id of a file in the index file, or -1. With orNext, returns where it would be.
+int64_t TrigramIndex::FindBaseFile(std::string_view relativePath, bool orNext) const {
+    uint32_t low = 0;
+    uint32_t high = mBaseFileCount;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (GetBasePath(middle) < relativePath)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (orNext)
+        return low;
+    return low < mBaseFileCount && GetBasePath(low) == relativePath ? static_cast<int64_t>(low) : -1;
+}
+
+// Only this thread changes mBase, mStale and mOverlay, so it reads them without the lock and
+// takes it for changing them.
+void TrigramIndex::Load(std::vector<std::string> files) {
+    bool mapped;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mReady = false;
+        mStale.clear();
+        mOverlay.clear();
+        mapped = MapIndex();
+    }
+    if (!mapped) {
+        if (Build(files)) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mReady = true;
+        }
+        return;
+    }
+
+    // Only files that are new or changed since the index was written are read again. Files
+    // the index has and the project doesn't stay stale.
+    std::vector<bool> stale(mBaseFileCount, true);
+    std::vector<std::string> changed;
+    for (const auto& path : files) {
+        const std::string relative = RelativePath(path);
+        const int64_t id = relative.empty() ? -1 : FindBaseFile(relative);
+        int64_t writeTime = 0;
+        uint64_t size = 0;
+        if (id >= 0 && StatFile(path, writeTime, size)) {
+            const Header& header = *reinterpret_cast<const Header*>(mBase.Data());
+            const FileRecord& record = reinterpret_cast<const FileRecord*>(mBase.Data() + header.filesOffset)[id];
+            if (record.writeTime == writeTime && record.size == size) {
+                stale[id] = false;
+                continue;
+            }
+        }
+        changed.push_back(path);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStale = std::move(stale);
+    }
+    ApplyUpdates(std::set<std::string>(changed.begin(), changed.end()));
+
+    // Keep what was found for next time
+    bool dirty;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        dirty = !mOverlay.empty() || std::find(mStale.begin(), mStale.end(), true) != mStale.end();
+        mReady = true;
+    }
+    if (dirty)
+        Merge();
+}
+
+// Indexes the given files (again) into the overlay, or drops them if they are gone
+void TrigramIndex::ApplyUpdates(const std::set<std::string>& paths) {
+    const std::vector<std::string> list(paths.begin(), paths.end());
+    for (size_t chunk = 0; chunk < list.size(); chunk += kChunkSize) {
+        const size_t count = std::min(kChunkSize, list.size() - chunk);
+        std::vector<IndexedFile> indexed(count);
+        std::vector<char> exists(count);
+        ParallelFor(count, [&](size_t i) {
+            exists[i] = IndexFile(list[chunk + i], indexed[i].trigrams, indexed[i].writeTime, indexed[i].size);
+        });
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStopping)
+            return;
+        for (size_t i = 0; i < count; ++i) {
+            const std::string relative = RelativePath(list[chunk + i]);
+            if (relative.empty())
+                continue;
+            const int64_t id = FindBaseFile(relative);
+            if (id >= 0)
+                mStale[id] = true;
+            if (exists[i]) {
+                mOverlay[relative] = std::move(indexed[i]);
+                continue;
+            }
+            mOverlay.erase(relative);
+
+            // A deleted directory takes everything below it along
+            const std::string prefix = relative + '/';
+            for (int64_t below = FindBaseFile(prefix, true); below < mBaseFileCount && GetBasePath(below).starts_with(prefix); ++below)
+                mStale[below] = true;
+            for (auto it = mOverlay.lower_bound(prefix); it != mOverlay.end() && it->first.starts_with(prefix);)
+                it = mOverlay.erase(it);
+        }
+    }
+}
+
+// Writes a new index of files from scratch, reading them on all cores
+bool TrigramIndex::Build(const std::vector<std::string>& paths) {
+    std::vector<std::pair<std::string, const std::string*>> sorted;
+    sorted.reserve(paths.size());
+    for (const auto& path : paths) {
+        std::string relative = RelativePath(path);
+        if (!relative.empty())
+            sorted.emplace_back(std::move(relative), &path);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first == b.first; }), sorted.end());
+
+    // Ids are handed out in path order and chunks are added in order, so every posting list
+    // comes out ascending
+    std::vector<FileInfo> files(sorted.size());
+    std::unordered_map<uint32_t, PostingList> lists;
+    for (size_t chunk = 0; chunk < sorted.size(); chunk += kChunkSize) {
+        const size_t count = std::min(kChunkSize, sorted.size() - chunk);
+        std::vector<std::vector<uint32_t>> trigrams(count);
+        ParallelFor(count, [&](size_t i) {
+            FileInfo& file = files[chunk + i];
+            file.relativePath = sorted[chunk + i].first;
+            IndexFile(*sorted[chunk + i].second, trigrams[i], file.writeTime, file.size);
+        });
+        for (size_t i = 0; i < count; ++i) {
+            for (uint32_t trigram : trigrams[i])
+                lists[trigram].Add(static_cast<uint32_t>(chunk + i));
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStopping)
+            return false;
+    }
+
+    std::vector<std::pair<uint32_t, PostingList>> postings(std::make_move_iterator(lists.begin()), std::make_move_iterator(lists.end()));
+    lists.clear();
+    std::sort(postings.begin(), postings.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    if (!WriteIndex(mIndexPath + ".tmp", files, postings))
+        return false;
+    if (ReplaceIndex())
+        return true;
+    ScheduleRebuild(paths);
+    return false;
+}
+
+// Writes a new index file combining the current one without its stale files and the overlay,
+// without reading any source file again
+bool TrigramIndex::Merge() {
+    std::vector<std::pair<uint32_t, PostingList>> postings;
+    std::vector<FileInfo> files;
+    {
+        // New ids in path order: the base files still current and the overlay
+        std::vector<std::pair<std::string_view, int64_t>> order; // (path, base id or -1 - overlay slot)
+        std::vector<const std::pair<const std::string, IndexedFile>*> overlay;
+        for (uint32_t id = 0; id < mBaseFileCount; ++id) {
+            if (!mStale[id])
+                order.emplace_back(GetBasePath(id), id);
+        }
+        for (const auto& entry : mOverlay) {
+            order.emplace_back(entry.first, -1 - static_cast<int64_t>(overlay.size()));
+            overlay.push_back(&entry);
+        }
+        std::sort(order.begin(), order.end());
+
+        const Header* header = mBaseFileCount > 0 || mBaseTrigramCount > 0 ? reinterpret_cast<const Header*>(mBase.Data()) : nullptr;
+        std::vector<uint32_t> remap(mBaseFileCount, UINT32_MAX);
+        std::map<uint32_t, std::vector<uint32_t>> overlayLists;
+        files.resize(order.size());
+        for (uint32_t newId = 0; newId < order.size(); ++newId) {
+            const auto& [path, source] = order[newId];
+            files[newId].relativePath.assign(path);
+            if (source >= 0) {
+                const FileRecord& record = reinterpret_cast<const FileRecord*>(mBase.Data() + header->filesOffset)[source];
+                files[newId].writeTime = record.writeTime;
+                files[newId].size = record.size;
+                remap[source] = newId;
+            }
+            else {
+                const IndexedFile& file = overlay[-1 - source]->second;
+                files[newId].writeTime = file.writeTime;
+                files[newId].size = file.size;
+                for (uint32_t trigram : file.trigrams)
+                    overlayLists[trigram].push_back(newId);
+            }
+        }
+
+        // Walk both sorted trigram sequences together
+        const TrigramRecord* records = header ? reinterpret_cast<const TrigramRecord*>(mBase.Data() + header->trigramsOffset) : nullptr;
+        const uint8_t* postingData = header ? reinterpret_cast<const uint8_t*>(mBase.Data() + header->postingsOffset) : nullptr;
+        const uint8_t* postingEnd = header ? postingData + header->postingsSize : nullptr;
+        auto overlayIt = overlayLists.begin();
+        std::vector<uint32_t> ids;
+        for (uint32_t r = 0; r < mBaseTrigramCount || overlayIt != overlayLists.end();) {
+            const uint32_t trigram = r < mBaseTrigramCount && (overlayIt == overlayLists.end() || records[r].trigram <= overlayIt->first)
+                ? records[r].trigram : overlayIt->first;
+
+            ids.clear();
+            if (r < mBaseTrigramCount && records[r].trigram == trigram) {
+                const uint8_t* p = postingData + records[r].offset;
+                uint32_t id = 0;
+                for (uint32_t i = 0; i < records[r].count && p < postingEnd; ++i) {
+                    uint32_t delta = 0;
+                    for (int shift = 0; p < postingEnd; shift += 7) {
+                        delta |= uint32_t(*p & 0x7F) << shift;
+                        if ((*p++ & 0x80) == 0)
+                            break;
+                    }
+                    id = i == 0 ? delta : id + delta;
+                    if (id < mBaseFileCount && remap[id] != UINT32_MAX)
+                        ids.push_back(remap[id]);
+                }
+                ++r;
+            }
+            if (overlayIt != overlayLists.end() && overlayIt->first == trigram) {
+                const size_t middle = ids.size();
+                ids.insert(ids.end(), overlayIt->second.begin(), overlayIt->second.end());
+                std::inplace_merge(ids.begin(), ids.begin() + middle, ids.end());
+                ++overlayIt;
+            }
+
+            if (!ids.empty()) {
+                PostingList list;
+                for (uint32_t id : ids)
+                    list.Add(id);
+                postings.emplace_back(trigram, std::move(list));
+            }
+        }
+    }
+
+    if (!WriteIndex(mIndexPath + ".tmp", files, postings))
+        return false;
+    if (ReplaceIndex())
+        return true;
+
+    std::vector<std::string> paths;
+    paths.reserve(files.size());
+    for (const auto& file : files)
+        paths.push_back(FullPath(file.relativePath));
+    ScheduleRebuild(std::move(paths));
+    return false;
+}
+
+bool TrigramIndex::Query(std::string_view literal, std::vector<std::string>& candidates) const {
+    std::vector<uint32_t> trigrams;
+    ExtractTrigrams(literal.data(), literal.size(), trigrams);
+    if (trigrams.empty())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mReady)
+        return false;
+
+    // Start with the shortest posting list and narrow it down with the others
+    if (mBaseTrigramCount > 0) {
+        const Header& header = *reinterpret_cast<const Header*>(mBase.Data());
+        const TrigramRecord* records = reinterpret_cast<const TrigramRecord*>(mBase.Data() + header.trigramsOffset);
+        const uint8_t* postingData = reinterpret_cast<const uint8_t*>(mBase.Data() + header.postingsOffset);
+        const uint8_t* postingEnd = postingData + header.postingsSize;
+
+        std::vector<const TrigramRecord*> lists;
+        for (uint32_t trigram : trigrams) {
+            const TrigramRecord* record = std::lower_bound(records, records + mBaseTrigramCount, trigram,
+                [](const TrigramRecord& r, uint32_t t) { return r.trigram < t; });
+            if (record == records + mBaseTrigramCount || record->trigram != trigram) {
+                lists.clear();
+                break;
+            }
+            lists.push_back(record);
+        }
+        std::sort(lists.begin(), lists.end(), [](const TrigramRecord* a, const TrigramRecord* b) { return a->count < b->count; });
+
+        std::vector<uint32_t> ids;
+        std::vector<uint32_t> next;
+        std::vector<uint32_t> intersection;
+        for (size_t l = 0; l < lists.size(); ++l) {
+            next.clear();
+            const uint8_t* p = postingData + lists[l]->offset;
+            uint32_t id = 0;
+            for (uint32_t i = 0; i < lists[l]->count && p < postingEnd; ++i) {
+                uint32_t delta = 0;
+                for (int shift = 0; p < postingEnd; shift += 7) {
+                    delta |= uint32_t(*p & 0x7F) << shift;
+                    if ((*p++ & 0x80) == 0)
+                        break;
+                }
+                id = i == 0 ? delta : id + delta;
+                next.push_back(id);
+            }
+            if (l == 0) {
+                ids.swap(next);
+            }
+            else {
+                intersection.clear();
+                std::set_intersection(ids.begin(), ids.end(), next.begin(), next.end(), std::back_inserter(intersection));
+                ids.swap(intersection);
+            }
+            if (ids.empty())
+                break;
+        }
+
+        for (uint32_t id : ids) {
+            if (id < mBaseFileCount && !mStale[id])
+                candidates.push_back(FullPath(GetBasePath(id)));
+        }
+    }
+
+    for (const auto& [path, file] : mOverlay) {
+        if (std::includes(file.trigrams.begin(), file.trigrams.end(), trigrams.begin(), trigrams.end()))
+            candidates.push_back(FullPath(path));
+    }
+    return true;
+}
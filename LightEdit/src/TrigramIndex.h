@@ -0,0 +1,87 @@
+﻿// TrigramIndex.h
+#pragma once
+#include "MappedFile.h"
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Persistent index of the three-byte sequences (trigrams, ignoring case) in every project file,
+// like codesearch. A search for a literal only has to look at the files whose posting lists
+// contain all of its trigrams; FileSearch then verifies those candidates.
+//
+// The index lives in one file laid out for memory mapping, so reopening a project only maps it
+// and checks which files changed since. Files saved or changed later are indexed again into an
+// in-memory overlay on a background thread, and the overlay is merged into a new index file
+// once it grows large.
+class TrigramIndex {
+public:
+    TrigramIndex() = default;
+    ~TrigramIndex();
+    TrigramIndex(const TrigramIndex&) = delete;
+    TrigramIndex& operator=(const TrigramIndex&) = delete;
+
+    // Loads the index stored at indexPath for the project in root and brings it up to date with
+    // files, the full paths of all project files, or builds it from scratch. Runs in the
+    // background; IsReady turns true once the index covers all of files.
+    void Open(const std::string& indexPath, const std::string& root, std::vector<std::string> files);
+    void Close();
+
+    // Indexes a file again after it was saved, changed on disk or deleted
+    void Update(const std::string& path);
+
+    bool IsReady() const;
+    bool IsBusy() const;   // indexing in the background
+    size_t GetFileCount() const;
+
+    // Appends the full paths of the files that may contain literal (ignoring case). Returns
+    // false when the index can't narrow the search down, because it is not ready or the literal
+    // is shorter than a trigram.
+    bool Query(std::string_view literal, std::vector<std::string>& candidates) const;
+
+private:
+    struct IndexedFile {
+        std::vector<uint32_t> trigrams; // sorted
+        int64_t writeTime = 0;
+        uint64_t size = 0;
+    };
+
+    void Run();
+    void Load(std::vector<std::string> files);
+    void ApplyUpdates(const std::set<std::string>& paths);
+    bool Build(const std::vector<std::string>& files);
+    bool Merge();
+    bool ReplaceIndex();
+    void ScheduleRebuild(std::vector<std::string> files);
+    bool MapIndex();
+    int64_t FindBaseFile(std::string_view relativePath, bool orNext = false) const;
+    std::string_view GetBasePath(uint32_t id) const;
+    std::string RelativePath(const std::string& path) const;
+    std::string FullPath(std::string_view relativePath) const;
+
+    std::string mIndexPath;
+    std::string mRoot;
+    std::thread mThread;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mWake;
+    bool mStopping = false;
+    bool mReady = false;
+    bool mBusy = false;
+    bool mOpenPending = false;
+    std::vector<std::string> mOpenFiles;
+    int mRebuilds = 0; // scheduled since the index file was last swapped in
+    std::set<std::string> mPendingUpdates;
+
+    // The index file, and what changed since it was written
+    MappedFile mBase;
+    uint32_t mBaseFileCount = 0;
+    uint32_t mBaseTrigramCount = 0;
+    std::vector<bool> mStale; // base files that were deleted or are in mOverlay now
+    std::map<std::string, IndexedFile> mOverlay; // by relative path
+};
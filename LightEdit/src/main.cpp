@@ -6,51 +6,196 @@
 #include "ImGui/imgui_impl_sdl3.h"
 #include "ImGui/imgui_impl_opengl3.h"
 #include "ImGui/TextEditor.h"
+#include "MappedFile.h"
+#include "AtomicFile.h"
+#include "FileLoader.h"
+#include "ProcessRunner.h"
+#include "ConsoleBuffer.h"
+#include "Diagnostics.h"
+#include "ProjectScanner.h"
+#include "FileWatcher.h"
+#include "FuzzyFinder.h"
+#include "FileSearch.h"
+#include "TrigramIndex.h"
+#include "FrameScheduler.h"
 #include <fstream>
 #include <filesystem>
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <cstring>
 #include <memory>
-#include <array>
 #include <cstdlib> // for system()
 #include <map>
 #include <set>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <windows.h>
-#define popen _popen
-#define pclose _pclose
 #endif
 
 namespace fs = std::filesystem;
 
+// Files at least this large are opened read-only through a memory mapping
+constexpr uintmax_t kLargeFileThreshold = 64ull << 20;
+
+// Written between lines when saving a file that had no line break to go by
+#ifdef _WIN32
+constexpr const char kLineBreak[] = "\r\n";
+#else
+constexpr const char kLineBreak[] = "\n";
+#endif
+
+// Touched in the build directory after each successful CMake configure. CMake inputs newer
+// than this file mean the build tree has to be configured again.
+constexpr const char* kConfigureStamp = ".lightedit-configured";
+
 // Custom TextEditor extension to track filenames and dirty state
 class CustomTextEditor : public TextEditor {
 public:
     void SetFilePath(const std::string& path) {
         mFilePath = path;
         mIsDirty = false;
+        RememberDiskState();
     }
     const std::string& GetFilePath() const { return mFilePath; }
     bool IsDirty() const { return mIsDirty; }
     void SetDirty(bool dirty) { mIsDirty = dirty; }
 
+    // Shows the file read-only straight from a memory mapping instead of loading it. The
+    // previous mapping, if any, is only let go once the editor shows the new one; if the file
+    // can't be mapped the editor keeps showing what it had.
+    bool OpenMapped(const std::string& path) {
+        auto file = std::make_unique<MappedFile>();
+        if (!file->Open(path)) return false;
+        SetTextView(BuildTextView(*file));
+        mMappedFile = std::move(file);
+        SetFilePath(path);
+        return true;
+    }
+    bool IsMapped() const { return mMappedFile != nullptr; }
+
+    // Reads the file on a worker thread; the tab shows it read-only meanwhile, first the
+    // beginning and then all of it, see UpdateLoad
+    void StartLoad(const std::string& path) {
+        SetFilePath(path);
+        SetReadOnly(true);
+        mLoader = std::make_unique<FileLoader>();
+        mLoader->Start(path);
+    }
+    bool IsLoading() const { return mLoader != nullptr; }
+
+    // Called every frame while loading, before the editor is drawn. Returns false once the file
+    // turned out to be unreadable.
+    bool UpdateLoad() {
+        if (!mLoader) return true;
+
+        // Checked before taking the result, so it can't arrive after the load counts as done
+        const bool running = mLoader->IsRunning();
+        Lines lines;
+        if (running) {
+            if (mLoader->TakePreview(lines)) SetLines(std::move(lines));
+            return true;
+        }
+
+        const bool loaded = mLoader->TakeResult(lines, mFormat);
+        mLoader.reset();
+        SetReadOnly(false);
+        if (!loaded) return false;
+
+        SetLines(std::move(lines));
+        if (mPendingCursor.mLine >= 0) {
+            SetCursorPosition(mPendingCursor);
+            mPendingCursor = Coordinates::Invalid();
+        }
+        return true;
+    }
+
+    // Moves the cursor there, or once the file is loaded
+    void GoTo(const Coordinates& position) {
+        if (IsLoading()) mPendingCursor = position;
+        else SetCursorPosition(position);
+    }
+
+    // Writes straight from the line storage into a temporary file, which only replaces the
+    // file once it is complete on disk
     bool Save() {
-        if (mFilePath.empty()) return false;
+        if (mFilePath.empty() || IsMapped() || IsLoading()) return false;
 
-        std::ofstream out(mFilePath);
-        if (out.good()) {
-            out << GetText();
-            mIsDirty = false;
-            return true;
+        const char* lineBreak = mFormat.mLineBreak == LineBreak::CrLf ? "\r\n" : mFormat.mLineBreak == LineBreak::Lf ? "\n" : kLineBreak;
+        const size_t lineBreakLength = strlen(lineBreak);
+
+        AtomicFile out;
+        if (!out.Open(mFilePath)) return false;
+        if (mFormat.mBom && !out.Write("\xEF\xBB\xBF", 3)) return false;
+        const size_t lineCount = GetTotalLines();
+        size_t line = 0;
+        const bool written = ForEachLine([&](const char* data, size_t size) {
+            return out.Write(data, size) && (++line == lineCount || out.Write(lineBreak, lineBreakLength));
+        });
+        if (!written || !out.Commit()) return false;
+
+        mIsDirty = false;
+        RememberDiskState();
+        return true;
+    }
+
+    // Called when the file watcher reports the file. Returns true if someone else changed or
+    // deleted it since it was last loaded or saved here; our own saves don't count.
+    bool CheckChangedOnDisk() {
+        std::error_code ec;
+        const fs::file_time_type writeTime = fs::last_write_time(mFilePath, ec);
+        if (ec || writeTime != mDiskWriteTime) {
+            mChangedOnDisk = true;
+            mDeletedOnDisk = static_cast<bool>(ec);
         }
-        return false;
+        return mChangedOnDisk;
+    }
+    bool IsChangedOnDisk() const { return mChangedOnDisk; }
+    bool IsDeletedOnDisk() const { return mDeletedOnDisk; }
+    void IgnoreDiskChange() { RememberDiskState(); }
+
+    // Loads the file again, dropping unsaved changes
+    bool Reload() {
+        const std::string path = mFilePath;
+        if (IsMapped()) return OpenMapped(path);
+
+        std::error_code ec;
+        if (!fs::is_regular_file(path, ec)) return false;
+        StartLoad(path);
+        return true;
     }
 
 private:
+    void RememberDiskState() {
+        std::error_code ec;
+        mDiskWriteTime = fs::last_write_time(mFilePath, ec);
+        mChangedOnDisk = false;
+        mDeletedOnDisk = false;
+    }
+
     std::string mFilePath;
+    TextFormat mFormat;
     bool mIsDirty = false;
+    fs::file_time_type mDiskWriteTime;
+    bool mChangedOnDisk = false;
+    bool mDeletedOnDisk = false;
+
+    std::unique_ptr<MappedFile> mMappedFile;
+    std::unique_ptr<FileLoader> mLoader;
+    Coordinates mPendingCursor = Coordinates::Invalid();
+};
+
+// A file in the project explorer. The name is split off once when the file is added, not every
+// time it is drawn.
+struct ProjectFile {
+    std::string name;
+    std::string fullPath;
+
+    explicit ProjectFile(std::string path) : name(fs::path(path).filename().string()), fullPath(std::move(path)) {}
 };
 
 // Represents a directory node in the project explorer
@@ -58,30 +203,137 @@ struct DirectoryNode {
     std::string name;
     std::string fullPath;
     std::map<std::string, DirectoryNode> subdirectories;
-    std::vector<std::string> files;
+    std::vector<ProjectFile> files;
+    bool expanded = false;
+};
+
+// One line of the project explorer: a directory when file is null, a file otherwise
+struct ExplorerRow {
+    DirectoryNode* directory = nullptr;
+    const ProjectFile* file = nullptr;
+    int depth = 0;
+};
+
+// Console window state besides the text itself. Lines are identified by their line number, see
+// ConsoleBuffer::GetFirstLineNumber, so they stay valid while old lines drop off the buffer.
+struct ConsoleView {
+    ImGuiTextFilter filter;
+    std::vector<size_t> filteredLines; // lines passing the filter, in order
+    size_t filteredUpTo = 0;           // the filter has been applied to all lines before this one
+    char search[128] = "";
+    size_t searchLine = ConsoleBuffer::kNotFound;
+    bool scrollToSearch = false;
+};
+
+// Find in Files window state; the search itself runs in FileSearch
+struct FindInFilesView {
+    char pattern[256] = "";
+    bool matchCase = false;
+    bool regex = false;
+    bool focus = false;   // put the cursor into the pattern on the next frame
+    bool searching = false;
+    bool usedIndex = false; // only the files the trigram index pointed to were searched
+    std::vector<FileSearch::Result> results;
+    std::string error;
+};
+
+// Tools > Benchmark Highlighting, which takes seconds and runs on its own thread. The lines it
+// prints are collected here and moved into the console by UpdateHighlightBenchmark.
+struct HighlightBenchmark {
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> cancelled{ false };
+    std::mutex mutex;
+    std::string output;
+
+    ~HighlightBenchmark() {
+        cancelled = true;
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+// Ctrl+P "Go to File" palette
+struct QuickOpen {
+    FuzzyFinder finder;
+    size_t indexedVersion = SIZE_MAX; // AppState::treeVersion the finder was filled from
+    std::vector<FuzzyFinder::Match> results;
+    char query[256] = "";
+    int selected = 0;
+    bool show = false;                // open the popup on the next frame
 };
 
 // Application state
 struct AppState {
     std::string projectPath;
     DirectoryNode projectRoot;
+    std::vector<ExplorerRow> explorerRows;    // the expanded part of the tree, flattened
+    bool explorerRowsDirty = true;            // set whenever the tree or its expansion changes
+    size_t treeVersion = 0;                   // bumped whenever files are added to or removed from the tree
+    QuickOpen quickOpen;
+    FileSearch fileSearch;
+    FindInFilesView findInFiles;
+    TrigramIndex trigramIndex;
+    ProjectScanner projectScanner;
+    std::vector<DirectoryNode*> scannedNodes; // by ProjectScanner directory id, while scanning; null once removed
+    bool scanInProgress = false;              // started and not reported as finished yet
+    FileWatcher projectWatcher;
     std::vector<std::unique_ptr<CustomTextEditor>> editors;
     int activeEditorIndex = -1;
-    std::string buildOutput;
+    ConsoleBuffer console;
+    ConsoleView consoleView;
+    ProcessRunner buildProcess;
+    bool buildInProgress = false; // started and not reported as finished yet
+    bool buildUseNinja = false;
+    int buildJobs = 0;            // parallel jobs for cmake --build, 0 for one per core
+    std::vector<Diagnostic> problems;                               // found in the output of the last build
+    DiagnosticCounts problemCounts;                                 // of problems, by severity
+    std::map<std::string, TextEditor::ErrorMarkers> problemMarkers; // by PathKey of the file
+    int selectEditorIndex = -1;   // tab to bring to the front on the next frame
     bool showDemoWindow = false;
+    bool wordWrap = false;        // applied to every editor tab
+    HighlightBenchmark highlightBenchmark;
 };
 
 // Function declarations
 void SetupImGuiStyle();
-void BuildDirectoryTree(DirectoryNode& root, const fs::path& currentPath);
 void ScanProjectDirectory(AppState& state, const std::string& path);
-void RenderDirectoryNode(const DirectoryNode& node, AppState& state);
+void UpdateProjectScan(AppState& state);
+void UpdateProjectWatch(AppState& state);
+DirectoryNode* FindDirectoryNode(AppState& state, const fs::path& path, bool create);
+void ForgetScannedNodes(AppState& state, const DirectoryNode& node);
+void AddExplorerRows(std::vector<ExplorerRow>& rows, DirectoryNode& node, int depth);
+void CollectProjectFiles(const DirectoryNode& node, std::vector<std::string>& paths);
+void UpdateQuickOpen(AppState& state);
+void RenderQuickOpen(AppState& state);
+void StartFileSearch(AppState& state);
+void UpdateFileSearch(AppState& state);
+void RenderFindInFiles(AppState& state);
 void RenderProjectExplorer(AppState& state);
 void RenderEditorTabs(AppState& state);
+int OpenEditor(AppState& state, const std::string& file);
+void UpdateEditorLoads(AppState& state);
+void CloseEditor(AppState& state, size_t index);
+void ScheduleFrames(AppState& state, FrameScheduler& scheduler);
+void GoToLocation(AppState& state, const std::string& file, int line, int column);
+std::string PathKey(const fs::path& path);
 void RenderConsole(AppState& state);
-void BuildProject(AppState& state);
+void UpdateConsoleFilter(AppState& state);
+void FindInConsole(AppState& state, bool forward);
+void BuildProject(AppState& state, bool reconfigure = false);
+std::string ReadCMakeCacheEntry(const fs::path& cache, const std::string& key);
+std::string GetConfigureReason(const AppState& state, const fs::path& buildDir);
+void UpdateBuild(AppState& state);
+void AddProblem(AppState& state, Diagnostic diagnostic, std::set<std::string>& changedFiles);
+void ClearProblems(AppState& state);
+void ShowProblem(AppState& state, size_t index);
+void RenderProblems(AppState& state);
+bool SaveEditor(AppState& state, CustomTextEditor& editor);
 bool SaveCurrentFile(AppState& state);
 void HandleShortcuts(AppState& state);
+void BenchmarkHighlighting(AppState& state);
+void UpdateHighlightBenchmark(AppState& state);
+void SetWordWrap(AppState& state, bool wrap);
 
 int main(int argc, char* argv[]) {
     // Initialize SDL
@@ -89,6 +341,7 @@ int main(int argc, char* argv[]) {
         printf("Error: %s\n", SDL_GetError());
         return -1;
     }
+    FrameScheduler::Init();
 
     // Setup window
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
@@ -140,10 +393,14 @@ int main(int argc, char* argv[]) {
 
     // Application state
     AppState state;
+    FrameScheduler scheduler;
 
     // Main loop
     bool done = false;
     while (!done) {
+        // Sleeps until there is something to draw
+        scheduler.WaitForFrame();
+
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             ImGui_ImplSDL3_ProcessEvent(&event);
@@ -162,6 +419,20 @@ int main(int argc, char* argv[]) {
                     (SDL_GetModState() & SDL_KMOD_CTRL)) {
                     SaveCurrentFile(state);
                 }
+                // Ctrl+P go to file
+                else if (event.key.key == SDLK_P &&
+                    (SDL_GetModState() & SDL_KMOD_CTRL)) {
+                    state.quickOpen.show = true;
+                }
+                // Ctrl+Shift+F find in files
+                else if (event.key.key == SDLK_F &&
+                    (SDL_GetModState() & SDL_KMOD_CTRL) && (SDL_GetModState() & SDL_KMOD_SHIFT)) {
+                    state.findInFiles.focus = true;
+                }
+                // Alt+Z toggle word wrap
+                else if (event.key.key == SDLK_Z && (SDL_GetModState() & SDL_KMOD_ALT)) {
+                    SetWordWrap(state, !state.wordWrap);
+                }
             }
         }
 
@@ -203,6 +474,12 @@ int main(int argc, char* argv[]) {
                         ScanProjectDirectory(state, path);
                     }
                 }
+                if (ImGui::MenuItem("Go to File...", "Ctrl+P", false, !state.projectPath.empty())) {
+                    state.quickOpen.show = true;
+                }
+                if (ImGui::MenuItem("Find in Files...", "Ctrl+Shift+F", false, !state.projectPath.empty())) {
+                    state.findInFiles.focus = true;
+                }
                 if (ImGui::MenuItem("Save", "Ctrl+S")) {
                     SaveCurrentFile(state);
                 }
@@ -210,17 +487,57 @@ int main(int argc, char* argv[]) {
             }
             if (ImGui::BeginMenu("View")) {
                 ImGui::MenuItem("Show Demo Window", nullptr, &state.showDemoWindow);
+                if (ImGui::MenuItem("Word Wrap", "Alt+Z", state.wordWrap)) {
+                    SetWordWrap(state, !state.wordWrap);
+                }
+                int maxLines = static_cast<int>(state.console.GetMaxLines());
+                ImGui::SetNextItemWidth(120.0f);
+                if (ImGui::InputInt("Console line limit", &maxLines, 10000, 100000)) {
+                    state.console.SetMaxLines(static_cast<size_t>(std::max(1000, maxLines)));
+                }
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Build")) {
+                const bool idle = !state.buildProcess.IsRunning();
+                if (ImGui::MenuItem("Build", "F5", false, idle)) {
+                    BuildProject(state);
+                }
+                if (ImGui::MenuItem("Reconfigure and Build", nullptr, false, idle)) {
+                    BuildProject(state, true);
+                }
+                ImGui::Separator();
+                ImGui::MenuItem("Use Ninja", nullptr, &state.buildUseNinja);
+                ImGui::SetNextItemWidth(120.0f);
+                ImGui::SliderInt("Parallel jobs", &state.buildJobs, 0, 64, state.buildJobs == 0 ? "Auto" : "%d");
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Tools")) {
+                if (ImGui::MenuItem("Benchmark Highlighting", nullptr, false, state.activeEditorIndex >= 0 && !state.highlightBenchmark.running)) {
+                    BenchmarkHighlighting(state);
+                }
                 ImGui::EndMenu();
             }
+
             ImGui::EndMainMenuBar();
         }
 
         ImGui::End();
 
+        // Pick up scan results and build output before they are drawn
+        UpdateProjectScan(state);
+        UpdateProjectWatch(state);
+        UpdateBuild(state);
+        UpdateFileSearch(state);
+        UpdateEditorLoads(state);
+        UpdateHighlightBenchmark(state);
+
         // Render our windows
         RenderProjectExplorer(state);
         RenderEditorTabs(state);
         RenderConsole(state);
+        RenderProblems(state);
+        RenderQuickOpen(state);
+        RenderFindInFiles(state);
 
         // Demo window (for testing ImGui features)
         if (state.showDemoWindow)
@@ -243,6 +560,7 @@ int main(int argc, char* argv[]) {
         }
 
         SDL_GL_SwapWindow(window);
+        ScheduleFrames(state, scheduler);
     }
 
     // Cleanup
@@ -322,82 +640,442 @@ void SetupImGuiStyle() {
     colors[ImGuiCol_ModalWindowDimBg] = ImVec4(0.80f, 0.80f, 0.80f, 0.35f);
 }
 
-void BuildDirectoryTree(DirectoryNode& root, const fs::path& currentPath) {
-    for (const auto& entry : fs::directory_iterator(currentPath)) {
-        if (entry.is_directory()) {
-            std::string dirName = entry.path().filename().string();
-            DirectoryNode& newNode = root.subdirectories[dirName];
-            newNode.name = dirName;
-            newNode.fullPath = entry.path().string();
-            BuildDirectoryTree(newNode, entry.path());
-        }
-        else if (entry.is_regular_file()) {
-            std::string ext = entry.path().extension().string();
-            if (ext == ".cpp" || ext == ".h" || ext == ".hpp" || ext == ".c" || ext == ".txt" || ext == ".md") {
-                root.files.push_back(entry.path().string());
+// Starts listing the project in the background; UpdateProjectScan fills in the tree
+void ScanProjectDirectory(AppState& state, const std::string& path) {
+    // Stop the previous scan before the nodes it refers to go away
+    state.projectScanner.Cancel();
+    state.projectRoot = DirectoryNode();
+    state.projectRoot.name = fs::path(path).filename().string();
+    state.projectRoot.fullPath = path;
+    state.projectRoot.expanded = true;
+    state.scannedNodes.assign(1, &state.projectRoot);
+    state.explorerRowsDirty = true;
+    ++state.treeVersion;
+
+    // Reopened once the scan has the complete file list
+    state.trigramIndex.Close();
+    state.projectScanner.Start(path);
+    state.scanInProgress = true;
+    state.projectWatcher.Start(path);
+}
+
+// Adds the directories listed since the last frame to the project tree and reports the result
+// once the scan ends. Tree nodes live in std::maps, so the pointers to them stay valid until the
+// file watcher removes a directory, which clears them with ForgetScannedNodes.
+void UpdateProjectScan(AppState& state) {
+    if (!state.scanInProgress)
+        return;
+
+    // Checked before taking the results, so none can arrive after the summary
+    const bool running = state.projectScanner.IsRunning();
+
+    std::vector<ProjectScanner::Directory> directories;
+    state.projectScanner.TakeResults(directories);
+    for (auto& directory : directories) {
+        if (directory.id >= state.scannedNodes.size())
+            state.scannedNodes.resize(directory.id + 1);
+
+        DirectoryNode* node = &state.projectRoot;
+        if (directory.id != 0) {
+            // The file watcher may have removed the parent since it was listed
+            DirectoryNode* parent = state.scannedNodes[directory.parentId];
+            if (parent == nullptr) {
+                state.scannedNodes[directory.id] = nullptr;
+                continue;
             }
+            node = &parent->subdirectories[directory.name];
+            node->name = std::move(directory.name);
+            node->fullPath = std::move(directory.fullPath);
+        }
+        node->files.clear();
+        node->files.reserve(directory.files.size());
+        for (auto& file : directory.files) {
+            node->files.emplace_back(std::move(file));
+        }
+
+        state.scannedNodes[directory.id] = node;
+        state.explorerRowsDirty = true;
+        ++state.treeVersion;
+    }
+
+    std::vector<std::string> errors;
+    state.projectScanner.TakeErrors(errors);
+    for (const auto& error : errors) {
+        state.console.Append(error + "\n");
+    }
+
+    if (!running) {
+        char summary[128];
+        snprintf(summary, sizeof(summary), "%s %zu files in %zu folders in %.1f s\n",
+            state.projectScanner.WasCancelled() ? "Scan cancelled after" : "Scanned",
+            state.projectScanner.GetFileCount(), state.projectScanner.GetDirectoryCount(), state.projectScanner.GetElapsedSeconds());
+        state.console.Append(summary);
+        state.scannedNodes.clear();
+        state.scanInProgress = false;
+
+        if (!state.projectScanner.WasCancelled()) {
+            std::vector<std::string> paths;
+            CollectProjectFiles(state.projectRoot, paths);
+            state.trigramIndex.Open(state.projectRoot.fullPath + "/build/.lightedit-trigrams", state.projectRoot.fullPath, std::move(paths));
         }
     }
 }
 
-void ScanProjectDirectory(AppState& state, const std::string& path) {
-    state.projectRoot = DirectoryNode();
-    state.projectRoot.name = fs::path(path).filename().string();
-    state.projectRoot.fullPath = path;
+// Appends the rows for node and, if it is expanded, everything visible below it. Directories
+// come before files, the same as in a file manager.
+void AddExplorerRows(std::vector<ExplorerRow>& rows, DirectoryNode& node, int depth) {
+    rows.push_back({ &node, nullptr, depth });
+    if (!node.expanded)
+        return;
+
+    for (auto& [name, subdirectory] : node.subdirectories) {
+        AddExplorerRows(rows, subdirectory, depth + 1);
+    }
+    for (const auto& file : node.files) {
+        rows.push_back({ &node, &file, depth + 1 });
+    }
+}
 
-    try {
-        BuildDirectoryTree(state.projectRoot, path);
+void CollectProjectFiles(const DirectoryNode& node, std::vector<std::string>& paths) {
+    for (const auto& [name, subdirectory] : node.subdirectories) {
+        CollectProjectFiles(subdirectory, paths);
     }
-    catch (const fs::filesystem_error& e) {
-        state.buildOutput = "Error scanning directory: " + std::string(e.what()) + "\n";
+    for (const auto& file : node.files) {
+        paths.push_back(file.fullPath);
+    }
+}
+
+// Matches the query against the project files again. The file list is only collected anew
+// when the tree changed since the last time.
+void UpdateQuickOpen(AppState& state) {
+    QuickOpen& quickOpen = state.quickOpen;
+    if (quickOpen.indexedVersion != state.treeVersion) {
+        std::vector<std::string> paths;
+        CollectProjectFiles(state.projectRoot, paths);
+        quickOpen.finder.SetPaths(std::move(paths), state.projectRoot.fullPath.size());
+        quickOpen.indexedVersion = state.treeVersion;
     }
+    quickOpen.finder.Find(quickOpen.query, 100, quickOpen.results);
+    quickOpen.selected = 0;
 }
 
-void RenderDirectoryNode(const DirectoryNode& node, AppState& state) {
-    // Display directories first
-    for (const auto& [name, dirNode] : node.subdirectories) {
-        if (ImGui::TreeNodeEx(name.c_str(), ImGuiTreeNodeFlags_OpenOnArrow)) {
-            RenderDirectoryNode(dirNode, state);
-            ImGui::TreePop();
+void RenderQuickOpen(AppState& state) {
+    QuickOpen& quickOpen = state.quickOpen;
+    if (quickOpen.show && !state.projectPath.empty()) {
+        ImGui::OpenPopup("Go to File");
+        quickOpen.query[0] = '\0';
+        quickOpen.results.clear();
+        quickOpen.selected = 0;
+    }
+
+    const ImGuiViewport* viewport = ImGui::GetMainViewport();
+    ImGui::SetNextWindowPos(ImVec2(viewport->WorkPos.x + viewport->WorkSize.x * 0.5f, viewport->WorkPos.y + 40.0f), ImGuiCond_Always, ImVec2(0.5f, 0.0f));
+    ImGui::SetNextWindowSize(ImVec2(std::min(700.0f, viewport->WorkSize.x - 40.0f), 0.0f));
+    if (!ImGui::BeginPopup("Go to File")) {
+        quickOpen.show = false;
+        return;
+    }
+
+    if (quickOpen.show) {
+        ImGui::SetKeyboardFocusHere();
+        quickOpen.show = false;
+    }
+    ImGui::SetNextItemWidth(-1.0f);
+    const bool enter = ImGui::InputTextWithHint("##Query", "Go to file", quickOpen.query, sizeof(quickOpen.query), ImGuiInputTextFlags_EnterReturnsTrue);
+    if (ImGui::IsItemEdited()) {
+        UpdateQuickOpen(state);
+    }
+
+    const int resultCount = static_cast<int>(quickOpen.results.size());
+    if (ImGui::IsKeyPressed(ImGuiKey_DownArrow) && resultCount > 0)
+        quickOpen.selected = (quickOpen.selected + 1) % resultCount;
+    if (ImGui::IsKeyPressed(ImGuiKey_UpArrow) && resultCount > 0)
+        quickOpen.selected = (quickOpen.selected + resultCount - 1) % resultCount;
+
+    int chosen = enter && resultCount > 0 ? quickOpen.selected : -1;
+    ImGui::BeginChild("Results", ImVec2(0.0f, ImGui::GetTextLineHeightWithSpacing() * 15.0f));
+    for (int i = 0; i < resultCount; ++i) {
+        const std::string_view path = quickOpen.finder.GetRelativePath(quickOpen.results[i].index);
+        ImGui::PushID(i);
+        const ImVec2 pos = ImGui::GetCursorPos();
+        if (ImGui::Selectable("##Result", i == quickOpen.selected)) {
+            chosen = i;
+        }
+        if (i == quickOpen.selected && (ImGui::IsKeyPressed(ImGuiKey_DownArrow) || ImGui::IsKeyPressed(ImGuiKey_UpArrow))) {
+            ImGui::SetScrollHereY();
+        }
+
+        // File name first, the folder it is in after it, dimmed
+        size_t nameStart = path.find_last_of("/\\");
+        nameStart = nameStart == std::string_view::npos ? 0 : nameStart + 1;
+        ImGui::SetCursorPos(pos);
+        ImGui::TextUnformatted(path.data() + nameStart, path.data() + path.size());
+        if (nameStart > 0) {
+            ImGui::SameLine();
+            ImGui::PushStyleColor(ImGuiCol_Text, ImGui::GetStyleColorVec4(ImGuiCol_TextDisabled));
+            ImGui::TextUnformatted(path.data(), path.data() + nameStart - 1);
+            ImGui::PopStyleColor();
         }
+        ImGui::PopID();
     }
+    ImGui::EndChild();
 
-    // Then display files
-    for (const auto& file : node.files) {
-        std::string filename = fs::path(file).filename().string();
+    if (chosen >= 0) {
+        const int index = OpenEditor(state, quickOpen.finder.GetPath(quickOpen.results[chosen].index));
+        if (index >= 0) {
+            state.activeEditorIndex = state.selectEditorIndex = index;
+        }
+        ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+}
 
-        if (ImGui::Selectable(filename.c_str())) {
-            // Check if file is already open
-            bool found = false;
-            for (size_t i = 0; i < state.editors.size(); ++i) {
-                if (state.editors[i]->GetFilePath() == file) {
-                    state.activeEditorIndex = i;
-                    found = true;
-                    break;
-                }
+// Searches every project file, taking the text of editors with unsaved changes instead of what
+// is on disk. Once the trigram index is ready, only the files it names as candidates for the
+// pattern's literal text are searched, plus the unsaved ones.
+void StartFileSearch(AppState& state) {
+    FindInFilesView& view = state.findInFiles;
+    view.results.clear();
+    view.error.clear();
+
+    std::map<std::string, std::shared_ptr<const std::string>> unsaved;
+    for (const auto& editor : state.editors) {
+        if (editor->IsDirty()) {
+            unsaved[PathKey(editor->GetFilePath())] = std::make_shared<const std::string>(editor->GetText());
+        }
+    }
+
+    std::vector<std::string> paths;
+    bool wholePattern = true;
+    const std::string literal = view.regex ? FileSearch::RequiredLiteral(view.pattern, wholePattern) : std::string(view.pattern);
+    view.usedIndex = state.trigramIndex.Query(literal, paths);
+    if (!view.usedIndex) {
+        CollectProjectFiles(state.projectRoot, paths);
+    }
+    else if (!unsaved.empty()) {
+        // The index only knows what is on disk
+        std::set<std::string> candidates;
+        for (const auto& path : paths) {
+            candidates.insert(PathKey(path));
+        }
+        for (const auto& editor : state.editors) {
+            if (editor->IsDirty() && candidates.insert(PathKey(editor->GetFilePath())).second) {
+                paths.push_back(editor->GetFilePath());
             }
+        }
+    }
+    std::vector<FileSearch::Source> sources;
+    sources.reserve(paths.size());
+    for (auto& path : paths) {
+        std::shared_ptr<const std::string> text;
+        if (!unsaved.empty()) {
+            const auto it = unsaved.find(PathKey(path));
+            if (it != unsaved.end())
+                text = it->second;
+        }
+        sources.push_back({ std::move(path), std::move(text) });
+    }
 
-            // If not open, create a new editor
-            if (!found) {
-                auto editor = std::make_unique<CustomTextEditor>();
-                editor->SetLanguageDefinition(TextEditor::LanguageDefinition::CPlusPlus());
-                editor->SetShowWhitespaces(false);
-
-                // Load file content
-                std::ifstream t(file);
-                if (t.good()) {
-                    std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-                    editor->SetText(str);
-                    editor->SetFilePath(file);
-                    state.editors.push_back(std::move(editor));
-                    state.activeEditorIndex = state.editors.size() - 1;
-                }
-                else {
-                    state.buildOutput = "Failed to open file: " + file + "\n";
-                }
+    FileSearch::Options options;
+    options.pattern = view.pattern;
+    options.matchCase = view.matchCase;
+    options.regex = view.regex;
+    view.searching = state.fileSearch.Start(options, std::move(sources), view.error);
+}
+
+void UpdateFileSearch(AppState& state) {
+    FindInFilesView& view = state.findInFiles;
+    if (!view.searching)
+        return;
+
+    // Checked before taking the results, so none can arrive after the search counts as done
+    const bool running = state.fileSearch.IsRunning();
+    state.fileSearch.TakeResults(view.results);
+    view.searching = running;
+}
+
+void RenderFindInFiles(AppState& state) {
+    FindInFilesView& view = state.findInFiles;
+    if (view.focus) {
+        ImGui::SetNextWindowFocus();
+    }
+    ImGui::Begin("Find in Files");
+
+    if (view.focus) {
+        ImGui::SetKeyboardFocusHere();
+        view.focus = false;
+    }
+    ImGui::SetNextItemWidth(-240.0f);
+    bool start = ImGui::InputTextWithHint("##Pattern", "Find in files", view.pattern, sizeof(view.pattern), ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    ImGui::Checkbox("Aa", &view.matchCase);
+    ImGui::SetItemTooltip("Match case");
+    ImGui::SameLine();
+    ImGui::Checkbox(".*", &view.regex);
+    ImGui::SetItemTooltip("Regular expression");
+    ImGui::SameLine();
+    if (state.fileSearch.IsRunning()) {
+        if (ImGui::Button("Cancel")) {
+            state.fileSearch.Cancel();
+        }
+    }
+    else {
+        start |= ImGui::Button("Search");
+    }
+    if (start && !state.projectPath.empty()) {
+        StartFileSearch(state);
+    }
+
+    const FileSearch& search = state.fileSearch;
+    if (!view.error.empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", view.error.c_str());
+    }
+    else if (search.GetSourceCount() > 0) {
+        ImGui::Text("%zu matches in %zu files, %zu of %zu files searched in %.2f s%s%s", search.GetResultCount(), search.GetMatchedFileCount(),
+            search.GetSearchedCount(), search.GetSourceCount(), search.GetElapsedSeconds(), view.usedIndex ? " using the index" : "",
+            search.WasTruncated() ? " (stopped, too many matches)" : search.WasCancelled() ? " (cancelled)" : "");
+    }
+    ImGui::Separator();
+
+    // Only the visible results are submitted
+    const size_t rootLength = state.projectRoot.fullPath.size() + 1;
+    ImGui::BeginChild("SearchResults", ImVec2(0.0f, 0.0f), ImGuiChildFlags_None, ImGuiWindowFlags_HorizontalScrollbar);
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(view.results.size()));
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+            const FileSearch::Result& result = view.results[row];
+            const std::string& path = search.GetSource(result.source).path;
+            char location[32];
+            snprintf(location, sizeof(location), ":%u: ", result.line);
+
+            ImGui::PushID(row);
+            const ImVec2 pos = ImGui::GetCursorPos();
+            if (ImGui::Selectable("##Result")) {
+                GoToLocation(state, path, result.line, result.column);
             }
+            ImGui::SetCursorPos(pos);
+            ImGui::PushStyleColor(ImGuiCol_Text, ImGui::GetStyleColorVec4(ImGuiCol_TextDisabled));
+            ImGui::TextUnformatted(path.size() > rootLength ? path.c_str() + rootLength : path.c_str());
+            ImGui::SameLine(0.0f, 0.0f);
+            ImGui::TextUnformatted(location);
+            ImGui::PopStyleColor();
+            ImGui::SameLine(0.0f, 0.0f);
+            ImGui::TextUnformatted(result.text.data(), result.text.data() + result.text.size());
+            ImGui::PopID();
+        }
+    }
+    clipper.End();
+    ImGui::EndChild();
+
+    ImGui::End();
+}
+
+// Returns the index of the editor showing file, opening it first if needed, or -1 if the file
+// can't be read
+int OpenEditor(AppState& state, const std::string& file) {
+    // Check if file is already open
+    const std::string key = PathKey(file);
+    for (size_t i = 0; i < state.editors.size(); ++i) {
+        if (PathKey(state.editors[i]->GetFilePath()) == key) {
+            return static_cast<int>(i);
         }
     }
+
+    auto editor = std::make_unique<CustomTextEditor>();
+    editor->SetLanguageDefinition(TextEditor::LanguageDefinition::CPlusPlus());
+    editor->SetShowWhitespaces(false);
+    editor->SetWordWrap(state.wordWrap);
+
+    // Load file content; huge files are mapped instead of copied into the editor, the others
+    // are read in the background and the tab opens right away
+    std::error_code ec;
+    const uintmax_t size = fs::file_size(file, ec);
+    bool loaded = !ec;
+    if (loaded && size >= kLargeFileThreshold) {
+        loaded = editor->OpenMapped(file);
+    }
+    else if (loaded) {
+        editor->StartLoad(file);
+    }
+
+    if (!loaded) {
+        state.console.Append("Failed to open file: " + file + "\n");
+        return -1;
+    }
+
+    // Files opened after the build still show what it reported about them
+    const auto markers = state.problemMarkers.find(key);
+    if (markers != state.problemMarkers.end()) {
+        editor->SetErrorMarkers(markers->second);
+    }
+
+    state.editors.push_back(std::move(editor));
+    return static_cast<int>(state.editors.size()) - 1;
+}
+
+// Swaps in the text of files that finished loading, and closes the tabs of those that couldn't
+// be read
+void UpdateEditorLoads(AppState& state) {
+    for (size_t i = 0; i < state.editors.size(); ++i) {
+        CustomTextEditor& editor = *state.editors[i];
+        if (editor.IsLoading() && !editor.UpdateLoad()) {
+            state.console.Append("Failed to open file: " + editor.GetFilePath() + "\n");
+            CloseEditor(state, i);
+            --i;
+        }
+    }
+}
+
+// Asks for the frames that are due without any input: the cursor blink, colorizing that is still
+// going on, and the elapsed times shown while background work runs
+void ScheduleFrames(AppState& state, FrameScheduler& scheduler) {
+    if (state.activeEditorIndex >= 0 && state.activeEditorIndex < static_cast<int>(state.editors.size())) {
+        const CustomTextEditor& editor = *state.editors[state.activeEditorIndex];
+        if (editor.IsColorizing())
+            scheduler.RequestFrames(1);
+        const int blinkDelay = editor.GetCursorBlinkDelay();
+        if (blinkDelay >= 0)
+            scheduler.RequestFrameIn(blinkDelay);
+    }
+
+    bool busy = state.buildProcess.IsRunning() || state.projectScanner.IsRunning() || state.fileSearch.IsRunning() || state.highlightBenchmark.running;
+    for (const auto& editor : state.editors)
+        busy = busy || editor->IsLoading();
+    if (busy)
+        scheduler.RequestFrameIn(250);
+
+    // Tooltips open after a hover delay, with the mouse standing still
+    if (ImGui::IsAnyItemHovered())
+        scheduler.RequestFrameIn(static_cast<int>(ImGui::GetStyle().HoverDelayNormal * 1000.0f) + 50);
+}
+
+// Closes a tab; a file still loading stops loading
+void CloseEditor(AppState& state, size_t index) {
+    state.editors.erase(state.editors.begin() + index);
+    if (state.activeEditorIndex >= static_cast<int>(state.editors.size())) {
+        state.activeEditorIndex = state.editors.empty() ? -1 : state.editors.size() - 1;
+    }
+}
+
+// Opens file and puts the cursor on a 1-based line and column
+void GoToLocation(AppState& state, const std::string& file, int line, int column) {
+    const int editorIndex = OpenEditor(state, file);
+    if (editorIndex < 0)
+        return;
+
+    state.editors[editorIndex]->GoTo(TextEditor::Coordinates(line - 1, std::max(0, column - 1)));
+    state.activeEditorIndex = state.selectEditorIndex = editorIndex;
+    ImGui::SetWindowFocus("Editor");
+}
+
+// Normalizes a path so the spellings compilers print compare equal to the one the editor uses
+std::string PathKey(const fs::path& path) {
+    std::string key = path.lexically_normal().generic_string();
+#ifdef _WIN32
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+#endif
+    return key;
 }
 
 void RenderProjectExplorer(AppState& state) {
@@ -405,12 +1083,68 @@ void RenderProjectExplorer(AppState& state) {
 
     if (!state.projectPath.empty()) {
         ImGui::Text("Project: %s", state.projectPath.c_str());
+
+        // Nothing tells how many folders are left, so the bar shows the listed part of those
+        // found so far
+        if (state.projectScanner.IsRunning()) {
+            const size_t files = state.projectScanner.GetFileCount();
+            const size_t listed = state.projectScanner.GetDirectoryCount();
+            const size_t pending = state.projectScanner.GetPendingCount();
+            char progress[64];
+            snprintf(progress, sizeof(progress), "%zu files, %zu folders", files, listed);
+            ImGui::ProgressBar(static_cast<float>(listed) / std::max<size_t>(1, listed + pending), ImVec2(-80.0f, 0.0f), progress);
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel")) {
+                state.projectScanner.Cancel();
+            }
+        }
         ImGui::Separator();
 
-        if (ImGui::TreeNodeEx(state.projectRoot.name.c_str(), ImGuiTreeNodeFlags_DefaultOpen | ImGuiTreeNodeFlags_OpenOnArrow)) {
-            RenderDirectoryNode(state.projectRoot, state);
-            ImGui::TreePop();
+        // The expanded part of the tree is flattened into rows only when it changes, so only the
+        // visible rows cost anything per frame, however many files an expanded folder holds
+        if (state.explorerRowsDirty) {
+            state.explorerRows.clear();
+            AddExplorerRows(state.explorerRows, state.projectRoot, 0);
+            state.explorerRowsDirty = false;
         }
+
+        ImGui::BeginChild("ExplorerRows");
+        const float indent = ImGui::GetStyle().IndentSpacing;
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(state.explorerRows.size()));
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                const ExplorerRow& row = state.explorerRows[i];
+                if (row.depth > 0)
+                    ImGui::Indent(row.depth * indent);
+
+                if (row.file == nullptr) {
+                    // Toggling takes effect on the next frame, the rows are not changed while drawn
+                    DirectoryNode* node = row.directory;
+                    ImGui::SetNextItemOpen(node->expanded);
+                    const bool open = ImGui::TreeNodeEx(node, ImGuiTreeNodeFlags_OpenOnArrow | ImGuiTreeNodeFlags_NoTreePushOnOpen, "%s", node->name.c_str());
+                    if (open != node->expanded) {
+                        node->expanded = open;
+                        state.explorerRowsDirty = true;
+                    }
+                }
+                else {
+                    ImGui::PushID(row.file);
+                    if (ImGui::Selectable(row.file->name.c_str())) {
+                        const int index = OpenEditor(state, row.file->fullPath);
+                        if (index >= 0) {
+                            state.activeEditorIndex = state.selectEditorIndex = index;
+                        }
+                    }
+                    ImGui::PopID();
+                }
+
+                if (row.depth > 0)
+                    ImGui::Unindent(row.depth * indent);
+            }
+        }
+        clipper.End();
+        ImGui::EndChild();
     }
     else {
         ImGui::Text("No project loaded");
@@ -436,15 +1170,34 @@ void RenderEditorTabs(AppState& state) {
             for (size_t i = 0; i < state.editors.size(); ++i) {
                 const auto& editor = state.editors[i];
                 std::string filename = fs::path(editor->GetFilePath()).filename().string();
-                std::string tabName = filename + (editor->IsDirty() ? " *" : "");
+                std::string tabName = filename + (editor->IsMapped() ? " [read-only]" : "") + (editor->IsDirty() ? " *" : "");
 
                 bool tabOpen = true;
                 ImGuiTabItemFlags flags = ImGuiTabItemFlags_None;
                 if (editor->IsDirty()) flags |= ImGuiTabItemFlags_UnsavedDocument;
+                if (static_cast<int>(i) == state.selectEditorIndex) flags |= ImGuiTabItemFlags_SetSelected;
 
                 if (ImGui::BeginTabItem(tabName.c_str(), &tabOpen, flags)) {
                     state.activeEditorIndex = i;
 
+                    if (editor->IsChangedOnDisk()) {
+                        ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.3f, 1.0f), editor->IsDeletedOnDisk() ? "Deleted on disk." : "Changed on disk.");
+                        ImGui::SameLine();
+                        if (ImGui::SmallButton("Reload")) {
+                            if (!editor->Reload()) {
+                                state.console.Append("Failed to reload: " + editor->GetFilePath() + "\n");
+                            }
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::SmallButton(editor->IsDirty() ? "Keep my changes" : "Ignore")) {
+                            editor->IgnoreDiskChange();
+                        }
+                    }
+
+                    if (editor->IsLoading()) {
+                        ImGui::TextDisabled("Loading...");
+                    }
+
                     // Get the available space for the editor
                     ImVec2 contentSize = ImGui::GetContentRegionAvail();
 
@@ -462,23 +1215,16 @@ void RenderEditorTabs(AppState& state) {
                 if (!tabOpen) {
                     // Save before closing if dirty
                     if (editor->IsDirty()) {
-                        if (editor->Save()) {
-                            state.buildOutput += "Saved: " + editor->GetFilePath() + "\n";
-                        }
-                        else {
-                            state.buildOutput += "Failed to save: " + editor->GetFilePath() + "\n";
-                        }
+                        SaveEditor(state, *editor);
                     }
 
-                    state.editors.erase(state.editors.begin() + i);
-                    if (state.activeEditorIndex >= static_cast<int>(state.editors.size())) {
-                        state.activeEditorIndex = state.editors.empty() ? -1 : state.editors.size() - 1;
-                    }
+                    CloseEditor(state, i);
                     --i; // Adjust index after removal
                 }
             }
             ImGui::EndTabBar();
         }
+        state.selectEditorIndex = -1;
     }
     else {
         ImGui::Text("No files open");
@@ -490,21 +1236,82 @@ void RenderEditorTabs(AppState& state) {
 void RenderConsole(AppState& state) {
     ImGui::Begin("Console");
 
-    // Build button
-    if (ImGui::Button("Build (F5)")) {
+    // Build button; while a build runs it can be cancelled instead
+    if (state.buildProcess.IsRunning()) {
+        if (ImGui::Button("Cancel Build")) {
+            state.buildProcess.Cancel();
+        }
+        ImGui::SameLine();
+        ImGui::Text("Building... %.0f s", state.buildProcess.GetElapsedSeconds());
+    }
+    else if (ImGui::Button("Build (F5)")) {
         BuildProject(state);
     }
     ImGui::SameLine();
+    ConsoleView& view = state.consoleView;
     if (ImGui::Button("Clear")) {
-        state.buildOutput.clear();
+        state.console.Clear();
+        view.filteredLines.clear();
+        view.filteredUpTo = 0;
+        view.searchLine = ConsoleBuffer::kNotFound;
+    }
+
+    ImGui::SameLine();
+    if (view.filter.Draw("Filter", 160.0f)) {
+        view.filteredLines.clear();
+        view.filteredUpTo = 0;
+    }
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(160.0f);
+    if (ImGui::InputTextWithHint("##Search", "Search", view.search, sizeof(view.search), ImGuiInputTextFlags_EnterReturnsTrue)) {
+        FindInConsole(state, true);
+        ImGui::SetKeyboardFocusHere(-1);
+    }
+    ImGui::SameLine();
+    if (ImGui::ArrowButton("##SearchPrev", ImGuiDir_Up)) {
+        FindInConsole(state, false);
+    }
+    ImGui::SameLine();
+    if (ImGui::ArrowButton("##SearchNext", ImGuiDir_Down)) {
+        FindInConsole(state, true);
     }
 
     ImGui::Separator();
 
-    // Console output
-    ImGui::BeginChild("ConsoleOutput");
-    ImGui::TextUnformatted(state.buildOutput.c_str());
-    if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
+    // Console output; only the visible lines are submitted
+    UpdateConsoleFilter(state);
+    const bool filtering = view.filter.IsActive();
+    const size_t firstLine = state.console.GetFirstLineNumber();
+    const size_t rowCount = filtering ? view.filteredLines.size() : state.console.GetLineCount();
+
+    ImGui::BeginChild("ConsoleOutput", ImVec2(0.0f, 0.0f), ImGuiChildFlags_None, ImGuiWindowFlags_HorizontalScrollbar);
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(rowCount));
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+            const size_t line = filtering ? view.filteredLines[row] : firstLine + row;
+            const std::string_view text = state.console.GetLine(line - firstLine);
+            if (line == view.searchLine) {
+                ImGui::PushStyleColor(ImGuiCol_Text, ImGui::GetStyleColorVec4(ImGuiCol_CheckMark));
+                ImGui::TextUnformatted(text.data(), text.data() + text.size());
+                ImGui::PopStyleColor();
+            }
+            else {
+                ImGui::TextUnformatted(text.data(), text.data() + text.size());
+            }
+        }
+    }
+    clipper.End();
+
+    if (view.scrollToSearch) {
+        // Rows have a fixed height, so the row of the hit gives its position directly
+        size_t row = view.searchLine - firstLine;
+        if (filtering)
+            row = std::lower_bound(view.filteredLines.begin(), view.filteredLines.end(), view.searchLine) - view.filteredLines.begin();
+        ImGui::SetScrollY(row * ImGui::GetTextLineHeightWithSpacing() - ImGui::GetWindowHeight() * 0.5f);
+        view.scrollToSearch = false;
+    }
+    else if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
         ImGui::SetScrollHereY(1.0f);
     }
     ImGui::EndChild();
@@ -512,41 +1319,105 @@ void RenderConsole(AppState& state) {
     ImGui::End();
 }
 
+// Applies the console filter to the lines added since the last frame and forgets the ones that
+// dropped off the front of the buffer. The last line may still be growing, so it is checked
+// again each time.
+void UpdateConsoleFilter(AppState& state) {
+    ConsoleView& view = state.consoleView;
+    if (!view.filter.IsActive())
+        return;
+
+    const size_t firstLine = state.console.GetFirstLineNumber();
+    const size_t endLine = firstLine + state.console.GetLineCount();
+    auto& lines = view.filteredLines;
+    lines.erase(lines.begin(), std::lower_bound(lines.begin(), lines.end(), firstLine));
+
+    const size_t from = std::max(view.filteredUpTo, firstLine);
+    lines.erase(std::lower_bound(lines.begin(), lines.end(), from), lines.end());
+    for (size_t line = from; line < endLine; ++line) {
+        const std::string_view text = state.console.GetLine(line - firstLine);
+        if (view.filter.PassFilter(text.data(), text.data() + text.size()))
+            lines.push_back(line);
+    }
+    view.filteredUpTo = std::max(from, endLine > 0 ? endLine - 1 : 0);
+}
+
+// Moves the search hit to the next (or previous) line containing the search text. With a filter
+// active, only lines passing it are considered.
+void FindInConsole(AppState& state, bool forward) {
+    ConsoleView& view = state.consoleView;
+    const size_t firstLine = state.console.GetFirstLineNumber();
+    if (view.search[0] == '\0') {
+        view.searchLine = ConsoleBuffer::kNotFound;
+        return;
+    }
+
+    if (!view.filter.IsActive()) {
+        size_t index = ConsoleBuffer::kNotFound;
+        if (view.searchLine != ConsoleBuffer::kNotFound && view.searchLine >= firstLine)
+            index = view.searchLine - firstLine;
+        index = state.console.Find(view.search, index, forward);
+        view.searchLine = index == ConsoleBuffer::kNotFound ? index : firstLine + index;
+        view.scrollToSearch = index != ConsoleBuffer::kNotFound;
+        return;
+    }
+
+    // Walk the filtered lines from the current hit on, wrapping around at the ends. Without a
+    // hit (kNotFound sorts last) this starts at the first or the last filtered line.
+    UpdateConsoleFilter(state);
+    const auto& lines = view.filteredLines;
+    const size_t count = lines.size();
+    size_t row = forward
+        ? std::upper_bound(lines.begin(), lines.end(), view.searchLine) - lines.begin()
+        : std::lower_bound(lines.begin(), lines.end(), view.searchLine) - lines.begin() + count - 1;
+    for (size_t step = 0; step < count; ++step, row += forward ? 1 : count - 1) {
+        const size_t line = lines[row % count];
+        if (ConsoleBuffer::Contains(state.console.GetLine(line - firstLine), view.search)) {
+            view.searchLine = line;
+            view.scrollToSearch = true;
+            return;
+        }
+    }
+    view.searchLine = ConsoleBuffer::kNotFound;
+}
+
+bool SaveEditor(AppState& state, CustomTextEditor& editor) {
+    if (!editor.Save()) {
+        state.console.Append("Failed to save: " + editor.GetFilePath() + "\n");
+        return false;
+    }
+    state.console.Append("Saved: " + editor.GetFilePath() + "\n");
+    state.trigramIndex.Update(editor.GetFilePath());
+    return true;
+}
+
 bool SaveCurrentFile(AppState& state) {
     if (state.activeEditorIndex >= 0 && state.activeEditorIndex < static_cast<int>(state.editors.size())) {
-        auto& editor = state.editors[state.activeEditorIndex];
-        if (editor->Save()) {
-            state.buildOutput += "Saved: " + editor->GetFilePath() + "\n";
-            return true;
-        }
-        else {
-            state.buildOutput += "Failed to save: " + editor->GetFilePath() + "\n";
-            return false;
-        }
+        return SaveEditor(state, *state.editors[state.activeEditorIndex]);
     }
     return false;
 }
 
-void BuildProject(AppState& state) {
+void BuildProject(AppState& state, bool reconfigure) {
     if (state.projectPath.empty()) {
-        state.buildOutput = "No project loaded\n";
+        state.console.Append("No project loaded\n");
+        return;
+    }
+    if (state.buildProcess.IsRunning()) {
+        state.console.Append("A build is already running\n");
         return;
     }
 
     // Save all open files first
     for (auto& editor : state.editors) {
         if (editor->IsDirty()) {
-            if (editor->Save()) {
-                state.buildOutput += "Saved: " + editor->GetFilePath() + "\n";
-            }
-            else {
-                state.buildOutput += "Failed to save: " + editor->GetFilePath() + "\n";
-            }
+            SaveEditor(state, *editor);
         }
     }
 
     // Execute build command
-    state.buildOutput += "Building project...\n";
+    state.console.Append("Building project...\n");
+    ClearProblems(state);
 
     // Create build directory if it doesn't exist
     std::string buildDir = state.projectPath + "/build";
@@ -554,25 +1425,437 @@ void BuildProject(AppState& state) {
         fs::create_directory(buildDir);
     }
 
-    // Execute CMake commands
-    std::string cmd = "cd " + buildDir + " && cmake .. && cmake --build .";
+    // CMake refuses to configure an existing build tree for a different generator, so the cache
+    // and everything it generated goes
+    std::error_code ec;
+    const fs::path cache = fs::path(buildDir) / "CMakeCache.txt";
+    std::string reason = reconfigure ? "requested" : GetConfigureReason(state, buildDir);
+    if (fs::exists(cache, ec) && (ReadCMakeCacheEntry(cache, "CMAKE_GENERATOR") == "Ninja") != state.buildUseNinja) {
+        fs::remove(cache, ec);
+        fs::remove_all(fs::path(buildDir) / "CMakeFiles", ec);
+        reason = "generator changed";
+    }
+
+    // Only configure when something CMake reads has changed; the stamp is touched only once
+    // configuring succeeded, so a failed configure is retried on the next build
+    std::string cmd;
+    if (!reason.empty()) {
+        state.console.Append("Configuring (" + reason + ")\n");
+        cmd += state.buildUseNinja ? "cmake .. -G Ninja" : "cmake ..";
+        cmd += std::string(" && cmake -E touch ") + kConfigureStamp + " && ";
+    }
+    else {
+        state.console.Append("Build tree is up to date, skipping configure\n");
+    }
+    const unsigned jobs = state.buildJobs > 0 ? state.buildJobs : std::max(1u, std::thread::hardware_concurrency());
+    cmd += "cmake --build . --parallel " + std::to_string(jobs);
+
+    // Run CMake in the background; UpdateBuild streams its output into the console
+    if (!state.buildProcess.Start(cmd, buildDir)) {
+        state.console.Append("Failed to execute build command\n");
+        return;
+    }
+    state.buildInProgress = true;
+}
+
+// Appends the lines the build printed since the last frame and reports the result once it ends
+void UpdateBuild(AppState& state) {
+    if (!state.buildInProgress)
+        return;
+
+    // Checked before taking the lines, so none can arrive after the summary
+    const bool running = state.buildProcess.IsRunning();
+
+    std::vector<std::string> lines;
+    state.buildProcess.TakeLines(lines);
+    std::set<std::string> changedFiles;
+    for (const auto& line : lines) {
+        Diagnostic diagnostic;
+        if (ParseDiagnostic(line, diagnostic)) {
+            AddProblem(state, std::move(diagnostic), changedFiles);
+        }
+        state.console.AddLine(line);
+    }
+
+    // Markers are handed to each editor once per frame, however many arrived for it
+    if (!changedFiles.empty()) {
+        for (auto& editor : state.editors) {
+            const auto markers = state.problemMarkers.find(PathKey(editor->GetFilePath()));
+            if (markers != state.problemMarkers.end() && changedFiles.count(markers->first)) {
+                editor->SetErrorMarkers(markers->second);
+            }
+        }
+    }
+
+    if (!running) {
+        char summary[128];
+        const double seconds = state.buildProcess.GetElapsedSeconds();
+        if (state.buildProcess.WasCancelled())
+            snprintf(summary, sizeof(summary), "Build cancelled after %.1f s\n", seconds);
+        else if (state.buildProcess.GetExitCode() == 0)
+            snprintf(summary, sizeof(summary), "Build succeeded in %.1f s\n", seconds);
+        else
+            snprintf(summary, sizeof(summary), "Build failed with exit code %d after %.1f s\n", state.buildProcess.GetExitCode(), seconds);
+        state.console.Append(summary);
+        state.buildInProgress = false;
+    }
+}
+
+// Records a diagnostic from the build and adds an error marker for it. Paths are resolved against
+// the build directory, where the compiler ran. changedFiles collects the files whose markers changed.
+void AddProblem(AppState& state, Diagnostic diagnostic, std::set<std::string>& changedFiles) {
+    fs::path path(diagnostic.file);
+    if (path.is_relative()) {
+        path = fs::path(state.projectPath) / "build" / path;
+    }
+    diagnostic.file = path.lexically_normal().string();
+
+    // Notes only explain the diagnostic before them and don't get a marker of their own. A header
+    // included by several sources reports the same problem once for each of them.
+    if (diagnostic.severity != Diagnostic::Severity::Note) {
+        const std::string key = PathKey(path);
+        const std::string text = (diagnostic.severity == Diagnostic::Severity::Error ? "error: " : "warning: ") + diagnostic.message;
+        std::string& marker = state.problemMarkers[key][diagnostic.line];
+        if (marker.find(text) == std::string::npos) {
+            if (!marker.empty()) marker += "\n";
+            marker += text;
+            changedFiles.insert(key);
+        }
+    }
+    state.problemCounts.Add(diagnostic.severity);
+    state.problems.push_back(std::move(diagnostic));
+}
+
+void ClearProblems(AppState& state) {
+    state.problems.clear();
+    state.problemCounts = DiagnosticCounts();
+    state.problemMarkers.clear();
+    for (auto& editor : state.editors) {
+        editor->SetErrorMarkers(TextEditor::ErrorMarkers());
+    }
+}
+
+// Opens the file of a problem and puts the cursor on it
+void ShowProblem(AppState& state, size_t index) {
+    const Diagnostic& problem = state.problems[index];
+    GoToLocation(state, problem.file, problem.line, problem.column);
+}
+
+void RenderProblems(AppState& state) {
+    ImGui::Begin("Problems");
+
+    ImGui::Text("%zu errors, %zu warnings", state.problemCounts.errors, state.problemCounts.warnings);
+    ImGui::Separator();
+
+    // Only the visible rows are submitted; clicking one jumps to its location
+    ImGui::BeginChild("ProblemList", ImVec2(0.0f, 0.0f), ImGuiChildFlags_None, ImGuiWindowFlags_HorizontalScrollbar);
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(state.problems.size()));
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+            const Diagnostic& problem = state.problems[row];
+            ImVec4 color = ImGui::GetStyleColorVec4(ImGuiCol_TextDisabled);
+            if (problem.severity == Diagnostic::Severity::Error)
+                color = ImVec4(1.0f, 0.4f, 0.4f, 1.0f);
+            else if (problem.severity == Diagnostic::Severity::Warning)
+                color = ImVec4(1.0f, 0.8f, 0.3f, 1.0f);
+
+            // The text is drawn over an unlabeled selectable, so messages can't clash with ImGui IDs
+            char location[64];
+            snprintf(location, sizeof(location), ":%d:%d: ", problem.line, problem.column);
+            const std::string text = fs::path(problem.file).filename().string() + location + problem.message;
+
+            ImGui::PushID(row);
+            const ImVec2 pos = ImGui::GetCursorPos();
+            if (ImGui::Selectable("##problem")) {
+                ShowProblem(state, row);
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("%s", problem.file.c_str());
+            }
+            ImGui::SetCursorPos(pos);
+            ImGui::TextColored(color, "%s", text.c_str());
+            ImGui::PopID();
+        }
+    }
+    clipper.End();
+    ImGui::EndChild();
+
+    ImGui::End();
+}
+
+// Applies what the file watcher saw change on disk to the project tree, and flags editors whose
+// file was changed elsewhere. Changes come in coalesced batches, and each directory they touch
+// is updated once per batch, so a big checkout doesn't make this quadratic.
+void UpdateProjectWatch(AppState& state) {
+    std::vector<FileWatcher::Change> changes;
+    if (state.projectWatcher.TakeChanges(changes)) {
+        state.console.Append("Lost track of file changes, scanning the project again\n");
+        ScanProjectDirectory(state, state.projectPath);
+        return;
+    }
+    if (changes.empty())
+        return;
+
+    struct DirectoryEdit {
+        std::set<std::string> removed;  // names of deleted files or directories
+        std::set<std::string> added;    // full paths of new files
+    };
+    std::map<std::string, DirectoryEdit> edits;
+
+    std::map<std::string, CustomTextEditor*> editorsByKey;
+    for (auto& editor : state.editors) {
+        editorsByKey[PathKey(editor->GetFilePath())] = editor.get();
+    }
+
+    for (const auto& change : changes) {
+        const fs::path path(change.path);
+        if (change.isDirectory) {
+            FindDirectoryNode(state, path, true);
+        }
+        else if (!change.exists) {
+            edits[path.parent_path().string()].removed.insert(path.filename().string());
+        }
+        else if (ProjectScanner::IsProjectFile(change.path)) {
+            edits[path.parent_path().string()].added.insert(change.path);
+        }
+        if (!change.isDirectory && (!change.exists || ProjectScanner::IsProjectFile(change.path))) {
+            state.trigramIndex.Update(change.path);
+        }
+
+        if (!change.isDirectory && !editorsByKey.empty()) {
+            const auto editor = editorsByKey.find(PathKey(path));
+            if (editor != editorsByKey.end()) {
+                const bool wasChanged = editor->second->IsChangedOnDisk();
+                if (editor->second->CheckChangedOnDisk() && !wasChanged) {
+                    state.console.Append("Changed on disk: " + change.path + "\n");
+                }
+            }
+        }
+    }
+
+    for (auto& [directory, edit] : edits) {
+        DirectoryNode* node = FindDirectoryNode(state, directory, !edit.added.empty());
+        if (node == nullptr)
+            continue;
+
+        for (const auto& name : edit.removed) {
+            const auto subdirectory = node->subdirectories.find(name);
+            if (subdirectory == node->subdirectories.end())
+                continue;
+            if (state.scanInProgress) {
+                ForgetScannedNodes(state, subdirectory->second);
+            }
+            node->subdirectories.erase(subdirectory);
+        }
+        // New files the tree already has were only written to, or the scan got there first
+        auto& files = node->files;
+        files.erase(std::remove_if(files.begin(), files.end(), [&](const ProjectFile& file) {
+            return edit.removed.count(file.name) != 0;
+        }), files.end());
+        for (const auto& file : files) {
+            edit.added.erase(file.fullPath);
+        }
+        for (const auto& file : edit.added) {
+            files.emplace_back(file);
+        }
+    }
+    state.explorerRowsDirty = true;
+    ++state.treeVersion;
+}
+
+// Drops the scan's references to node and everything below it before they are removed from the
+// tree, so results still coming in for them are ignored
+void ForgetScannedNodes(AppState& state, const DirectoryNode& node) {
+    std::set<const DirectoryNode*> removed;
+    std::vector<const DirectoryNode*> pending{ &node };
+    while (!pending.empty()) {
+        const DirectoryNode* current = pending.back();
+        pending.pop_back();
+        removed.insert(current);
+        for (const auto& [name, subdirectory] : current->subdirectories) {
+            pending.push_back(&subdirectory);
+        }
+    }
+    for (auto& scanned : state.scannedNodes) {
+        if (removed.count(scanned) != 0)
+            scanned = nullptr;
+    }
+}
+
+// Returns the tree node of a directory inside the project, creating it and the ones above it if
+// asked to, or nullptr
+DirectoryNode* FindDirectoryNode(AppState& state, const fs::path& path, bool create) {
+    const fs::path relative = path.lexically_relative(state.projectRoot.fullPath);
+    if (relative.empty() || *relative.begin() == "..")
+        return nullptr;
+
+    DirectoryNode* node = &state.projectRoot;
+    fs::path nodePath = state.projectRoot.fullPath;
+    for (const auto& part : relative) {
+        if (part == ".")
+            continue;
+        nodePath /= part;
+        const std::string name = part.string();
+        auto it = node->subdirectories.find(name);
+        if (it == node->subdirectories.end()) {
+            if (!create)
+                return nullptr;
+            it = node->subdirectories.emplace(name, DirectoryNode()).first;
+            it->second.name = name;
+            it->second.fullPath = nodePath.string();
+        }
+        node = &it->second;
+    }
+    return node;
+}
+
+// Returns the value of key in a CMakeCache.txt ("KEY:TYPE=value" lines), or an empty string
+std::string ReadCMakeCacheEntry(const fs::path& cache, const std::string& key) {
+    std::ifstream in(cache);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, key.size(), key) != 0 || line.size() <= key.size() || line[key.size()] != ':')
+            continue;
+        const size_t equals = line.find('=', key.size());
+        if (equals != std::string::npos)
+            return line.substr(equals + 1);
+    }
+    return std::string();
+}
+
+// Returns why the build tree needs a CMake configure run, or an empty string when the last
+// configure is newer than the toolchain file and every CMakeLists.txt and *.cmake file of the
+// project. The project files are taken from the scanned tree, so only they are looked at on disk;
+// anything that can't be checked counts as changed. CMakeCache.txt isn't compared: cmake --build
+// rewrites it whenever it regenerates, which it does by itself after the cache was edited.
+std::string GetConfigureReason(const AppState& state, const fs::path& buildDir) {
+    std::error_code ec;
+    const fs::path cache = buildDir / "CMakeCache.txt";
+    if (!fs::exists(cache, ec))
+        return "no CMakeCache.txt";
+
+    const auto configured = fs::last_write_time(buildDir / kConfigureStamp, ec);
+    if (ec)
+        return "not configured by LightEdit yet";
+
+    auto isNewer = [configured](const fs::path& path) {
+        std::error_code ec;
+        const auto time = fs::last_write_time(path, ec);
+        return ec || time > configured;
+    };
+
+    const std::string toolchain = ReadCMakeCacheEntry(cache, "CMAKE_TOOLCHAIN_FILE");
+    if (!toolchain.empty() && isNewer(toolchain))
+        return "toolchain file changed";
+
+    if (state.scanInProgress)
+        return "project still being scanned";
+
+    // Skips the build tree itself and hidden directories such as .git
+    std::vector<const DirectoryNode*> pending{ &state.projectRoot };
+    while (!pending.empty()) {
+        const DirectoryNode* node = pending.back();
+        pending.pop_back();
+        for (const auto& [name, subdirectory] : node->subdirectories) {
+            if (name.front() != '.' && !(node == &state.projectRoot && name == "build"))
+                pending.push_back(&subdirectory);
+        }
+        for (const auto& file : node->files) {
+            if ((file.name == "CMakeLists.txt" || fs::path(file.name).extension() == ".cmake") && isNewer(file.fullPath))
+                return fs::path(file.fullPath).lexically_relative(state.projectPath).string() + " changed";
+        }
+    }
+    return std::string();
+}
 
-    // Execute command and capture output
-    std::array<char, 128> buffer;
-    std::string result;
+// Colorizes the active file with every regex-based language, once through std::regex and once
+// through the compiled token DFA, and logs both throughputs to the console. Runs on a worker
+// thread; the lines to colorize are copied first.
+void BenchmarkHighlighting(AppState& state) {
+    HighlightBenchmark& benchmark = state.highlightBenchmark;
+    if (benchmark.running || state.activeEditorIndex < 0 || state.activeEditorIndex >= static_cast<int>(state.editors.size()))
+        return;
 
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
-        state.buildOutput += "Failed to execute build command\n";
+    auto& editor = state.editors[state.activeEditorIndex];
+    if (editor->IsMapped()) {
+        state.console.Append("Benchmark is not available for memory-mapped files\n");
         return;
     }
 
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        result += buffer.data();
+    // std::regex only manages a few MB/s, so the first MB is plenty
+    constexpr size_t kMaxBytes = 1u << 20;
+    std::vector<std::string> lines;
+    size_t bytes = 0;
+    for (auto& line : editor->GetTextLines()) {
+        if (bytes >= kMaxBytes) break;
+        bytes += line.size();
+        lines.push_back(std::move(line));
     }
 
-    int returnCode = pclose(pipe);
+    state.console.Append("Highlighting benchmark: " + editor->GetFilePath() + "\n");
+
+    std::vector<std::pair<const char*, TextEditor::LanguageDefinitionPtr>> languages = {
+        { "HLSL", TextEditor::LanguageDefinition::HLSL() },
+        { "GLSL", TextEditor::LanguageDefinition::GLSL() },
+        { "SQL", TextEditor::LanguageDefinition::SQL() },
+        { "AngelScript", TextEditor::LanguageDefinition::AngelScript() },
+        { "Lua", TextEditor::LanguageDefinition::Lua() },
+    };
+
+    if (benchmark.thread.joinable())
+        benchmark.thread.join();
+    benchmark.running = true;
+    benchmark.cancelled = false;
+    benchmark.thread = std::thread([&benchmark, lines = std::move(lines), languages = std::move(languages)] {
+        for (const auto& [name, language] : languages) {
+            if (benchmark.cancelled)
+                break;
+            auto result = TextEditor::BenchmarkTokenizer(language, lines);
+
+            char buffer[256];
+            auto throughput = [&result](double seconds) { return seconds > 0.0 ? result.mBytes / seconds / 1e6 : 0.0; };
+            if (result.mDfaCompiled) {
+                snprintf(buffer, sizeof(buffer), "  %-12s %zu bytes: std::regex %.1f MB/s, DFA %.1f MB/s (%.1fx), %zu mismatched chars\n",
+                    name, result.mBytes, throughput(result.mRegexSeconds), throughput(result.mDfaSeconds),
+                    result.mDfaSeconds > 0.0 ? result.mRegexSeconds / result.mDfaSeconds : 0.0, result.mMismatches);
+            }
+            else {
+                snprintf(buffer, sizeof(buffer), "  %-12s %zu bytes: std::regex %.1f MB/s, token regexes could not be compiled to a DFA\n",
+                    name, result.mBytes, throughput(result.mRegexSeconds));
+            }
+
+            std::lock_guard<std::mutex> lock(benchmark.mutex);
+            benchmark.output += buffer;
+            FrameScheduler::Wake();
+        }
+        benchmark.running = false;
+        FrameScheduler::Wake();
+    });
+}
+
+// Moves what the benchmark printed since the last frame into the console
+void UpdateHighlightBenchmark(AppState& state) {
+    HighlightBenchmark& benchmark = state.highlightBenchmark;
+    if (!benchmark.thread.joinable())
+        return;
 
-    state.buildOutput += result;
-    state.buildOutput += returnCode == 0 ? "Build succeeded!\n" : "Build failed!\n";
-}
\ No newline at end of file
+    // Checked before taking the output, so none can arrive after the thread is joined
+    const bool running = benchmark.running;
+    std::string output;
+    {
+        std::lock_guard<std::mutex> lock(benchmark.mutex);
+        output.swap(benchmark.output);
+    }
+    if (!output.empty())
+        state.console.Append(output);
+    if (!running)
+        benchmark.thread.join();
+}
+
+void SetWordWrap(AppState& state, bool wrap) {
+    state.wordWrap = wrap;
+    for (auto& editor : state.editors) {
+        editor->SetWordWrap(wrap);
+    }
+}